@@ -0,0 +1,139 @@
+/**
+  @file ai.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Computer player. Predicts where ball will cross its stick plane and moves there.
+
+  Between stick hits ball moves in a straight line bouncing on walls, so its crossing point with
+  a plane is found in closed form by unfolding the reflections: position on each axis is moved
+  freely and folded back into the range between walls. Prediction is made once each time player
+  returns the ball. Difficulty is how long computer takes to react, how fast its stick moves and
+  how far from the predicted point it aims.
+ */
+
+#include "ai.h"
+#include <math.h>
+#include <string.h>
+
+static const AI_DIFFICULTY difficulties[] = {
+    // reaction time (s), max stick speed (stage units/s), aim error (relative to half stick)
+    { 0.25f, 0.6f, 1.6f },
+    { 0.12f, 1.0f, 1.3f },
+    { 0.06f, 1.6f, 1.25f }
+};
+
+static const char* level_names[] = { "easy", "normal", "hard" };
+
+void ai_set_level(GameContext* ctx, AI_LEVEL level)
+{
+    ctx->ai = difficulties[level];
+}
+
+/**
+  Parses a level name (easy, normal, hard). Returns -1 if name is unknown.
+ */
+int ai_parse_level(const char* name, AI_LEVEL* level)
+{
+    for (int i = 0; i <= AI_HARD; i++) {
+        if (!strcmp(name, level_names[i])) {
+            *level = (AI_LEVEL)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+  Folds a coordinate that moved freely back into [min, max], as if it had bounced on both limits.
+ */
+float fold_coordinate(float position, float min, float max)
+{
+    float range = max - min;
+    float offset;
+    if (range <= 0.0f) {
+        return min;
+    }
+    offset = fmodf(position - min, 2.0f * range);
+    if (offset < 0.0f) {
+        offset += 2.0f * range;
+    }
+    if (offset > range) {
+        offset = 2.0f * range - offset;
+    }
+    return min + offset;
+}
+
+/**
+  Computes where ball center will be when it reaches plane_z, bouncing on walls. Returns 0 and
+  sets out (x, y) or -1 if ball doesn't move towards the plane.
+ */
+int predict_intercept(const GameContext* ctx, float plane_z, float* out)
+{
+    const BODY* ball = &ctx->ball;
+    const float* velocity = ctx->ball_speed_vector;
+    float time;
+
+    if (velocity[2] == 0.0f) {
+        return -1;
+    }
+    time = (plane_z - ball->z) / velocity[2];
+    if (time < 0.0f) {
+        return -1;
+    }
+    out[0] = fold_coordinate(ball->x + velocity[0] * time, -ctx->stage.width2 + ball->width, ctx->stage.width2 - ball->width);
+    out[1] = fold_coordinate(ball->y + velocity[1] * time, -ctx->stage.height2 + ball->width, ctx->stage.height2 - ball->width);
+    return 0;
+}
+
+static float ai_random(GameContext* ctx)
+{
+    return (game_random(ctx) & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+}
+
+static void ai_react(void* owner, TIMER* timer)
+{
+    (void)timer;
+    ((GameContext*)owner)->ai_moving = true;
+}
+
+/**
+  Chooses where computer stick goes after ball velocity changed. Call it when ball has been
+  returned by player and its deflection applied.
+ */
+void ai_plan(GameContext* ctx)
+{
+    float intercept[2];
+    if (predict_intercept(ctx, ctx->opponent_stick.z + ctx->ball.width, intercept) < 0) {
+        intercept[0] = ctx->ball.x;
+        intercept[1] = ctx->ball.y;
+    }
+    ctx->ai_target[0] = intercept[0] + ai_random(ctx) * ctx->ai.aim_error * ctx->opponent_stick.width2;
+    ctx->ai_target[1] = intercept[1] + ai_random(ctx) * ctx->ai.aim_error * ctx->opponent_stick.height2;
+    ctx->ai_moving = false;
+    if (SECONDS_TO_TICKS(ctx->ai.reaction_time) > 0) {
+        timer_schedule(&ctx->timers, &ctx->ai_timer, SECONDS_TO_TICKS(ctx->ai.reaction_time), ai_react);
+    } else {
+        ctx->ai_moving = true;
+    }
+}
+
+/**
+  Moves computer stick one tick towards its target, once its reaction time is over.
+ */
+void ai_move(GameContext* ctx)
+{
+    float dx, dy, distance, max_step;
+
+    if (!ctx->ai_moving) {
+        return;
+    }
+    dx = ctx->ai_target[0] - ctx->opponent_stick.x;
+    dy = ctx->ai_target[1] - ctx->opponent_stick.y;
+    distance = sqrtf(dx * dx + dy * dy);
+    max_step = ctx->ai.max_speed * TICK_TIME;
+    if (distance > max_step) {
+        dx *= max_step / distance;
+        dy *= max_step / distance;
+    }
+    move_opponent_stick(ctx, ctx->opponent_stick.x + dx, ctx->opponent_stick.y + dy);
+}
@@ -0,0 +1,26 @@
+/**
+  @file ai.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Computer player. Predicts where ball will cross its stick plane and moves there.
+ */
+
+#ifndef _AI_H_
+#define _AI_H_
+
+#include "pong3d.h"
+
+typedef enum {
+    AI_EASY,
+    AI_NORMAL,
+    AI_HARD
+} AI_LEVEL;
+
+void ai_set_level(GameContext* ctx, AI_LEVEL level);
+int ai_parse_level(const char* name, AI_LEVEL* level);
+float fold_coordinate(float position, float min, float max);
+int predict_intercept(const GameContext* ctx, float plane_z, float* out);
+void ai_plan(GameContext* ctx);
+void ai_move(GameContext* ctx);
+
+#endif
@@ -0,0 +1,23 @@
+/**
+  @file atomics.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Atomic operations on ints shared by two threads, for lock-free buffers and queues.
+ */
+
+#ifndef _ATOMICS_H_
+#define _ATOMICS_H_
+
+#ifdef _MSC_VER
+#include <intrin.h>
+// volatile accesses have acquire and release semantics in MSVC
+#define atomic_load_acquire(ptr) (*(ptr))
+#define atomic_store_release(ptr, value) (*(ptr) = (value))
+#define atomic_exchange(ptr, value) _InterlockedExchange((volatile long*)(ptr), (value))
+#else
+#define atomic_load_acquire(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define atomic_store_release(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define atomic_exchange(ptr, value) __atomic_exchange_n((ptr), (value), __ATOMIC_ACQ_REL)
+#endif
+
+#endif
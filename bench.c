@@ -0,0 +1,468 @@
+/**
+  @file bench.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Audio benchmarks. Times sound synthesis without audio device and checks its output
+  against the original per sample synthetizer.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "clip.h"
+#include "math_constants.h"
+#include "mixer.h"
+#include "music.h"
+#include "patches.h"
+#include "reverb.h"
+#include "synth.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// max difference allowed between block synthetizer and reference one, relative to full scale
+#define SYNTH_TOLERANCE 1e-3f
+
+// renders of each patch timed by synth benchmark
+#define SYNTH_BENCH_ITERATIONS 50
+
+// min speedup of block synthetizer over reference one for each sound made of sines and cosines,
+// the target, and for sounds with triangle or saw oscillators, which fall short of it: their
+// filter runs sample by sample and they take about 1 ns per sample against 3-5 ns of reference
+#define SYNTH_MIN_SPEEDUP 20.0
+#define SYNTH_MIN_FILTERED_SPEEDUP 2.5
+
+// device buffer of voices benchmark, in frames
+#define BENCH_BUFFER_FRAMES 512
+
+// seconds of audio run through reverb for each impulse response
+#define REVERB_BENCH_SECONDS 4
+
+// seconds of music rendered at each speed
+#define MUSIC_BENCH_SECONDS 120
+
+// min signal to noise ratio of sounds stored as 16 bit PCM, in dB; ADPCM ones must keep CLIP_MIN_SNR
+#define CLIP_MIN_SNR_PCM16 60.0
+
+static double elapsed_seconds(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static float reference_oscillator(OSCILLATOR_TYPE type, float* ang, float incr)
+{
+    double value = 0.0;
+    switch (type) {
+    case SIN:
+        value = sin(*ang);
+        *ang += incr;
+        if (*ang >= P_2PI)
+            *ang -= P_2PI;
+        break;
+    case TRIANGLE: {
+        double triValue = *ang * M_PI_2;
+        *ang += incr;
+        if (triValue < 0.0)
+            value = 1.0 + triValue;
+        else
+            value = 1.0 - triValue;
+        if (*ang >= M_PI)
+            *ang -= P_2PI;
+    } break;
+    case SAW:
+        value = (*ang / M_PI) - 1.0;
+        *ang += incr;
+        if (*ang >= P_2PI)
+            *ang -= P_2PI;
+        break;
+    case COS:
+        value = cos(*ang);
+        *ang += incr;
+        if (*ang >= P_2PI)
+            *ang -= P_2PI;
+        break;
+    case NONE:
+        value = 0;
+    }
+    return (float)value;
+}
+
+/**
+  Original synthetizer, one sample at a time, as reference for output and speed.
+ */
+static int reference_synthetize(const SYNTH* synthParams, sample_t* samples, int sample_freq)
+{
+    int state = 0;
+    float value;
+    float oldValue = 0.0f;
+    float volume = synthParams->volume;
+
+    int samples_count = (int)((float)sample_freq * synthParams->totalTime);
+
+    int attackTimeSamples = (int)(synthParams->attackTime * (float)sample_freq);
+    int decayTimeSamples = (int)(synthParams->decayTime * (float)sample_freq);
+    int releaseTimeSamples = (int)(synthParams->releaseTime * (float)sample_freq);
+
+    int envCount = attackTimeSamples;
+    float slope = volume / (float)attackTimeSamples;
+
+    float phaseIncrOsc1 = (P_2PI / (float)sample_freq) * synthParams->oscillator1_freq;
+    float phaseIncrOsc2 = (P_2PI / (float)sample_freq) * synthParams->oscillator2_freq;
+    float phase1 = 0.0f;
+    float phase2 = 0.0f;
+
+    for (int i = 0; i < samples_count; i++) {
+        value = reference_oscillator(synthParams->oscillator1_type, &phase1, phaseIncrOsc1);
+        if (synthParams->oscillator2_type != NONE) {
+            value = value * reference_oscillator(synthParams->oscillator2_type, &phase2, phaseIncrOsc2);
+        }
+        value = (synthParams->filterBeta1 * value) + (synthParams->filterBeta2 * oldValue);
+        oldValue = value;
+
+        switch (state) {
+        case 0:
+            if (envCount > 0) {
+                volume += slope;
+                envCount--;
+            } else {
+                state = 1;
+                envCount = decayTimeSamples;
+                slope = (volume - synthParams->decayValue) / (float)decayTimeSamples;
+            }
+            // falls through
+        case 1:
+            if (envCount > 0) {
+                envCount--;
+                volume -= slope;
+            } else {
+                state = 2;
+                envCount = releaseTimeSamples;
+                slope = volume / (float)releaseTimeSamples;
+            }
+            break;
+        case 2:
+            if (envCount > 0) {
+                envCount--;
+                volume -= slope;
+            } else {
+                state = -1;
+                volume = 0.0f;
+            }
+            break;
+        }
+        samples[i] = (sample_t)(volume * value);
+    }
+
+    int delaySamples = (int)(synthParams->delayTime * (float)sample_freq);
+    if (delaySamples > 0) {
+        for (int i = 0; i < samples_count - delaySamples; i++) {
+            samples[i + delaySamples] += samples[i] * (sample_t)synthParams->reverbSize;
+        }
+    }
+    return samples_count;
+}
+
+static void reference_render(const SYNTH* synth, sample_t* samples, int sample_rate)
+{
+    reference_synthetize(synth, samples, sample_rate);
+}
+
+typedef void (*SynthRender)(const SYNTH* synth, sample_t* samples, int sample_rate);
+
+/**
+  Seconds of the fastest of iterations renders, so other work of the machine doesn't count.
+ */
+static double fastest_render(SynthRender render, const SYNTH* synth, sample_t* samples, int sample_rate, int iterations)
+{
+    double fastest = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        struct timespec start;
+        double seconds;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        render(synth, samples, sample_rate);
+        seconds = elapsed_seconds(&start);
+        if (i == 0 || seconds < fastest) {
+            fastest = seconds;
+        }
+    }
+    return fastest;
+}
+
+/**
+  Speedup a patch must reach: SYNTH_MIN_SPEEDUP if the block synthetizer renders it as sinusoids,
+  else SYNTH_MIN_FILTERED_SPEEDUP.
+ */
+static double min_speedup(const SYNTH* synth, int sample_rate)
+{
+    SYNTH_VOICE voice;
+    synth_voice_start(&voice, synth, sample_rate);
+    return voice.sinusoids ? SYNTH_MIN_SPEEDUP : SYNTH_MIN_FILTERED_SPEEDUP;
+}
+
+/**
+  Renders every game sound with the reference and the block synthetizer. Returns number of
+  sounds whose output differs more than SYNTH_TOLERANCE or that aren't min_speedup times faster.
+ */
+static int synth_bench(int sample_rate, int iterations)
+{
+    double reference_total = 0.0, block_total = 0.0;
+    long long total_samples = 0;
+    int failures = 0;
+
+    printf("synth: %d Hz, fastest of %d renders per sound, blocks of %d samples\n", sample_rate, iterations, SYNTH_BLOCK);
+    for (int patch = 0; patch < PATCHES_COUNT; patch++) {
+        const SYNTH* synth = &sound_patches[patch];
+        int count = synth_length(synth, sample_rate);
+        sample_t* reference = (sample_t*)malloc(sizeof(sample_t) * count);
+        sample_t* block = (sample_t*)malloc(sizeof(sample_t) * count);
+        double reference_seconds, block_seconds, speedup, required = min_speedup(synth, sample_rate);
+        float max_error = 0.0f;
+
+        reference_seconds = fastest_render(reference_render, synth, reference, sample_rate, iterations);
+        // synthetize without allocation
+        block_seconds = fastest_render(synth_render, synth, block, sample_rate, iterations);
+        speedup = reference_seconds / block_seconds;
+
+        for (int i = 0; i < count; i++) {
+            float error = fabsf(block[i] - reference[i]);
+            if (error > max_error) {
+                max_error = error;
+            }
+        }
+        failures += max_error > SYNTH_TOLERANCE || speedup < required;
+        printf("  %-14s %6d samples, reference %7.2f ns/sample, block %6.2f ns/sample, %5.1fx of %4.1fx, max error %.2e%s%s\n",
+            sound_patch_names[patch], count, reference_seconds * 1e9 / count, block_seconds * 1e9 / count, speedup, required,
+            max_error, max_error > SYNTH_TOLERANCE ? " (over tolerance)" : "", speedup < required ? " (too slow)" : "");
+        reference_total += reference_seconds;
+        block_total += block_seconds;
+        total_samples += count;
+        free(reference);
+        free(block);
+    }
+    printf("  all sounds: reference %.2f ns/sample, block %.2f ns/sample, %.1fx faster\n",
+        reference_total * 1e9 / total_samples, block_total * 1e9 / total_samples, reference_total / block_total);
+    return failures;
+}
+
+/**
+  Plays every hit patch on all mixer voices at once, synthetized live with varying pitch and pan,
+  and mixes them in device buffers until they end. Reports cost of a voice as share of one core.
+ */
+static void voices_bench(int sample_rate, int iterations)
+{
+    static const PATCH_ID hit_patches[] = { PLAYER_PONG_PATCH, OPPONENT_PONG_PATCH, WALL_HIT_PATCH };
+    static MIXER mixer;
+    static float out[BENCH_BUFFER_FRAMES * MIXER_CHANNELS];
+    MIXER_SYNTH_STATS stats;
+    struct timespec start;
+    double seconds;
+    long long buffers = 0;
+
+    mixer_init(&mixer, monotonic_ns);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < iterations; i++) {
+        int playing = 0;
+        for (int v = 0; v < MIXER_VOICES; v++) {
+            SYNTH_VOICE voice;
+            synth_voice_start(&voice, &sound_patches[hit_patches[v % 3]], sample_rate);
+            synth_voice_transpose(&voice, 1.0f + v / (float)MIXER_VOICES);
+            mixer_play_synth(&mixer, &voice, 0.5f, v / (float)MIXER_VOICES * 2.0f - 1.0f, 0);
+            if (voice.length > playing) {
+                playing = voice.length;
+            }
+        }
+        for (int done = 0; done < playing; done += BENCH_BUFFER_FRAMES) {
+            mixer_render(&mixer, out, BENCH_BUFFER_FRAMES);
+            buffers++;
+        }
+    }
+    seconds = elapsed_seconds(&start);
+    mixer_synth_stats(&mixer, &stats);
+    printf("voices: %d live voices at %d Hz, buffers of %d frames\n", MIXER_VOICES, sample_rate, BENCH_BUFFER_FRAMES);
+    printf("  synthesis %.2f ns/sample, %.3f%% of a core per voice; mixing %.1f us per buffer\n",
+        stats.frame_ns, stats.frame_ns * sample_rate / 1e7, seconds * 1e6 / buffers);
+}
+
+/**
+  Runs noise through reverbs of generated impulse responses from 0.1 to 3 seconds. Reports time
+  per block of REVERB_PARTITION samples, as share of one core, and memory of each reverb.
+ */
+static int reverb_bench(int sample_rate)
+{
+    static const float ir_seconds[] = { 0.1f, 0.3f, 1.0f, 2.0f, 3.0f };
+    static float out[BENCH_BUFFER_FRAMES * 2];
+    int buffers = REVERB_BENCH_SECONDS * sample_rate / BENCH_BUFFER_FRAMES;
+    uint32_t noise = 1;
+
+    printf("reverb: %d Hz, blocks of %d samples (%.1f ms)\n", sample_rate, REVERB_PARTITION, REVERB_PARTITION * 1000.0 / sample_rate);
+    for (int i = 0; i < (int)(sizeof(ir_seconds) / sizeof(ir_seconds[0])); i++) {
+        int length = (int)(ir_seconds[i] * sample_rate);
+        float* impulse_response = (float*)malloc(sizeof(float) * length);
+        REVERB reverb;
+        struct timespec start;
+        double block_us;
+
+        if (!impulse_response) {
+            return 1;
+        }
+        reverb_generate_ir(impulse_response, length, 1977);
+        if (reverb_create(&reverb, impulse_response, length, 0.5f) < 0) {
+            free(impulse_response);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int b = 0; b < buffers; b++) {
+            for (int f = 0; f < BENCH_BUFFER_FRAMES * 2; f++) {
+                noise ^= noise << 13;
+                noise ^= noise >> 17;
+                noise ^= noise << 5;
+                out[f] = (noise >> 8) / 16777216.0f - 0.5f;
+            }
+            reverb_process(&reverb, out, BENCH_BUFFER_FRAMES);
+        }
+        block_us = elapsed_seconds(&start) * 1e6 / ((double)buffers * BENCH_BUFFER_FRAMES / REVERB_PARTITION);
+        printf("  %.1f s impulse response, %4d partitions: %7.1f us per block, %5.2f%% of a core, %6d KB\n",
+            ir_seconds[i], reverb.partitions, block_us, block_us * sample_rate / REVERB_PARTITION / 1e4,
+            reverb_memory(&reverb) / 1024);
+        reverb_dispose(&reverb);
+        free(impulse_response);
+    }
+    return 0;
+}
+
+/**
+  Stores every patch as 16 bit PCM and as IMA-ADPCM. Reports memory against float samples, signal
+  to noise ratio and time to mix a clip into stereo buffers, against mixing float samples. Returns
+  count of clips under their min signal to noise ratio; ADPCM only has one for patches the game
+  stores as clips.
+ */
+static int clips_bench(int sample_rate, int iterations)
+{
+    static const CLIP_FORMAT formats[] = { CLIP_PCM16, CLIP_ADPCM };
+    static const float gains[2] = { 0.7f, 0.3f };
+    static float out[BENCH_BUFFER_FRAMES * 2];
+    int failures = 0;
+
+    printf("clips: %d Hz, mixed in buffers of %d frames\n", sample_rate, BENCH_BUFFER_FRAMES);
+    for (int patch = 0; patch < PATCHES_COUNT; patch++) {
+        sample_t* samples;
+        int length = synthetize(&sound_patches[patch], &samples, sample_rate);
+        int stored = 0;
+        struct timespec start;
+        double float_ns;
+
+        for (int c = 0; c < CLIP_PATCHES_COUNT; c++) {
+            stored |= clip_patches[c] == (PATCH_ID)patch;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < iterations; i++) {
+            for (int done = 0; done < length; done += BENCH_BUFFER_FRAMES) {
+                int count = length - done < BENCH_BUFFER_FRAMES ? length - done : BENCH_BUFFER_FRAMES;
+                for (int f = 0; f < count; f++) {
+                    out[f * 2] += samples[done + f] * gains[0];
+                    out[f * 2 + 1] += samples[done + f] * gains[1];
+                }
+            }
+        }
+        float_ns = elapsed_seconds(&start) * 1e9 / iterations / length;
+        printf("  %-14s %6d samples, float %7d bytes, mix %.2f ns/sample\n", sound_patch_names[patch], length,
+            length * (int)sizeof(sample_t), float_ns);
+
+        for (int f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++) {
+            SOUND_CLIP clip;
+            double snr, min_snr = formats[f] == CLIP_PCM16 ? CLIP_MIN_SNR_PCM16 : stored ? CLIP_MIN_SNR : 0.0;
+
+            if (clip_encode(&clip, samples, length, formats[f]) < 0) {
+                failures++;
+                continue;
+            }
+            snr = clip_snr(&clip, samples);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int i = 0; i < iterations; i++) {
+                for (int done = 0; done < length; done += BENCH_BUFFER_FRAMES) {
+                    int count = length - done < BENCH_BUFFER_FRAMES ? length - done : BENCH_BUFFER_FRAMES;
+                    clip_mix(&clip, done, count, gains, out);
+                }
+            }
+            printf("    %-9s %7d bytes, %4.1fx smaller, snr %5.1f dB, mix %.2f ns/sample%s\n",
+                clip_format_name(formats[f]), clip.bytes, (double)length * sizeof(sample_t) / clip.bytes, snr,
+                elapsed_seconds(&start) * 1e9 / iterations / length, snr < min_snr ? " (under min snr)" : "");
+            failures += snr < min_snr;
+            clip_dispose(&clip);
+        }
+        free_samples(samples);
+    }
+    return failures;
+}
+
+/**
+  Renders background music at song tempo and at max speed. Returns 1 if it takes more than
+  MUSIC_CPU_BUDGET of one core.
+ */
+static int music_bench(int sample_rate)
+{
+    static const float speeds[] = { 1.0f, MUSIC_MAX_SPEED };
+    static float out[BENCH_BUFFER_FRAMES * 2];
+    static SEQUENCER sequencer;
+    int buffers = MUSIC_BENCH_SECONDS * sample_rate / BENCH_BUFFER_FRAMES;
+    int over_budget = 0;
+
+    printf("music: %d s at %d Hz, sequencer of %d bytes, budget %.1f%% of a core\n", MUSIC_BENCH_SECONDS, sample_rate,
+        (int)sizeof(SEQUENCER), MUSIC_CPU_BUDGET * 100.0);
+    for (int i = 0; i < (int)(sizeof(speeds) / sizeof(speeds[0])); i++) {
+        struct timespec start;
+        double load;
+
+        sequencer_init(&sequencer, &background_song, sample_rate, 0.35f);
+        sequencer_set_speed(&sequencer, speeds[i]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int b = 0; b < buffers; b++) {
+            memset(out, 0, sizeof(out));
+            sequencer_render(&sequencer, out, BENCH_BUFFER_FRAMES);
+        }
+        load = elapsed_seconds(&start) / ((double)buffers * BENCH_BUFFER_FRAMES / sample_rate);
+        over_budget |= load > MUSIC_CPU_BUDGET;
+        printf("  speed %.1f: %.2f ns per frame, %.3f%% of a core%s\n", speeds[i],
+            load * 1e9 / sample_rate, load * 100.0, load > MUSIC_CPU_BUDGET ? " (over budget)" : "");
+    }
+    return over_budget;
+}
+
+/**
+  Usage: pong3d_bench [--sample-rate n] [--iterations n]
+  Returns 1 if any check fails.
+ */
+int main(int argc, char** argv)
+{
+    int sample_rate = 44100;
+    int iterations = SYNTH_BENCH_ITERATIONS;
+    int failures = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sample-rate") && i + 1 < argc) {
+            sample_rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        }
+    }
+    if (sample_rate < 8000 || iterations < 1) {
+        fprintf(stderr, "Invalid sample rate or iterations\n");
+        return 2;
+    }
+    failures += synth_bench(sample_rate, iterations);
+    voices_bench(sample_rate, iterations);
+    failures += clips_bench(sample_rate, iterations);
+    failures += reverb_bench(sample_rate);
+    failures += music_bench(sample_rate);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+/**
+  @file clip.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Rendered sounds stored as 16 bit PCM or IMA-ADPCM, decoded as they are mixed.
+
+  Sounds are normalized to their peak before they're stored. 16 bit samples take half the memory
+  of float ones and IMA-ADPCM about an eighth. ADPCM blocks start with an exact sample and the
+  step index, so each one is decoded on its own; its 4 bit codes depend on the previous sample and
+  are decoded one by one. Decoded 16 bit samples are converted, scaled by channel gains and added
+  to the stereo mix 4 at a time with SSE2.
+ */
+
+#include "clip.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CLIP_HAVE_SSE
+#include <emmintrin.h>
+#endif
+
+static const int adpcm_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+    73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408,
+    449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630,
+    9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int adpcm_index_changes[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// difference and next row of each step index row and code, so decoding a code takes two loads.
+// Filled by first clip_encode; clips are encoded before they're decoded.
+static int adpcm_differences[89 * 16];
+static unsigned short adpcm_next_row[89 * 16];
+static int adpcm_tables_ready = 0;
+
+static void adpcm_init_tables(void)
+{
+    for (int index = 0; index < 89; index++) {
+        for (int code = 0; code < 16; code++) {
+            // step * (magnitude + 1/2) / 4, middle of the range the encoder quantized the difference to
+            int difference = ((code & 7) * 2 + 1) * adpcm_steps[index] >> 3;
+            int next = index + adpcm_index_changes[code];
+            adpcm_differences[index * 16 + code] = code & 8 ? -difference : difference;
+            adpcm_next_row[index * 16 + code] = (unsigned short)((next < 0 ? 0 : (next > 88 ? 88 : next)) * 16);
+        }
+    }
+    adpcm_tables_ready = 1;
+}
+
+static short to_pcm16(sample_t sample, float scale)
+{
+    float scaled = sample * scale;
+    if (scaled > 32767.0f) {
+        return 32767;
+    }
+    if (scaled < -32768.0f) {
+        return -32768;
+    }
+    return (short)(scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f);
+}
+
+// applies a 4 bit code to predictor and step index, so encoder follows decoder
+static void adpcm_decode_code(int code, int* predictor, int* index)
+{
+    int value = *predictor + adpcm_differences[*index * 16 + code];
+
+    *predictor = value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+    *index = adpcm_next_row[*index * 16 + code] / 16;
+}
+
+static int adpcm_encode_sample(int sample, int* predictor, int* index)
+{
+    int difference = sample - *predictor;
+    int code = 0;
+    int magnitude;
+
+    if (difference < 0) {
+        code = 8;
+        difference = -difference;
+    }
+    magnitude = (difference << 2) / adpcm_steps[*index];
+    code |= magnitude > 7 ? 7 : magnitude;
+    adpcm_decode_code(code, predictor, index);
+    return code;
+}
+
+static void adpcm_encode_block(const sample_t* samples, int count, float scale, int* index, unsigned char* block)
+{
+    int predictor = to_pcm16(samples[0], scale);
+
+    memset(block, 0, ADPCM_BLOCK_BYTES);
+    block[0] = (unsigned char)(predictor & 0xFF);
+    block[1] = (unsigned char)((predictor >> 8) & 0xFF);
+    block[2] = (unsigned char)*index;
+    for (int i = 1; i < count; i++) {
+        int code = adpcm_encode_sample(to_pcm16(samples[i], scale), &predictor, index);
+        block[4 + (i - 1) / 2] |= (unsigned char)((i - 1) % 2 ? code << 4 : code);
+    }
+}
+
+static void adpcm_decode_block(const unsigned char* block, short* out)
+{
+    int predictor = (short)(block[0] | (block[1] << 8));
+    int row = block[2] * 16;
+
+    out[0] = (short)predictor;
+    for (int i = 1; i < ADPCM_BLOCK_SAMPLES; i++) {
+        int code = (block[4 + (i - 1) / 2] >> ((i - 1) % 2 * 4)) & 0x0F;
+        predictor += adpcm_differences[row + code];
+        predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+        row = adpcm_next_row[row + code];
+        out[i] = (short)predictor;
+    }
+}
+
+/**
+  Stores length samples in format. Returns -1 if clip data couldn't be allocated.
+ */
+int clip_encode(SOUND_CLIP* clip, const sample_t* samples, int length, CLIP_FORMAT format)
+{
+    int blocks = (length + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+    float peak = 0.0f;
+    float scale;
+
+    for (int i = 0; i < length; i++) {
+        float magnitude = samples[i] < 0.0f ? -samples[i] : samples[i];
+        peak = magnitude > peak ? magnitude : peak;
+    }
+    clip->scale = peak > 0.0f ? peak : 1.0f;
+    if (!adpcm_tables_ready) {
+        adpcm_init_tables();
+    }
+    scale = 32767.0f / clip->scale;
+
+    clip->format = format;
+    clip->length = length;
+    clip->bytes = format == CLIP_PCM16 ? length * (int)sizeof(short) : blocks * ADPCM_BLOCK_BYTES;
+    clip->data = (unsigned char*)malloc(clip->bytes > 0 ? clip->bytes : 1);
+    if (!clip->data) {
+        clip->length = clip->bytes = 0;
+        return -1;
+    }
+    if (format == CLIP_PCM16) {
+        short* pcm = (short*)clip->data;
+        for (int i = 0; i < length; i++) {
+            pcm[i] = to_pcm16(samples[i], scale);
+        }
+    } else {
+        int index = 0;
+        for (int b = 0; b < blocks; b++) {
+            int start = b * ADPCM_BLOCK_SAMPLES;
+            int count = length - start < ADPCM_BLOCK_SAMPLES ? length - start : ADPCM_BLOCK_SAMPLES;
+            adpcm_encode_block(samples + start, count, scale, &index, clip->data + b * ADPCM_BLOCK_BYTES);
+        }
+    }
+    return 0;
+}
+
+void clip_dispose(SOUND_CLIP* clip)
+{
+    free(clip->data);
+    clip->data = NULL;
+    clip->length = clip->bytes = 0;
+}
+
+// gains include the scale of stored samples
+static void mix_pcm16(const short* samples, int count, const float* gains, float* stereo)
+{
+    float left = gains[0];
+    float right = gains[1];
+    int i = 0;
+
+#ifdef CLIP_HAVE_SSE
+    __m128 left_scale = _mm_set1_ps(left);
+    __m128 right_scale = _mm_set1_ps(right);
+    for (; i + 4 <= count; i += 4) {
+        __m128i packed = _mm_loadl_epi64((const __m128i*)(samples + i));
+        // sign extend to 32 bits by shifting each sample down from the top half
+        __m128 values = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+        __m128 l = _mm_mul_ps(values, left_scale);
+        __m128 r = _mm_mul_ps(values, right_scale);
+        float* out = stereo + i * 2;
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_unpacklo_ps(l, r)));
+        _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_unpackhi_ps(l, r)));
+    }
+#endif
+    for (; i < count; i++) {
+        stereo[i * 2] += samples[i] * left;
+        stereo[i * 2 + 1] += samples[i] * right;
+    }
+}
+
+/**
+  Returns up to count samples from position, decoding their ADPCM block to block if needed.
+  Count of returned samples is stored in length.
+ */
+static const short* clip_stretch(const SOUND_CLIP* clip, int position, int count, short* block, int* length)
+{
+    int offset = position % ADPCM_BLOCK_SAMPLES;
+
+    if (clip->format == CLIP_PCM16) {
+        *length = count;
+        return (const short*)clip->data + position;
+    }
+    adpcm_decode_block(clip->data + position / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES, block);
+    *length = ADPCM_BLOCK_SAMPLES - offset < count ? ADPCM_BLOCK_SAMPLES - offset : count;
+    return block + offset;
+}
+
+/**
+  Adds count samples from position, scaled by left and right gains, to interleaved stereo frames.
+ */
+void clip_mix(const SOUND_CLIP* clip, int position, int count, const float* gains, float* stereo)
+{
+    short block[ADPCM_BLOCK_SAMPLES];
+    float scaled[2] = { gains[0] * clip->scale / 32767.0f, gains[1] * clip->scale / 32767.0f };
+
+    while (count > 0) {
+        int length;
+        const short* samples = clip_stretch(clip, position, count, block, &length);
+        mix_pcm16(samples, length, scaled, stereo);
+        stereo += length * 2;
+        position += length;
+        count -= length;
+    }
+}
+
+/**
+  Decodes count samples from position to out.
+ */
+void clip_decode(const SOUND_CLIP* clip, int position, int count, float* out)
+{
+    short block[ADPCM_BLOCK_SAMPLES];
+    float scale = clip->scale / 32767.0f;
+
+    while (count > 0) {
+        int length;
+        const short* samples = clip_stretch(clip, position, count, block, &length);
+        for (int i = 0; i < length; i++) {
+            out[i] = samples[i] * scale;
+        }
+        out += length;
+        position += length;
+        count -= length;
+    }
+}
+
+/**
+  Signal to noise ratio of a clip encoding samples, in dB. An exact clip gives CLIP_EXACT_SNR.
+ */
+double clip_snr(const SOUND_CLIP* clip, const sample_t* samples)
+{
+    float decoded[ADPCM_BLOCK_SAMPLES];
+    double signal = 0.0, noise = 0.0;
+
+    for (int done = 0; done < clip->length; done += ADPCM_BLOCK_SAMPLES) {
+        int count = clip->length - done < ADPCM_BLOCK_SAMPLES ? clip->length - done : ADPCM_BLOCK_SAMPLES;
+        clip_decode(clip, done, count, decoded);
+        for (int i = 0; i < count; i++) {
+            double error = (double)decoded[i] - samples[done + i];
+            signal += (double)samples[done + i] * samples[done + i];
+            noise += error * error;
+        }
+    }
+    return noise > 0.0 ? 10.0 * log10(signal / noise) : CLIP_EXACT_SNR;
+}
+
+/**
+  Encodes samples as format, or as 16 bit PCM if format keeps less than min_snr dB of them.
+  Signal to noise ratio of the stored clip goes to snr. Returns -1 if clip couldn't be stored.
+ */
+int clip_encode_min_snr(SOUND_CLIP* clip, const sample_t* samples, int length, CLIP_FORMAT format, double min_snr, double* snr)
+{
+    if (clip_encode(clip, samples, length, format) < 0) {
+        return -1;
+    }
+    *snr = clip_snr(clip, samples);
+    if (format != CLIP_PCM16 && *snr < min_snr) {
+        clip_dispose(clip);
+        if (clip_encode(clip, samples, length, CLIP_PCM16) < 0) {
+            return -1;
+        }
+        *snr = clip_snr(clip, samples);
+    }
+    return 0;
+}
+
+const char* clip_format_name(CLIP_FORMAT format)
+{
+    return format == CLIP_PCM16 ? "pcm16" : "ima-adpcm";
+}
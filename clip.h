@@ -0,0 +1,51 @@
+/**
+  @file clip.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Rendered sounds stored as 16 bit PCM or IMA-ADPCM, decoded as they are mixed.
+ */
+
+#ifndef _CLIP_H_
+#define _CLIP_H_
+
+#include "synth.h"
+
+// samples of an IMA-ADPCM block: first one in its header and the rest as 4 bit codes
+#define ADPCM_BLOCK_SAMPLES 129
+#define ADPCM_BLOCK_BYTES (4 + (ADPCM_BLOCK_SAMPLES - 1) / 2)
+
+// min signal to noise ratio of a stored clip, in dB; clips that compress under it are stored as 16 bit PCM
+#define CLIP_MIN_SNR 30.0
+
+// signal to noise ratio given to a clip that stores its samples exactly
+#define CLIP_EXACT_SNR 999.0
+
+typedef enum {
+    CLIP_PCM16,
+    CLIP_ADPCM
+} CLIP_FORMAT;
+
+/**
+  @brief A rendered sound. Blocks of an IMA-ADPCM clip decode on their own, so it can be played
+  from any position.
+ */
+typedef struct {
+    CLIP_FORMAT format;
+    /** samples of the sound */
+    int length;
+    /** bytes of data */
+    int bytes;
+    /** peak of the sound; it's stored normalized, so quiet sounds keep resolution and loud ones don't clip */
+    float scale;
+    unsigned char* data;
+} SOUND_CLIP;
+
+int clip_encode(SOUND_CLIP* clip, const sample_t* samples, int length, CLIP_FORMAT format);
+int clip_encode_min_snr(SOUND_CLIP* clip, const sample_t* samples, int length, CLIP_FORMAT format, double min_snr, double* snr);
+double clip_snr(const SOUND_CLIP* clip, const sample_t* samples);
+void clip_dispose(SOUND_CLIP* clip);
+void clip_decode(const SOUND_CLIP* clip, int position, int count, float* out);
+void clip_mix(const SOUND_CLIP* clip, int position, int count, const float* gains, float* stereo);
+const char* clip_format_name(CLIP_FORMAT format);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+  @file drawqueue.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Queue of draws of a frame, sorted by a 64 bit key before they're issued.
+
+  Keys are laid out from the highest bit as:
+
+    opaque:      pass (2) | 0 | variant (3) | vao (12) | depth (24)      | unused (14) | index (8)
+    transparent: pass (2) | 1 | far depth (24) | variant (3) | vao (12)  | unused (14) | index (8)
+    overlay:     pass (2) | unused (54)                                               | index (8)
+
+  so opaque draws are grouped by shader variant and VAO, near ones first within a group, and
+  transparent ones go from far to near. Index of the draw in the queue makes keys unique and
+  keeps submission order among equal keys. Keys are sorted with a radix sort of 8 bits per pass,
+  skipping bytes all keys share.
+ */
+
+#include "drawqueue.h"
+#include <string.h>
+
+#define DEPTH_BITS 24
+#define DEPTH_MAX ((1u << DEPTH_BITS) - 1)
+#define VARIANT_MASK 0x7u
+#define VAO_MASK 0xFFFu
+#define INDEX_MASK 0xFFu
+
+static uint64_t quantize_depth(float depth)
+{
+    float scaled = depth / DRAW_DEPTH_RANGE * (float)DEPTH_MAX;
+
+    if (scaled <= 0.0f) {
+        return 0;
+    }
+    return scaled >= (float)DEPTH_MAX ? DEPTH_MAX : (uint64_t)scaled;
+}
+
+/**
+  Builds sort key of a draw. Variant is the shader variant it uses, vao its vertex array and
+  depth its distance from camera along view direction. Overlay draws only use pass.
+ */
+uint64_t draw_key(DRAW_PASS pass, int transparent, unsigned variant, unsigned vao, float depth)
+{
+    uint64_t key = (uint64_t)pass << 62;
+
+    if (pass == DRAW_PASS_OVERLAY) {
+        return key;
+    }
+    if (transparent) {
+        key |= 1ULL << 61;
+        key |= (DEPTH_MAX - quantize_depth(depth)) << 37;
+        key |= (uint64_t)(variant & VARIANT_MASK) << 34;
+        key |= (uint64_t)(vao & VAO_MASK) << 22;
+    } else {
+        key |= (uint64_t)(variant & VARIANT_MASK) << 58;
+        key |= (uint64_t)(vao & VAO_MASK) << 46;
+        key |= quantize_depth(depth) << 22;
+    }
+    return key;
+}
+
+/**
+  Adds a draw with key. Returns the draw to set its params, or NULL if queue is full.
+ */
+DRAW_ITEM* draw_queue_submit(DRAW_QUEUE* queue, uint64_t key, DrawFunction draw, const void* data)
+{
+    DRAW_ITEM* item;
+
+    if (queue->count >= DRAW_QUEUE_CAPACITY) {
+        queue->dropped++;
+        return NULL;
+    }
+    item = &queue->items[queue->count];
+    item->draw = draw;
+    item->data = data;
+    memset(item->params, 0, sizeof(item->params));
+    queue->keys[queue->count] = (key & ~(uint64_t)INDEX_MASK) | (uint64_t)queue->count;
+    queue->count++;
+    return item;
+}
+
+void draw_queue_sort(DRAW_QUEUE* queue)
+{
+    uint64_t* keys = queue->keys;
+    uint64_t* sorted = queue->sorted;
+    int count = queue->count;
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        int offsets[256] = { 0 };
+        int total = 0;
+
+        for (int i = 0; i < count; i++) {
+            offsets[(keys[i] >> shift) & 0xFF]++;
+        }
+        if (count == 0 || offsets[(keys[0] >> shift) & 0xFF] == count) {
+            continue;
+        }
+        for (int b = 0; b < 256; b++) {
+            int bucket = offsets[b];
+            offsets[b] = total;
+            total += bucket;
+        }
+        for (int i = 0; i < count; i++) {
+            sorted[offsets[(keys[i] >> shift) & 0xFF]++] = keys[i];
+        }
+        uint64_t* swap = keys;
+        keys = sorted;
+        sorted = swap;
+    }
+    if (keys != queue->keys) {
+        memcpy(queue->keys, keys, sizeof(uint64_t) * count);
+    }
+}
+
+/**
+  Sorts draws, issues them in key order and empties the queue.
+ */
+void draw_queue_execute(DRAW_QUEUE* queue)
+{
+    draw_queue_sort(queue);
+    for (int i = 0; i < queue->count; i++) {
+        const DRAW_ITEM* item = &queue->items[queue->keys[i] & INDEX_MASK];
+        item->draw(item);
+    }
+    queue->count = 0;
+}
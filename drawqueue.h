@@ -0,0 +1,56 @@
+/**
+  @file drawqueue.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Queue of draws of a frame, sorted by a 64 bit key before they're issued.
+ */
+
+#ifndef _DRAWQUEUE_H_
+#define _DRAWQUEUE_H_
+
+#include <stdint.h>
+
+// draws a frame holds; index of each draw takes the low 8 bits of its key
+#define DRAW_QUEUE_CAPACITY 256
+
+// view depths sorted apart, from camera to DRAW_DEPTH_RANGE
+#define DRAW_DEPTH_RANGE 16.0f
+
+/**
+  World draws go first, opaque then transparent ones. Overlay draws (fades and text) go last,
+  in the order they're submitted.
+ */
+typedef enum {
+    DRAW_PASS_WORLD,
+    DRAW_PASS_OVERLAY
+} DRAW_PASS;
+
+typedef struct DRAW_ITEM DRAW_ITEM;
+
+typedef void (*DrawFunction)(const DRAW_ITEM* item);
+
+/**
+  A draw: function issuing it, with data and params it's given. Data must stay valid until the
+  queue is executed.
+ */
+struct DRAW_ITEM {
+    DrawFunction draw;
+    const void* data;
+    float params[4];
+};
+
+typedef struct {
+    uint64_t keys[DRAW_QUEUE_CAPACITY];
+    uint64_t sorted[DRAW_QUEUE_CAPACITY];
+    DRAW_ITEM items[DRAW_QUEUE_CAPACITY];
+    int count;
+    /** draws dropped because queue was full */
+    unsigned dropped;
+} DRAW_QUEUE;
+
+uint64_t draw_key(DRAW_PASS pass, int transparent, unsigned variant, unsigned vao, float depth);
+DRAW_ITEM* draw_queue_submit(DRAW_QUEUE* queue, uint64_t key, DrawFunction draw, const void* data);
+void draw_queue_sort(DRAW_QUEUE* queue);
+void draw_queue_execute(DRAW_QUEUE* queue);
+
+#endif
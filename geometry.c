@@ -5,11 +5,11 @@
 	@brief Game objects for pong3d and utils functions for geometry tranformations.
 */
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "geometry.h"
-#include "renderer.h"
 #include "math_constants.h"
 
 #define OVERLAY_ALPHA 0.8f
@@ -24,7 +24,13 @@ PONG_ELEMENT ball_mark;
 PONG_ELEMENT overlay;
 PONG_ELEMENT startText;
 
-float opponent_z_coord;
+const int vertex_components[VERTEX_ATTRIBUTES] = { 3, 4, 2 };
+
+// first float of each attribute in vertices meshes are built in
+static const int vertex_sources[VERTEX_ATTRIBUTES] = { 0, 3, 7 };
+
+// bytes of a component in each encoding
+static const int encoding_sizes[] = { 0, 4, 2, 1, 2 };
 
 void create_projection_matrix(float fovy, float aspect_ratio, float near_plane, float far_plane, float* out)
 {
@@ -78,22 +84,11 @@ void assign_position_to_vertex(float* dest, int dest_index, float x, float y, fl
     dest[dest_offset] = x;
     dest[dest_offset + 1] = y;
     dest[dest_offset + 2] = z;
-    dest[dest_offset + 3] = 1.0f;
-}
-
-void cp_position_to_vertex(float* src, float* dest, int src_index, int dest_index)
-{
-    int src_offset = src_index * 3;
-    int dest_offset = dest_index * VERTEX_SIZE;
-    dest[dest_offset] = src[src_offset];
-    dest[dest_offset + 1] = src[src_offset + 1];
-    dest[dest_offset + 2] = src[src_offset + 2];
-    dest[dest_offset + 3] = 1.0f;
 }
 
 void assign_color_to_vertex(float* vertex_buffer, int index, float r, float g, float b, float a)
 {
-    int offset = index * VERTEX_SIZE + 4;
+    int offset = index * VERTEX_SIZE + 3;
     vertex_buffer[offset] = r;
     vertex_buffer[offset + 1] = g;
     vertex_buffer[offset + 2] = b;
@@ -101,11 +96,97 @@ void assign_color_to_vertex(float* vertex_buffer, int index, float r, float g, f
 }
 void assign_uv_to_vertex(float* vertex_buffer, int index, float u, float v)
 {
-    int offset = index * VERTEX_SIZE + 12;
+    int offset = index * VERTEX_SIZE + 7;
     vertex_buffer[offset] = u;
     vertex_buffer[offset + 1] = v;
 }
 
+void set_vertex_layout(VERTEX_LAYOUT* layout, VERTEX_ENCODING position, VERTEX_ENCODING color, VERTEX_ENCODING uv)
+{
+    layout->encodings[VERTEX_POSITION] = position;
+    layout->encodings[VERTEX_COLOR] = color;
+    layout->encodings[VERTEX_UV] = uv;
+    layout->stride = 0;
+    for (int a = 0; a < VERTEX_ATTRIBUTES; a++) {
+        layout->offsets[a] = layout->stride;
+        layout->stride += (vertex_components[a] * encoding_sizes[layout->encodings[a]] + 3) & ~3;
+    }
+}
+
+/**
+  Rounds to nearest half float. Values too small for normal halves are flushed to zero.
+ */
+static uint16_t to_half(float value)
+{
+    uint32_t bits;
+    uint32_t sign, mantissa, rest;
+    int exponent;
+    uint16_t half;
+
+    memcpy(&bits, &value, sizeof(bits));
+    sign = (bits >> 16) & 0x8000;
+    exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    mantissa = bits & 0x7FFFFF;
+    if (exponent <= 0) {
+        return (uint16_t)sign;
+    }
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7C00);
+    }
+    half = (uint16_t)(sign | (uint32_t)exponent << 10 | mantissa >> 13);
+    // ties to even; a carry out of mantissa rightly goes to exponent
+    rest = mantissa & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return half;
+}
+
+static uint32_t to_unorm(float value, uint32_t max)
+{
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return (uint32_t)(value * max + 0.5f);
+}
+
+/**
+  Packs vertices of element to its layout in out, which holds vertex_count * layout.stride bytes.
+ */
+void pack_vertices(const PONG_ELEMENT* element, unsigned char* out)
+{
+    const VERTEX_LAYOUT* layout = &element->layout;
+
+    memset(out, 0, (size_t)element->vertex_count * layout->stride);
+    for (int v = 0; v < element->vertex_count; v++) {
+        const float* source = element->vertex + v * VERTEX_SIZE;
+        unsigned char* vertex = out + v * layout->stride;
+        for (int a = 0; a < VERTEX_ATTRIBUTES; a++) {
+            unsigned char* component = vertex + layout->offsets[a];
+            for (int c = 0; c < vertex_components[a]; c++) {
+                float value = source[vertex_sources[a] + c];
+                uint16_t packed16;
+                switch (layout->encodings[a]) {
+                case ENCODING_FLOAT:
+                    memcpy(component + c * 4, &value, 4);
+                    break;
+                case ENCODING_HALF:
+                    packed16 = to_half(value);
+                    memcpy(component + c * 2, &packed16, 2);
+                    break;
+                case ENCODING_UNORM8:
+                    component[c] = (unsigned char)to_unorm(value, 255);
+                    break;
+                case ENCODING_UNORM16:
+                    packed16 = (uint16_t)to_unorm(value, 65535);
+                    memcpy(component + c * 2, &packed16, 2);
+                    break;
+                case ENCODING_NONE:
+                    break;
+                }
+            }
+        }
+    }
+}
+
 /*
    Algorithm to build vertex indices of common mesh.
 */
@@ -125,7 +206,8 @@ void emit_mesh_triangle_pair(int index, int num_base_vertices, int* triangle1, i
 void setup_stick(PONG_ELEMENT* stick, float stick_width, float stick_height, const float* color)
 {
 
-    stick->vertexType = GL_TRIANGLES;
+    stick->vertexType = PRIMITIVE_TRIANGLES;
+    set_vertex_layout(&stick->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_UNORM16);
 
     stick->width = stick_width;
     stick->height = stick_height;
@@ -169,7 +251,8 @@ void setup_overlay(PONG_ELEMENT* pOverlay, float alpha, float stage_width, float
 	pOverlay->width = stage_width;
 	pOverlay->height = stage_height;
 
-	pOverlay->vertexType = GL_TRIANGLES;
+	pOverlay->vertexType = PRIMITIVE_TRIANGLES;
+	set_vertex_layout(&pOverlay->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_NONE);
 
 	pOverlay->width2 = pOverlay->width / 2.0f;
 	pOverlay->height2 = pOverlay->height / 2.0f;
@@ -203,6 +286,12 @@ void setup_overlay(PONG_ELEMENT* pOverlay, float alpha, float stage_width, float
 	pOverlay->model_matrix[14] = 0.0f;
 }
 
+/**
+  Stage is a box open at both ends, made of blocks along Z. Each side is a strip of triangles
+  sharing vertices between blocks, so its vertices are its corners at each block ring. UV of a
+  vertex is its side across, 0 to 1, and its ring along, so the shader finds from it the distance
+  to the grid lines and the block a fragment belongs to, and draws fill and grid in one pass.
+ */
 void setup_stage(PONG_ELEMENT* pStage,
     int window_width,
     int window_height,
@@ -212,74 +301,69 @@ void setup_stage(PONG_ELEMENT* pStage,
     const float* color)
 {
 
-    int vertex = 0;
     float aspect = (float)window_width / window_height;
-    float x_width, y_height;
+    float corners[4][2];
 	pStage->width = width;
 	pStage->height = width / aspect;
 	pStage->large = large * blocks;
 	pStage->width2 = pStage->width / 2.0f;
 	pStage->height2 = pStage->height / 2.0f;
 
-	pStage->vertexType = GL_QUADS;
+	pStage->vertexType = PRIMITIVE_TRIANGLES;
+	// ring numbers along UV are out of unorm range; halves hold them exactly
+	set_vertex_layout(&pStage->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_HALF);
 
-    x_width = pStage->width2;
-    y_height = pStage->height2;
+    // corners of a ring: top left, top right, bottom right, bottom left
+    corners[0][0] = -pStage->width2;
+    corners[0][1] = pStage->height2;
+    corners[1][0] = pStage->width2;
+    corners[1][1] = pStage->height2;
+    corners[2][0] = pStage->width2;
+    corners[2][1] = -pStage->height2;
+    corners[3][0] = -pStage->width2;
+    corners[3][1] = -pStage->height2;
 
-	pStage->vertex_count = blocks * 16;
-	pStage->elements_count = 0;
+	pStage->vertex_count = 4 * (blocks + 1) * 2;
+	pStage->elements_count = 4 * blocks * 6;
 
 	pStage->vertex = (float*)calloc(VERTEX_SIZE * pStage->vertex_count, sizeof(float));
+	pStage->elements = (unsigned int*)malloc(sizeof(unsigned int) * pStage->elements_count);
 
-    // first create temporal vertices for 3d box (4 vetices up and 4 vertices bottom)
-    int tmp_vertex_count = blocks * 8;
-    float* tmp_vertex = (float*)malloc(sizeof(float) * 3 * tmp_vertex_count);
-
-    for (int i = 0; i <= blocks; i++) {
-        float z_depth = (-large * (float)i);
-
-        tmp_vertex[vertex++] = -x_width;
-        tmp_vertex[vertex++] = y_height;
-        tmp_vertex[vertex++] = z_depth;
-
-        tmp_vertex[vertex++] = x_width;
-        tmp_vertex[vertex++] = y_height;
-        tmp_vertex[vertex++] = z_depth;
-
-        tmp_vertex[vertex++] = x_width;
-        tmp_vertex[vertex++] = -y_height;
-        tmp_vertex[vertex++] = z_depth;
-
-        tmp_vertex[vertex++] = -x_width;
-        tmp_vertex[vertex++] = -y_height;
-        tmp_vertex[vertex++] = z_depth;
-    }
+    int vertex = 0;
+    int element = 0;
+    for (int side = 0; side < 4; side++) {
+        const float* from = corners[side];
+        const float* to = corners[(side + 1) % 4];
+        int first = vertex;
+
+        for (int ring = 0; ring <= blocks; ring++) {
+            float z_depth = -large * (float)ring;
+
+            assign_position_to_vertex(pStage->vertex, vertex, from[0], from[1], z_depth);
+            assign_color_to_vertex(pStage->vertex, vertex, color[0], color[1], color[2], color[3]);
+            assign_uv_to_vertex(pStage->vertex, vertex, 0.0f, (float)ring);
+            vertex++;
 
-    // now join vertices for build quads using intermediate triangles
-    int triangle1[3];
-    int triangle2[3];
-    vertex = 0;
-    float alpha = color[3];
-
-    for (int i = 0, j = 0; i < blocks * 4; i++, j += 4) {
-        emit_mesh_triangle_pair(i, 4, triangle1, triangle2);
-        // each block has got a darker color
-        if (i > 0 && i % 4 == 0) {
-            alpha /= 2.0f;
+            assign_position_to_vertex(pStage->vertex, vertex, to[0], to[1], z_depth);
+            assign_color_to_vertex(pStage->vertex, vertex, color[0], color[1], color[2], color[3]);
+            assign_uv_to_vertex(pStage->vertex, vertex, 1.0f, (float)ring);
+            vertex++;
+        }
+        // two triangles per block, wound like the former quads
+        for (int block = 0; block < blocks; block++) {
+            unsigned int near_from = first + block * 2;
+            unsigned int near_to = near_from + 1;
+            unsigned int far_from = near_from + 2;
+            unsigned int far_to = near_from + 3;
+
+            pStage->elements[element++] = near_from;
+            pStage->elements[element++] = far_from;
+            pStage->elements[element++] = far_to;
+            pStage->elements[element++] = near_from;
+            pStage->elements[element++] = far_to;
+            pStage->elements[element++] = near_to;
         }
-        cp_position_to_vertex(tmp_vertex, pStage->vertex, triangle1[0], j);
-        assign_color_to_vertex(pStage->vertex, j, color[0], color[1], color[2], alpha);
-
-        cp_position_to_vertex(tmp_vertex, pStage->vertex, triangle1[1], j + 1);
-        assign_color_to_vertex(pStage->vertex, j + 1, color[0], color[1], color[2], alpha);
-
-        cp_position_to_vertex(tmp_vertex, pStage->vertex, triangle1[2], j + 2);
-        assign_color_to_vertex(pStage->vertex, j + 2, color[0], color[1], color[2], alpha);
-
-        cp_position_to_vertex(tmp_vertex, pStage->vertex, triangle2[2], j + 3);
-        assign_color_to_vertex(pStage->vertex, j + 3, color[0], color[1], color[2], alpha);
     }
-    free(tmp_vertex);
     load_identity_matrix(pStage->model_matrix);
 }
 
@@ -293,7 +377,8 @@ void setup_ball(PONG_ELEMENT* pBall, int segments, float radius, const float* co
     int triangle2[3];
     float unit_angle = P_2PI / segments;
 
-	pBall->vertexType = GL_TRIANGLES;
+	pBall->vertexType = PRIMITIVE_TRIANGLES;
+	set_vertex_layout(&pBall->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_NONE);
 	pBall->width = radius;
 
 	pBall->vertex_count = segments * segments;
@@ -331,7 +416,8 @@ void build_circle(PONG_ELEMENT* element, float radius, int segments, const float
     element->vertex_count = (segments + 2);
     element->vertex = (float*)calloc(element->vertex_count * VERTEX_SIZE, sizeof(float));
     element->elements_count = 0;
-    element->vertexType = GL_TRIANGLE_FAN;
+    element->vertexType = PRIMITIVE_TRIANGLE_FAN;
+    set_vertex_layout(&element->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_NONE);
     int vertex = 1;
     int p;
     float unit_angle = P_2PI / (float)segments;
@@ -373,23 +459,23 @@ void setup_stick_shadows(PONG_ELEMENT* element, float width, float height, const
     element->elements_count = 6;
     element->width = width;
     element->height = height;
-    element->z = 0.0f;
-    element->vertexType = GL_TRIANGLES;
+    element->vertexType = PRIMITIVE_TRIANGLES;
+    set_vertex_layout(&element->layout, ENCODING_HALF, ENCODING_UNORM8, ENCODING_NONE);
     float width2 = element->width / 2.0f;
     float height2 = element->height / 2.0f;
     element->width2 = width2;
     element->height2 = height2;
 
-    assign_position_to_vertex(element->vertex, 0, -width2, -height2, element->z);
+    assign_position_to_vertex(element->vertex, 0, -width2, -height2, 0.0f);
     assign_color_to_vertex(element->vertex, 0, color[0], color[1], color[2], color[3]);
 
-    assign_position_to_vertex(element->vertex, 1, -width2, height2, element->z);
+    assign_position_to_vertex(element->vertex, 1, -width2, height2, 0.0f);
     assign_color_to_vertex(element->vertex, 1, color[0], color[1], color[2], color[3]);
 
-    assign_position_to_vertex(element->vertex, 2, width2, height2, element->z);
+    assign_position_to_vertex(element->vertex, 2, width2, height2, 0.0f);
     assign_color_to_vertex(element->vertex, 2, color[0], color[1], color[2], color[3]);
 
-    assign_position_to_vertex(element->vertex, 3, width2, -height2, element->z);
+    assign_position_to_vertex(element->vertex, 3, width2, -height2, 0.0f);
     assign_color_to_vertex(element->vertex, 3, color[0], color[1], color[2], color[3]);
 
     memcpy(element->elements, elements, sizeof(elements));
@@ -401,20 +487,19 @@ void create_elements(int window_width, int window_height, int stage_blocks)
     /**
 	  Config for geometry of all objects in game
 	  : */
-    float stage_width = 1.0f;
-    float stage_large = 1.5f;
+    float stage_width = STAGE_WIDTH;
+    float stage_large = STAGE_LARGE;
     float blocks_large = stage_large / stage_blocks;
 
     float stage_color[] = { 0.0f, 1.0f, 0.0f, 0.2f };
     float overlay_alpha = OVERLAY_ALPHA;
     float aspect = (float)window_width / window_height;
-    float stick_width = stage_width / 6.0f;
+    float stick_width = STICK_WIDTH;
     float stick_color[] = { 0.5f, 0.5f, 0.5f, 0.5f };
     int ball_segments = 20;
-    float ball_radius = stage_large / 80.0f;
+    float ball_radius = BALL_RADIUS;
     float ball_color[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
     float shadows_color[] = { 1.0f, 1.0f, 1.0f, 0.2f };
-    opponent_z_coord = -stage_blocks * blocks_large;
 
     setup_stage(&stage, window_width, window_height, stage_blocks, stage_width, blocks_large, stage_color);
 
@@ -433,17 +518,6 @@ void create_elements(int window_width, int window_height, int stage_blocks)
     setup_stick(&player_stick, stick_width, stick_width / aspect, stick_color);
 
     setup_stick_shadows(&stick_shadow, stick_width, ball_radius, shadows_color);
-
-    reset_player_stick_position();
-    reset_opponent_stick_position();
-    upload_to_renderer(&stage);
-    upload_to_renderer(&overlay);
-    upload_to_renderer(&player_stick);
-    upload_to_renderer(&opponent_stick);
-    upload_to_renderer(&ball);
-    upload_to_renderer(&ball_shadow);
-    upload_to_renderer(&ball_mark);
-    upload_to_renderer(&stick_shadow);
 }
 
 void free_pong_element(PONG_ELEMENT* element)
@@ -454,9 +528,6 @@ void free_pong_element(PONG_ELEMENT* element)
     if (element->elements_count > 0 && element->elements) {
         free(element->elements);
     }
-    if (element->uploaded) {
-    	remove_to_renderer(element);
-    }
 }
 
 void dispose_elements()
@@ -468,56 +539,36 @@ void dispose_elements()
     free_pong_element(&ball_shadow);
     free_pong_element(&stick_shadow);
     free_pong_element(&ball_mark);
+    free_pong_element(&overlay);
 }
 
-void reset_player_stick_position()
+void setup_body(BODY* body, float width, float height, float large)
 {
-    player_stick.x = 0.0f;
-    player_stick.y = 0.0f;
-    player_stick.xprev = 0.0f;
-    player_stick.yprev = 0.0f;
-    player_stick.z = 0.0f;
+    body->x = 0.0f;
+    body->y = 0.0f;
+    body->z = 0.0f;
+    body->width = width;
+    body->height = height;
+    body->large = large;
+    body->width2 = width / 2.0f;
+    body->height2 = height / 2.0f;
+    body->large2 = large / 2.0f;
 }
-void reset_opponent_stick_position()
-{
-    opponent_stick.x = 0.0f;
-    opponent_stick.y = 0.0f;
-    opponent_stick.xprev = 0.0f;
-    opponent_stick.yprev = 0.0f;
-    opponent_stick.z = opponent_z_coord;
-    opponent_stick.model_matrix[12] = 0.0;
-    opponent_stick.model_matrix[13] = 0.0;
-    opponent_stick.model_matrix[14] = opponent_stick.z;
-}
-void move_player_stick(float x, float y)
-{
-    player_stick.x = x;
-    player_stick.y = y;
-    player_stick.model_matrix[12] = x;
-    player_stick.model_matrix[13] = y;
-}
-void move_opponent_stick(float x, float y)
-{
-    opponent_stick.x = x;
-    opponent_stick.y = y;
-    opponent_stick.model_matrix[12] = x;
-    opponent_stick.model_matrix[13] = y;
-}
-void reset_ball_position()
+
+void move_body(BODY* body, float x, float y, float z)
 {
-    ball.x = 0.0f;
-    ball.y = 0.0f;
-    ball.z = player_stick.z - ball.width;
-    ball.model_matrix[12] = 0.0;
-    ball.model_matrix[13] = 0.0;
-    ball.model_matrix[14] = ball.z;
+    body->x = x;
+    body->y = y;
+    body->z = z;
 }
-void move_ball(float x, float y, float z)
+
+/**
+  Sets translation of element model matrix to a point between prev and current position.
+  alpha is the elapsed fraction of current tick (0 previous tick, 1 current tick).
+ */
+void place_element(PONG_ELEMENT* element, const float* prev, const float* position, float alpha)
 {
-    ball.x = x;
-    ball.y = y;
-    ball.z = z;
-    ball.model_matrix[12] = x;
-    ball.model_matrix[13] = y;
-    ball.model_matrix[14] = z;
+    element->model_matrix[12] = prev[0] + (position[0] - prev[0]) * alpha;
+    element->model_matrix[13] = prev[1] + (position[1] - prev[1]) * alpha;
+    element->model_matrix[14] = prev[2] + (position[2] - prev[2]) * alpha;
 }
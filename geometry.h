@@ -8,37 +8,75 @@
 #ifndef _MESH_H_
 #define _MESH_H_
 
-#ifdef _WINDOWS
-#include <windows.h>
-#endif
+/**
+  @brief Vertex structure meshes are built in is position * 3 + color * 4 + texture * 2. Float types.
+  Each mesh is packed to its VERTEX_LAYOUT when it's uploaded.
+ */
+#define VERTEX_SIZE 9
+
+// sizes of game objects in stage units. Stage height and stick height follow window aspect.
+#define STAGE_WIDTH 1.0f
+#define STAGE_LARGE 1.5f
+#define STICK_WIDTH (STAGE_WIDTH / 6.0f)
+#define BALL_RADIUS (STAGE_LARGE / 80.0f)
 
-#include <GL/glew.h>
+/**
+  @brief Primitives to draw meshes with. Renderer translates them to graphics API ones.
+ */
+typedef enum {
+    PRIMITIVE_TRIANGLES,
+    PRIMITIVE_TRIANGLE_FAN
+} PRIMITIVE_TYPE;
 
 /**
-  @brief Vertex structure is position * 4 + color * 4 + normal * 4 + texture * 2. Float types.
+  @brief Vertex attributes: position (x, y, z), color (r, g, b, a) and texture coordinates (u, v).
  */
-#define VERTEX_SIZE 14
+typedef enum {
+    VERTEX_POSITION,
+    VERTEX_COLOR,
+    VERTEX_UV,
+    VERTEX_ATTRIBUTES
+} VERTEX_ATTRIBUTE;
 
 /**
-  @brief Game object structure.
+  @brief How an attribute is stored: not at all, as floats, as half floats, or as unsigned bytes or
+  shorts normalized to 0..1.
+ */
+typedef enum {
+    ENCODING_NONE,
+    ENCODING_FLOAT,
+    ENCODING_HALF,
+    ENCODING_UNORM8,
+    ENCODING_UNORM16
+} VERTEX_ENCODING;
+
+/**
+  @brief Packed vertex of a mesh: encoding and byte offset of each attribute. Attributes start at
+  4 byte boundaries.
+ */
+typedef struct {
+    VERTEX_ENCODING encodings[VERTEX_ATTRIBUTES];
+    int offsets[VERTEX_ATTRIBUTES];
+    int stride;
+} VERTEX_LAYOUT;
+
+extern const int vertex_components[VERTEX_ATTRIBUTES];
+
+/**
+  @brief Game object structure. Renderer handles (vao, vbo, ebo, texture) are only set when element is uploaded.
  */
 typedef struct {
     float* vertex;
     int vertex_count;
-    GLuint vbo;
-    GLuint texture;
+    VERTEX_LAYOUT layout;
+    unsigned int vbo;
+    unsigned int texture;
     unsigned int* elements;
     int elements_count;
-    GLuint mode;
-    GLuint vertexType;
-    float x;
-    float y;
-    float z;
-    float xprev;
-    float yprev;
-    float zprev;
-    GLuint vao;
-    GLuint ebo;
+    unsigned int mode;
+    PRIMITIVE_TYPE vertexType;
+    unsigned int vao;
+    unsigned int ebo;
     float width;
     float height;
     float large;
@@ -51,6 +89,22 @@ typedef struct {
     int uploaded;
 } PONG_ELEMENT;
 
+/**
+  @brief Simulated game object: position and sizes. Each match has its own bodies, while
+  meshes (PONG_ELEMENT) are shared and placed where the rendered match bodies are.
+ */
+typedef struct {
+    float x;
+    float y;
+    float z;
+    float width;
+    float height;
+    float large;
+    float width2;
+    float height2;
+    float large2;
+} BODY;
+
 extern PONG_ELEMENT player_stick;
 extern PONG_ELEMENT opponent_stick;
 extern PONG_ELEMENT ball;
@@ -62,14 +116,13 @@ extern PONG_ELEMENT overlay;
 extern PONG_ELEMENT startText;
 
 void create_elements(int stage_width, int stage_height, int num_blocks);
+void set_vertex_layout(VERTEX_LAYOUT* layout, VERTEX_ENCODING position, VERTEX_ENCODING color, VERTEX_ENCODING uv);
+void pack_vertices(const PONG_ELEMENT* element, unsigned char* out);
 void dispose_elements();
 void load_identity_matrix(float* out);
 void create_projection_matrix(float fovy, float aspect_ratio, float near_plane, float far_plane, float* out);
-void reset_player_stick_position();
-void reset_opponent_stick_position();
-void move_player_stick(float x, float y);
-void move_opponent_stick(float x, float y);
-void reset_ball_position();
-void move_ball(float x, float y, float z);
+void setup_body(BODY* body, float width, float height, float large);
+void move_body(BODY* body, float x, float y, float z);
+void place_element(PONG_ELEMENT* element, const float* prev, const float* position, float alpha);
 
 #endif
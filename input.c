@@ -0,0 +1,76 @@
+/**
+  @file input.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Ring buffer of timestamped input events, consumed in order by game ticks.
+ */
+
+#include "input.h"
+
+/**
+  Appends an event to queue. When queue is full, a mouse motion replaces the newest event if
+  that is a motion too (only last position matters), otherwise the event is dropped.
+  Returns 0 if event was queued or -1 if it was dropped.
+ */
+int input_push_event(INPUT_QUEUE* queue, const SysEvent* event)
+{
+    if (queue->count == INPUT_QUEUE_SIZE) {
+        SysEvent* newest = &queue->events[(queue->head + queue->count - 1) % INPUT_QUEUE_SIZE];
+        if (event->type == MOUSEMOTION && newest->type == MOUSEMOTION) {
+            *newest = *event;
+            return 0;
+        }
+        queue->dropped++;
+        return -1;
+    }
+    queue->events[(queue->head + queue->count) % INPUT_QUEUE_SIZE] = *event;
+    queue->count++;
+    return 0;
+}
+
+int input_pending_events(const INPUT_QUEUE* queue)
+{
+    return queue->count;
+}
+
+/**
+  Returns number of queued events that happened at or before timestamp (nanoseconds).
+ */
+int input_events_until(const INPUT_QUEUE* queue, uint64_t timestamp)
+{
+    int i;
+    for (i = 0; i < queue->count; i++) {
+        if (queue->events[(queue->head + i) % INPUT_QUEUE_SIZE].timestamp > timestamp) {
+            break;
+        }
+    }
+    return i;
+}
+
+/**
+  Returns queued event at index (0 is the oldest) without removing it.
+ */
+const SysEvent* input_peek_event(const INPUT_QUEUE* queue, int index)
+{
+    return &queue->events[(queue->head + index) % INPUT_QUEUE_SIZE];
+}
+
+void input_consume_events(INPUT_QUEUE* queue, int consumed)
+{
+    if (consumed > queue->count) {
+        consumed = queue->count;
+    }
+    queue->head = (queue->head + consumed) % INPUT_QUEUE_SIZE;
+    queue->count -= consumed;
+}
+
+void input_clear_events(INPUT_QUEUE* queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+}
+
+int input_dropped_events(const INPUT_QUEUE* queue)
+{
+    return queue->dropped;
+}
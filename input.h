@@ -0,0 +1,34 @@
+/**
+  @file input.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Ring buffer of timestamped input events, consumed in order by game ticks.
+ */
+
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include "msys.h"
+
+// max input events waiting to be consumed by game ticks
+#define INPUT_QUEUE_SIZE 256
+
+/**
+  @brief Input events of a match. Each game context owns one.
+ */
+typedef struct INPUT_QUEUE {
+    SysEvent events[INPUT_QUEUE_SIZE];
+    int head;
+    int count;
+    int dropped;
+} INPUT_QUEUE;
+
+int input_push_event(INPUT_QUEUE* queue, const SysEvent* event);
+int input_pending_events(const INPUT_QUEUE* queue);
+int input_events_until(const INPUT_QUEUE* queue, uint64_t timestamp);
+const SysEvent* input_peek_event(const INPUT_QUEUE* queue, int index);
+void input_consume_events(INPUT_QUEUE* queue, int count);
+void input_clear_events(INPUT_QUEUE* queue);
+int input_dropped_events(const INPUT_QUEUE* queue);
+
+#endif
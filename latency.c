@@ -0,0 +1,270 @@
+/**
+  @file latency.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Audio latency benchmark. Runs game sounds through a fake audio device driven by a virtual
+  clock, so it needs no sound card. A scripted game loop plays sounds of events at times within
+  ticks and the device finds in its buffers the sample each one starts at.
+
+  Device calls back for a buffer every buffer period, give or take callback jitter, and plays it
+  while the next one is filled, so a sample is heard a buffer period after its buffer is handed
+  over. Game ticks are processed some time after they end, like in a loaded game loop. Events are
+  far apart, so each sound starts in silence and its first nonzero sample marks when it's heard.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "msys.h"
+#include "pong3d.h"
+#include "sound.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// seconds between scripted events, longer than the longest sound
+#define EVENT_SPACING 1.5
+
+// samples over this level are heard
+#define ONSET_LEVEL 1e-6f
+
+// max difference between latencies of sounds, in milliseconds
+#define MAX_LATENCY_SPREAD 1.0
+
+// fake device and virtual clock
+static uint64_t virtual_time;
+static SysAudioCallback device_callback;
+static void* device_data;
+static SysAudioFormat device_format;
+
+uint64_t sys_get_time_ns()
+{
+    return virtual_time;
+}
+
+int sys_init_sound(int sample_rate, int buffer_frames, SysAudioCallback callback, void* data, SysAudioFormat* format)
+{
+    device_callback = callback;
+    device_data = data;
+    device_format.sample_rate = sample_rate;
+    device_format.channels = 2;
+    device_format.buffer_frames = buffer_frames;
+    *format = device_format;
+    return 0;
+}
+
+void sys_dispose_audio()
+{
+    device_callback = NULL;
+}
+
+typedef struct {
+    int sample_rate;
+    int buffer_frames;
+    int events;
+    /** max time callbacks come early or late, and max time game ticks are processed after they end, in ms */
+    double callback_jitter;
+    double tick_delay;
+    const char* reverb;
+    int music;
+} LATENCY_OPTIONS;
+
+static double elapsed_ns(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+static uint32_t next_random(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// random number from 0 to 1
+static double random_fraction(uint32_t* state)
+{
+    return (next_random(state) >> 8) / 16777216.0;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+  Plays scripted event number index, at time within the tick that started at tick_start.
+ */
+static void play_event(int index, float time, uint64_t tick_start)
+{
+    GAME_EVENT event;
+    uint64_t at = tick_start + (uint64_t)(time * 1e9f);
+
+    memset(&event, 0, sizeof(GAME_EVENT));
+    event.time = time;
+    event.speed = 1.0f;
+    switch (index % 6) {
+    case 0:
+        play_start_sound(at);
+        break;
+    case 1:
+        play_player_pong_sound(&event, at);
+        break;
+    case 2:
+        play_wall_hit_sound(&event, at);
+        break;
+    case 3:
+        play_opponent_pong_sound(&event, at);
+        break;
+    case 4:
+        play_player_wins_sound(at);
+        break;
+    default:
+        play_opponent_wins_sound(at);
+        break;
+    }
+}
+
+/**
+  Runs the script and prints latencies and mixer time. Returns 1 if a sound was late, a buffer
+  took longer than its period or sound latencies spread more than MAX_LATENCY_SPREAD.
+ */
+static int run_latency(const LATENCY_OPTIONS* options)
+{
+    uint64_t tick_period = 1000000000ULL / TICK_RATE;
+    uint64_t buffer_period = (uint64_t)options->buffer_frames * 1000000000ULL / options->sample_rate;
+    uint64_t start = 1000000000ULL;
+    uint64_t end = start + (uint64_t)((options->events + 1) * EVENT_SPACING * 1e9);
+    int buffers = (int)((end - start) / buffer_period) + 1;
+    double* buffer_ns = (double*)malloc(sizeof(double) * buffers);
+    double* heard = (double*)malloc(sizeof(double) * options->events);
+    float* out = (float*)malloc(sizeof(float) * options->buffer_frames * 2);
+    uint32_t random = 1977;
+    uint64_t tick = 0, buffer = 0, tick_processed, callback;
+    uint64_t pending_event = 0;
+    int next_event = 0, heard_count = 0, underruns = 0, rendered = 0, failed;
+    uint64_t event_time = start + (uint64_t)(EVENT_SPACING * 1e9);
+    SoundStats stats;
+
+    if (!buffer_ns || !heard || !out) {
+        free(buffer_ns);
+        free(heard);
+        free(out);
+        return 1;
+    }
+    virtual_time = start;
+    if (init_sound(options->sample_rate, options->buffer_frames) < 0
+        || (options->reverb && set_sound_reverb(options->reverb) < 0)) {
+        fprintf(stderr, "Couldn't initialize sound\n");
+        free(buffer_ns);
+        free(heard);
+        free(out);
+        return 1;
+    }
+    if (options->music) {
+        play_music();
+    }
+    tick_processed = start + tick_period;
+    callback = start;
+    // game loop and device run in virtual time, each one doing next what comes first
+    while (buffer < (uint64_t)buffers) {
+        uint64_t tick_end = start + (tick + 1) * tick_period;
+
+        if (tick_processed < callback) {
+            virtual_time = tick_processed;
+            if (next_event < options->events && event_time < tick_end) {
+                float time = (float)(event_time - (tick_end - tick_period)) / 1e9f;
+                play_event(next_event++, time, tick_end - tick_period);
+                pending_event = event_time;
+                event_time += (uint64_t)(EVENT_SPACING * 1e9);
+                event_time += (uint64_t)(random_fraction(&random) * tick_period);
+            }
+            tick++;
+            tick_processed = start + (tick + 1) * tick_period + (uint64_t)(random_fraction(&random) * options->tick_delay * 1e6);
+            continue;
+        }
+        {
+            struct timespec cpu_start;
+            virtual_time = callback;
+            clock_gettime(CLOCK_MONOTONIC, &cpu_start);
+            device_callback(device_data, out, options->buffer_frames);
+            buffer_ns[rendered] = elapsed_ns(&cpu_start);
+            underruns += buffer_ns[rendered] > buffer_period;
+            rendered++;
+        }
+        for (int i = 0; pending_event && !options->music && !options->reverb && i < options->buffer_frames * 2; i++) {
+            if (out[i] > ONSET_LEVEL || out[i] < -ONSET_LEVEL) {
+                // played after the buffer being played now, at its exact rate
+                uint64_t heard_time = start + (buffer + 1) * buffer_period + (uint64_t)(i / 2) * 1000000000ULL / options->sample_rate;
+                heard[heard_count++] = (heard_time - pending_event) / 1e6;
+                pending_event = 0;
+            }
+        }
+        buffer++;
+        callback = (uint64_t)((int64_t)(start + buffer * buffer_period)
+            + (int64_t)((random_fraction(&random) * 2.0 - 1.0) * options->callback_jitter * 1e6));
+    }
+    dispose_sound();
+    sound_stats(&stats);
+
+    qsort(buffer_ns, rendered, sizeof(double), compare_doubles);
+    qsort(heard, heard_count, sizeof(double), compare_doubles);
+    printf("latency: %d Hz, buffer %d frames (%.1f ms), %d events, callback jitter %.1f ms, tick delay %.1f ms\n",
+        options->sample_rate, options->buffer_frames, buffer_period / 1e6, options->events, options->callback_jitter, options->tick_delay);
+    printf("  event to sample handed to device: p50 %.2f ms, p99 %.2f ms, max %.2f ms; late sounds %u (max %.2f ms)\n",
+        stats.latency.p50, stats.latency.p99, stats.latency.max, stats.latency.late, stats.latency.late_max);
+    if (heard_count > 0) {
+        printf("  event to sample heard: %d sounds, min %.2f ms, p50 %.2f ms, max %.2f ms, spread %.3f ms\n",
+            heard_count, heard[0], heard[heard_count / 2], heard[heard_count - 1], heard[heard_count - 1] - heard[0]);
+    } else {
+        printf("  event to sample heard: not measured with music or reverb\n");
+    }
+    printf("  mixer: %d buffers, p50 %.1f us, p99 %.1f us, max %.1f us per buffer (%.2f%% of period), underruns %d\n",
+        rendered, buffer_ns[rendered / 2] / 1e3, buffer_ns[rendered * 99 / 100] / 1e3, buffer_ns[rendered - 1] / 1e3,
+        buffer_ns[rendered - 1] * 100.0 / buffer_period, underruns);
+    failed = stats.latency.late > 0 || underruns > 0
+        || (heard_count > 0 && heard[heard_count - 1] - heard[0] > MAX_LATENCY_SPREAD)
+        || (!options->music && !options->reverb && heard_count < options->events);
+    free(buffer_ns);
+    free(heard);
+    free(out);
+    return failed;
+}
+
+/**
+  Usage: pong3d_latency [--sample-rate n] [--buffer-frames n] [--events n] [--callback-jitter ms]
+  [--tick-delay ms] [--reverb off|seconds|file.wav] [--music on|off]
+  Returns 1 if any check fails.
+ */
+int main(int argc, char** argv)
+{
+    LATENCY_OPTIONS options = { SAMPLE_RATE, AUDIO_BUFFER_FRAMES, 48, 0.5, 1.0, NULL, 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sample-rate") && i + 1 < argc) {
+            options.sample_rate = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--buffer-frames") && i + 1 < argc) {
+            options.buffer_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--events") && i + 1 < argc) {
+            options.events = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--callback-jitter") && i + 1 < argc) {
+            options.callback_jitter = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--tick-delay") && i + 1 < argc) {
+            options.tick_delay = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--reverb") && i + 1 < argc) {
+            i++;
+            options.reverb = strcmp(argv[i], "off") ? argv[i] : NULL;
+        } else if (!strcmp(argv[i], "--music") && i + 1 < argc) {
+            options.music = !strcmp(argv[++i], "on");
+        }
+    }
+    if (options.sample_rate < 8000 || options.buffer_frames < 16 || options.events < 1) {
+        fprintf(stderr, "Invalid sample rate, buffer frames or events\n");
+        return 2;
+    }
+    return run_latency(&options);
+}
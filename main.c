@@ -17,11 +17,16 @@
 #include <windows.h>
 #endif
 
+#include "ai.h"
 #include "geometry.h"
+#include "input.h"
 #include "msys.h"
+#include "multiball.h"
 #include "pong3d.h"
 #include "renderer.h"
+#include "replay.h"
 #include "screens.h"
+#include "snapshot.h"
 #include "sound.h"
 #include "tasks.h"
 #include "text.h"
@@ -29,10 +34,23 @@
 
 
 void run_game();
-void init_game();
-int process_state(int, int, SysEvent* event);
+int render_loop(void* data);
+void process_game_events(GameContext* ctx, uint64_t tick_start);
+int process_replay_input(GameContext* ctx);
+void parse_arguments(int argc, char** argv);
 void cleanup();
-int process_events_task(SysEvent* event);
+
+// match recording and replay files, and extra balls of multi-ball mode, from command line
+const char* record_path = NULL;
+const char* replay_path = NULL;
+int multiball_count = 0;
+AI_LEVEL ai_level = AI_NORMAL;
+int audio_buffer_frames = AUDIO_BUFFER_FRAMES;
+const char* reverb_spec = REVERB_DEFAULT;
+int music_enabled = 1;
+
+// match played in window
+GameContext game;
 
 #ifdef _WINDOWS
 INT CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, INT nCmdShow)
@@ -42,13 +60,26 @@ int main(int argc, char** argv)
 {
 #endif
 
+#ifdef _WINDOWS
+    parse_arguments(__argc, __argv);
+#else
+    parse_arguments(argc, argv);
+#endif
+
     if (sys_init_video(WINDOW_WIDTH, WINDOW_HEIGHT) < 0) {
         cleanup();
         exit(1000);
     }
 
-    if (init_sound(SAMPLE_RATE) < 0) {
+    if (init_sound(SAMPLE_RATE, audio_buffer_frames) < 0) {
 	log_error("Couldn't initialize sound device. The game will run without sound :(");
+    } else {
+        if (set_sound_reverb(reverb_spec) < 0) {
+            log_error("Couldn't load reverb %s", reverb_spec);
+        }
+        if (music_enabled) {
+            play_music();
+        }
     }
     if (init_renderer(WINDOW_WIDTH, WINDOW_HEIGHT) < 0) {
         cleanup();
@@ -59,127 +90,274 @@ int main(int argc, char** argv)
         exit(1003);
     }
     create_elements(WINDOW_WIDTH, WINDOW_HEIGHT, STAGE_BLOCKS);
+    upload_elements();
     init_screens();
     run_game();
     cleanup();
     return 0;
 }
 
+/**
+  Options: --record file to record the match, --replay file to play a recorded one,
+  --multiball n to play with n extra balls, --difficulty easy|normal|hard for computer skill,
+  --audio-buffer n for samples of audio device buffer, --reverb off|seconds|file.wav for reverb
+  of sounds, --music on|off for background music.
+ */
+void parse_arguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "--record")) {
+            record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay")) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--multiball")) {
+            multiball_count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--audio-buffer")) {
+            audio_buffer_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--reverb")) {
+            reverb_spec = argv[++i];
+        } else if (!strcmp(argv[i], "--music")) {
+            music_enabled = strcmp(argv[++i], "off") != 0;
+        } else if (!strcmp(argv[i], "--difficulty") && ai_parse_level(argv[++i], &ai_level) < 0) {
+            log_error("Unknown difficulty %s", argv[i]);
+        }
+    }
+}
+
 void cleanup()
 {
+    SysPacerStats stats;
+    RENDERER_STATE_STATS gl_state;
+    SoundStats sound;
+    const SoundAsset* report;
+    int assets;
+    sys_pacer_stats(&stats);
+    if (stats.frames > 0) {
+        log_info("Frames: %u, missed deadlines: %u, jitter p50: %.3f ms, p99: %.3f ms, max: %.3f ms",
+            stats.frames, stats.missed, stats.jitter_p50, stats.jitter_p99, stats.jitter_max);
+    }
+    renderer_state_stats(&gl_state);
+    if (gl_state.frames > 0) {
+        log_info("GL state calls per frame: %.1f issued, %.1f skipped as redundant",
+            (double)gl_state.total_issued / gl_state.frames, (double)gl_state.total_skipped / gl_state.frames);
+    }
+    remove_elements();
     dispose_elements();
     dispose_renderer();
     dispose_text_renderer();
     sys_dispose_video();
     dispose_sound();
+    sound_stats(&sound);
+    if (sound.latency.count > 0) {
+        log_info("Audio: %d Hz, %d channels, buffer %d samples (%.1f ms), sounds: %u, play latency p50: %.1f ms, p99: %.1f ms, max: %.1f ms, late: %u (max %.1f ms)",
+            sound.sample_rate, sound.channels, sound.buffer_frames, sound.buffer_frames * 1000.0 / sound.sample_rate,
+            sound.latency.count, sound.latency.p50, sound.latency.p99, sound.latency.max, sound.latency.late, sound.latency.late_max);
+    }
+    if (sound.synth.frames > 0) {
+        log_info("Live voices: %llu samples synthetized, %.1f ns per sample, %.2f%% of a core per voice",
+            (unsigned long long)sound.synth.frames, sound.synth.frame_ns, sound.voice_load);
+    }
+    if (sound.music.frames > 0) {
+        log_info("Music: %.1f ns per frame, %.2f%% of a core", sound.music.frame_ns, sound.music_load);
+    }
+    assets = sound_assets(&report);
+    for (int i = 0; i < assets; i++) {
+        log_info("Sound %s: %d samples, %s %d bytes, %.1fx smaller than float (%d bytes), snr %.1f dB%s%s%s",
+            report[i].name, report[i].samples, report[i].format, report[i].bytes,
+            report[i].bytes > 0 ? (double)report[i].float_bytes / report[i].bytes : 0.0, report[i].float_bytes, report[i].snr,
+            report[i].rejected ? " (" : "", report[i].rejected ? report[i].rejected : "", report[i].rejected ? " under min snr)" : "");
+    }
     sys_quit();
 }
 
-void init_game()
-{
-    balls = BALLS;
-    reset_player_stick_position();
-    reset_opponent_stick_position();
-    reset_ball_position();
-    player_score = 0;
-    opponent_score = 0;
-}
-
 void run_game()
 {
 
-    int framesElapsed = 0;
-    unsigned int startTime, elapsedTime;
-    unsigned int period = (unsigned int)(1000.0 / FPS);
-    int pendingEvent = 0;
-    SysEvent event;
-    int reset_frames_counter = 0;
-    int wait_time = 0;
-    int time_last_frame = startTime = sys_get_ticks();
-    GAME_STATE currentState = STARTING;
-    change_state(STARTING);
-
-    // Game loop.
-
-    while (gameState != EXIT) {
-        startTime = sys_get_ticks();
-        if (pendingEvent) {
-            process_events_task(&event);
+    uint64_t currentTime, lastTime, tickTime;
+    uint64_t tick_period = 1000000000ULL / TICK_RATE;
+    uint64_t accumulator = 0;
+    uint32_t seed = (uint32_t)time(NULL);
+    int events;
+    int user_closed = 0;
+    REPLAY replay;
+    REPLAY recorder;
+    BALL_SET multiball;
+    SNAPSHOT_BUFFER snapshots;
+    void* render_thread;
+
+    if (replay_path && replay_load(&replay, replay_path, &seed) < 0) {
+        log_error("Couldn't load replay file %s", replay_path);
+        return;
+    }
+    init_game(&game, seed);
+    ai_set_level(&game, ai_level);
+    if (record_path) {
+        if (replay_start_recording(&recorder, record_path, seed) < 0) {
+            log_error("Couldn't create replay file %s", record_path);
+        } else {
+            game.recorder = &recorder;
         }
-        if (currentState != gameState || reset_frames_counter) {
-            framesElapsed = 0;
-            currentState = gameState;
+    }
+    if (multiball_count > 0) {
+        if (multiball_create(&multiball, multiball_count) < 0) {
+            log_error("Couldn't create %d balls", multiball_count);
+        } else {
+            multiball_launch(&multiball, &game, seed);
+            game.multiball = &multiball;
+        }
+    }
+    lastTime = sys_get_time_ns();
+    render_thread = NULL;
+    if (snapshot_buffer_create(&snapshots, game.multiball ? game.multiball->count : 0) < 0) {
+        // match isn't played, but recording and balls are released below
+        log_error("Couldn't create snapshots of %d balls", multiball_count);
+        change_state(&game, EXIT);
+    } else {
+        snapshot_publish(&snapshots, &game, lastTime);
+
+        // render thread owns GL context while game runs
+        sys_gl_make_current(0);
+        render_thread = sys_create_thread("render", render_loop, &snapshots);
+        if (!render_thread) {
+            log_error("Couldn't create render thread");
+            change_state(&game, EXIT);
         }
-        reset_frames_counter = process_state(framesElapsed, pendingEvent, &event);
-        render();
-        framesElapsed++;
+    }
 
-        time_last_frame = sys_get_ticks();
+    // Game loop. Simulation advances in fixed ticks and publishes a snapshot after each one for render thread.
 
-        elapsedTime = time_last_frame - startTime;
-        wait_time = period - elapsedTime;
-        if (wait_time < 0) {
-            wait_time = 0;
+    while (game.gameState != EXIT) {
+        sys_pump_events(&game.input);
+        if (replay_path && process_replay_input(&game)) {
+            user_closed = 1;
+        }
+        currentTime = sys_get_time_ns();
+        accumulator += currentTime - lastTime;
+        lastTime = currentTime;
+        if (accumulator > MAX_TICKS_PER_FRAME * tick_period) {
+            accumulator = MAX_TICKS_PER_FRAME * tick_period;
         }
-        pendingEvent = sys_wait(&event, wait_time);
+        while (accumulator >= tick_period && game.gameState != EXIT) {
+            // each tick consumes input events happened until the time it simulates
+            tickTime = currentTime - (accumulator - tick_period);
+            if (replay_path) {
+                events = replay_feed_tick(&replay, &game);
+                if (events < 0) {
+                    change_state(&game, EXIT);
+                    break;
+                }
+            } else {
+                events = input_events_until(&game.input, tickTime);
+            }
+            game_tick(&game, events);
+            process_game_events(&game, tickTime - tick_period);
+            // music speeds up with the ball
+            set_music_speed(game.fps_inc > 0 ? (float)REFERENCE_FPS / game.fps_inc : MUSIC_MAX_SPEED);
+            snapshot_publish(&snapshots, &game, tickTime);
+            accumulator -= tick_period;
+        }
+        sys_sleep_until(currentTime + tick_period - accumulator);
+    }
+    if (render_thread) {
+        // a snapshot of EXIT state stops render thread
+        snapshot_publish(&snapshots, &game, sys_get_time_ns());
+        sys_wait_thread(render_thread);
+    }
+    sys_gl_make_current(1);
+    snapshot_buffer_dispose(&snapshots);
+    if (game.recorder && replay_stop_recording(game.recorder, &game) < 0) {
+        log_error("Couldn't write replay file %s", record_path);
+    }
+    if (replay_path) {
+        if (!user_closed) {
+            log_info("Replay %s", replay_verify(&replay, &game) == 0 ? "matches recording" : "diverged from recording");
+        }
+        replay_dispose(&replay);
+    }
+    if (game.multiball) {
+        multiball_dispose(game.multiball);
     }
 }
 
-int process_state(int elapsedFrames, int pendingEvent, SysEvent* event)
+/**
+  Draws newest snapshot of match at most FPS times per second, until match exits. A slow swap
+  only delays frames, simulation and input keep running in game loop.
+ */
+int render_loop(void* data)
 {
-    int reset_frames = 1;
-    switch (gameState) {
-
-    case STARTING:
-        reset_frames = start_screen_task(elapsedFrames);
-        break;
-    case LOADING_PLAYERS:
-        reset_frames = loading_players_task(elapsedFrames);
-        break;
-    case PLAYER_SERVICE:
-        reset_frames = player_service_task(elapsedFrames, pendingEvent, event);
-        break;
-    case PLAYER_RETURN:
-    case OPP_RETURN:
-        reset_frames = playing_task(elapsedFrames);
-        break;
-    case PLAYER_WINS:
-        reset_frames = player_wins_task(elapsedFrames);
-        break;
-    case OPP_WINS:
-        reset_frames = opponent_wins_task(elapsedFrames);
-        break;
-    case OPP_SERVICE:
-        reset_frames = opponent_service_task(elapsedFrames);
-        break;
-    case FINISHED:
-        reset_frames = finished_task(elapsedFrames);
-        break;
-    case EXIT:
-        break;
-    case STARTED:
-        break;
-    }
-    return reset_frames;
+    SNAPSHOT_BUFFER* snapshots = (SNAPSHOT_BUFFER*)data;
+    uint64_t tick_period = 1000000000ULL / TICK_RATE;
+    const GAME_SNAPSHOT* snapshot;
+
+    sys_gl_make_current(1);
+    sys_pacer_init(FPS);
+    for (;;) {
+        snapshot = snapshot_acquire(snapshots);
+        if (snapshot->state == EXIT) {
+            break;
+        }
+        place_snapshot_elements(snapshot, snapshot_alpha(snapshot, sys_get_time_ns(), tick_period));
+        render(snapshot);
+        sys_pacer_wait();
+    }
+    sys_gl_make_current(0);
+    return 0;
 }
 
-int process_events_task(SysEvent* event)
+/**
+  While replaying, live input is discarded except for closing the game. Returns 1 if game was closed.
+ */
+int process_replay_input(GameContext* ctx)
 {
+    int closed = 0;
+    for (int i = 0; i < input_pending_events(&ctx->input); i++) {
+        if (input_peek_event(&ctx->input, i)->type == CLOSE) {
+            change_state(ctx, EXIT);
+            closed = 1;
+        }
+    }
+    input_clear_events(&ctx->input);
+    return closed;
+}
 
-    switch (event->type) {
-    case CLOSE:
-        change_state(EXIT);
-        break;
-    case MOUSELBUTTONUP:
-        if (gameState == STARTING || gameState == FINISHED) {
-            change_state(LOADING_PLAYERS);
-        } else if (gameState == PLAYER_SERVICE && ball_in_player_stick()) {
-            play_player_pong_sound();
-            change_state(PLAYER_RETURN);
+/**
+  Applies to platform the effects queued by game logic in last tick, which started at tick_start.
+  Sounds are scheduled at the time their event happened within the tick.
+ */
+void process_game_events(GameContext* ctx, uint64_t tick_start)
+{
+    for (int i = 0; i < game_events_count(ctx); i++) {
+        const GAME_EVENT* event = game_event(ctx, i);
+        uint64_t time = tick_start + (uint64_t)(event->time * 1e9f);
+        switch (event->type) {
+        case START_SOUND:
+            play_start_sound(time);
+            break;
+        case PLAYER_PONG_SOUND:
+            play_player_pong_sound(event, time);
+            break;
+        case OPPONENT_PONG_SOUND:
+            play_opponent_pong_sound(event, time);
+            break;
+        case WALL_HIT_SOUND:
+            play_wall_hit_sound(event, time);
+            break;
+        case PLAYER_WINS_SOUND:
+            play_player_wins_sound(time);
+            break;
+        case OPPONENT_WINS_SOUND:
+            play_opponent_wins_sound(time);
+            break;
+        case SHOW_CURSOR:
+            sys_show_cursor(1);
+            break;
+        case HIDE_CURSOR:
+            sys_show_cursor(0);
+            break;
+        case CENTER_MOUSE:
+            sys_mouse_center(WINDOW_WIDTH, WINDOW_HEIGHT);
+            break;
         }
-        break;
-    case MOUSEMOTION:
-        break;
     }
-    return 0;
+    clear_game_events(ctx);
 }
@@ -0,0 +1,431 @@
+/**
+  @file mixer.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Real-time mixer of a fixed pool of voices, run from the audio device callback.
+
+  Game thread writes commands into a ring and publishes them by moving its write counter;
+  audio thread applies all published commands at the start of each device buffer and mixes
+  the active voices into it. A sound without time starts at most one device buffer after it is
+  played. A sound for an event at a time starts schedule delay later, at the sample of the buffer
+  that falls then: mixer follows the mixer clock time of buffers from the frames it renders,
+  corrected slowly by callback times, so sounds keep the spacing of their events to the sample.
+  Commands are stamped with mixer clock, so the delay until their sound reaches the device is
+  measured when they are applied. Voices either play a clip rendered beforehand or synthetize a
+  SYNTH_VOICE set up by the game thread, block by block, as they play. Optional music is mixed
+  with them and an optional reverb runs on the mix.
+ */
+
+#include "mixer.h"
+#include "atomics.h"
+#include <string.h>
+
+#define MIXER_COMMANDS_MASK (MIXER_COMMANDS - 1)
+
+void mixer_init(MIXER* mixer, MIXER_CLOCK clock)
+{
+    memset(mixer, 0, sizeof(MIXER));
+    mixer->clock = clock;
+}
+
+static int push_command(MIXER* mixer, const MIXER_COMMAND* command)
+{
+    unsigned int written = mixer->commands_written;
+    if (written - atomic_load_acquire(&mixer->commands_read) >= MIXER_COMMANDS) {
+        mixer->dropped_commands++;
+        return -1;
+    }
+    mixer->commands[written & MIXER_COMMANDS_MASK] = *command;
+    mixer->commands[written & MIXER_COMMANDS_MASK].time = mixer->clock();
+    atomic_store_release(&mixer->commands_written, written + 1);
+    return 0;
+}
+
+/**
+  Sounds played for an event at a time start delay nanoseconds after it, at sample_rate frames
+  per second. delay must cover the time until the game thread plays them, plus a device buffer.
+ */
+void mixer_set_schedule(MIXER* mixer, int sample_rate, uint64_t delay)
+{
+    mixer->schedule_delay = delay;
+    atomic_store_release(&mixer->sample_rate, sample_rate);
+}
+
+static void setup_play_command(MIXER* mixer, MIXER_COMMAND* command, uint64_t at)
+{
+    memset(command, 0, sizeof(MIXER_COMMAND));
+    command->at = at;
+    if (++mixer->next_id == 0) {
+        mixer->next_id = 1;
+    }
+    command->type = MIXER_PLAY;
+    command->id = mixer->next_id;
+}
+
+/**
+  Plays a clip scaled by gain on both channels, for an event at mixer clock time at (0 plays it
+  as soon as possible). Returns id of the voice for mixer_stop,
+  or 0 if the command queue is full.
+ */
+unsigned int mixer_play(MIXER* mixer, const SOUND_CLIP* clip, float gain, uint64_t at)
+{
+    MIXER_COMMAND command;
+
+    setup_play_command(mixer, &command, at);
+    command.clip = clip;
+    command.length = clip->length;
+    command.gains[0] = command.gains[1] = gain;
+    return push_command(mixer, &command) == 0 ? command.id : 0;
+}
+
+/**
+  Plays a copy of a started synth voice, synthetized by audio thread as it plays. pan goes from
+  -1 (left) to 1 (right); centered voices play at gain on both channels, panned ones lower the
+  opposite channel. at is as in mixer_play. Returns id of the voice for mixer_stop, or 0 if the
+  command queue is full.
+ */
+unsigned int mixer_play_synth(MIXER* mixer, const SYNTH_VOICE* synth, float gain, float pan, uint64_t at)
+{
+    MIXER_COMMAND command;
+
+    setup_play_command(mixer, &command, at);
+    command.synth = *synth;
+    command.length = synth->length - synth->position;
+    command.gains[0] = gain * (pan > 0.0f ? 1.0f - pan : 1.0f);
+    command.gains[1] = gain * (pan < 0.0f ? 1.0f + pan : 1.0f);
+    return push_command(mixer, &command) == 0 ? command.id : 0;
+}
+
+void mixer_stop(MIXER* mixer, unsigned int id)
+{
+    MIXER_COMMAND command;
+
+    memset(&command, 0, sizeof(MIXER_COMMAND));
+    command.type = MIXER_STOP;
+    command.id = id;
+    push_command(mixer, &command);
+}
+
+/**
+  Sets reverb of mixed voices, or none if reverb is NULL. A reverb set must outlive the audio thread.
+ */
+void mixer_set_reverb(MIXER* mixer, REVERB* reverb)
+{
+    atomic_store_release(&mixer->reverb, reverb);
+}
+
+/**
+  Sets music mixed with voices, or none if music is NULL. A sequencer set must outlive the audio thread.
+ */
+void mixer_set_music(MIXER* mixer, SEQUENCER* music)
+{
+    atomic_store_release(&mixer->music, music);
+}
+
+static MIXER_VOICE* free_voice(MIXER* mixer)
+{
+    MIXER_VOICE* nearest_end = &mixer->voices[0];
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        MIXER_VOICE* voice = &mixer->voices[i];
+        if (!voice->id) {
+            return voice;
+        }
+        if (voice->length - voice->position < nearest_end->length - nearest_end->position) {
+            nearest_end = voice;
+        }
+    }
+    mixer->stolen_voices++;
+    return nearest_end;
+}
+
+static void record_latency(MIXER* mixer, uint64_t latency)
+{
+    uint64_t bin = latency / MIXER_LATENCY_BIN_NS;
+    mixer->latency_histogram[bin < MIXER_LATENCY_BINS ? bin : MIXER_LATENCY_BINS]++;
+    if (latency > mixer->latency_max) {
+        mixer->latency_max = latency;
+    }
+    mixer->latency_count++;
+}
+
+/**
+  Frames from start of current buffer until a sound for an event at time at starts. Records its
+  latency from the event.
+ */
+static int schedule_voice(MIXER* mixer, uint64_t at, int sample_rate)
+{
+    int64_t due;
+    int delay;
+
+    due = (int64_t)(at + mixer->schedule_delay - mixer->stream_time);
+    if (due < 0) {
+        mixer->late_sounds++;
+        mixer->late_max = (uint64_t)-due > mixer->late_max ? (uint64_t)-due : mixer->late_max;
+        record_latency(mixer, mixer->stream_time - at);
+        return 0;
+    }
+    delay = (int)(due * sample_rate / 1000000000LL);
+    record_latency(mixer, mixer->stream_time + (uint64_t)delay * 1000000000ULL / sample_rate - at);
+    return delay;
+}
+
+static void apply_command(MIXER* mixer, const MIXER_COMMAND* command, int sample_rate, uint64_t now)
+{
+    MIXER_VOICE* voice;
+
+    if (command->type == MIXER_PLAY) {
+        int delay = 0;
+        if (command->at && sample_rate) {
+            delay = schedule_voice(mixer, command->at, sample_rate);
+        } else {
+            record_latency(mixer, now > command->time ? now - command->time : 0);
+        }
+        voice = free_voice(mixer);
+        voice->id = command->id;
+        voice->clip = command->clip;
+        if (!command->clip) {
+            voice->synth = command->synth;
+        }
+        voice->length = command->length;
+        voice->position = 0;
+        voice->delay = delay;
+        voice->gains[0] = command->gains[0];
+        voice->gains[1] = command->gains[1];
+        return;
+    }
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        if (mixer->voices[i].id == command->id) {
+            mixer->voices[i].id = 0;
+        }
+    }
+}
+
+static void mix_voice(float* out, const sample_t* samples, int count, const float* gains)
+{
+    for (int i = 0; i < count; i++) {
+        out[i * MIXER_CHANNELS] += samples[i] * gains[0];
+        out[i * MIXER_CHANNELS + 1] += samples[i] * gains[1];
+    }
+}
+
+static void mix_synth_voice(MIXER* mixer, MIXER_VOICE* voice, float* out, int count)
+{
+    sample_t block[SYNTH_BLOCK];
+    uint64_t start = mixer->clock();
+
+    for (int done = 0; done < count; done += SYNTH_BLOCK) {
+        int length = count - done < SYNTH_BLOCK ? count - done : SYNTH_BLOCK;
+        synth_voice_render(&voice->synth, block, length);
+        mix_voice(out + done * MIXER_CHANNELS, block, length, voice->gains);
+    }
+    mixer->synth_time += mixer->clock() - start;
+    mixer->synth_frames += count;
+}
+
+/**
+  Mixes next frames of count synth voices sharing oscillator types, synthetized together.
+ */
+static void mix_synth_lanes(MIXER* mixer, MIXER_VOICE* const* voices, int count, float* out, int frames)
+{
+    sample_t blocks[SYNTH_LANES][SYNTH_BLOCK];
+    SYNTH_VOICE* synths[SYNTH_LANES];
+    sample_t* outs[SYNTH_LANES];
+
+    for (int l = 0; l < count; l++) {
+        synths[l] = &voices[l]->synth;
+        outs[l] = blocks[l];
+    }
+    for (int done = 0; done < frames; done += SYNTH_BLOCK) {
+        int length = frames - done < SYNTH_BLOCK ? frames - done : SYNTH_BLOCK;
+        synth_voices_render(synths, outs, count, length);
+        for (int l = 0; l < count; l++) {
+            MIXER_VOICE* voice = voices[l];
+            int rendered = voice->length - voice->position < length ? voice->length - voice->position : length;
+            mix_voice(out + done * MIXER_CHANNELS, blocks[l], rendered, voice->gains);
+            voice->position += rendered;
+            mixer->synth_frames += rendered;
+        }
+    }
+    for (int l = 0; l < count; l++) {
+        if (voices[l]->position >= voices[l]->length) {
+            voices[l]->id = 0;
+        }
+    }
+}
+
+static int plays_synth_from_start(const MIXER_VOICE* voice)
+{
+    return voice->id && !voice->clip && !voice->delay;
+}
+
+/**
+  Mixes synth voices that play from the start of the buffer, synthetizing the ones sharing
+  oscillator types together, SYNTH_LANES at a time.
+ */
+static void mix_synth_voices(MIXER* mixer, float* out, int frames)
+{
+    int grouped[MIXER_VOICES] = { 0 };
+    int groups = 0;
+    uint64_t start = 0;
+
+    for (int v = 0; v < MIXER_VOICES; v++) {
+        const SYNTH_VOICE* synth = &mixer->voices[v].synth;
+        MIXER_VOICE* lanes[SYNTH_LANES];
+        int count = 0;
+
+        if (grouped[v] || !plays_synth_from_start(&mixer->voices[v])) {
+            continue;
+        }
+        for (int w = v; w < MIXER_VOICES && count < SYNTH_LANES; w++) {
+            MIXER_VOICE* voice = &mixer->voices[w];
+            if (!grouped[w] && plays_synth_from_start(voice) && voice->synth.oscillator1_type == synth->oscillator1_type
+                && voice->synth.oscillator2_type == synth->oscillator2_type) {
+                lanes[count++] = voice;
+                grouped[w] = 1;
+            }
+        }
+        if (!groups++) {
+            start = mixer->clock();
+        }
+        mix_synth_lanes(mixer, lanes, count, out, frames);
+    }
+    if (groups) {
+        mixer->synth_time += mixer->clock() - start;
+    }
+}
+
+/**
+  Moves stream time to the buffer starting now. Buffers follow each other by the frames rendered;
+  callback time only corrects that slowly, as callbacks jitter, unless buffers stopped for longer
+  than a buffer.
+ */
+static void advance_stream_time(MIXER* mixer, int sample_rate, uint64_t now, int frames)
+{
+    uint64_t expected = mixer->stream_time + (uint64_t)mixer->stream_frames * 1000000000ULL / sample_rate;
+    int64_t drift = (int64_t)(now - expected);
+    int64_t buffer = (int64_t)frames * 1000000000LL / sample_rate;
+
+    if (!mixer->stream_time || drift > buffer || drift < -buffer) {
+        mixer->stream_time = now;
+    } else {
+        mixer->stream_time = expected + drift / 8;
+    }
+    mixer->stream_frames = frames;
+}
+
+static void mix_voice_frames(MIXER* mixer, MIXER_VOICE* voice, float* out, int frames)
+{
+    int count;
+
+    if (voice->delay >= frames) {
+        voice->delay -= frames;
+        return;
+    }
+    out += voice->delay * MIXER_CHANNELS;
+    frames -= voice->delay;
+    voice->delay = 0;
+    count = voice->length - voice->position < frames ? voice->length - voice->position : frames;
+    if (voice->clip) {
+        clip_mix(voice->clip, voice->position, count, voice->gains, out);
+    } else {
+        mix_synth_voice(mixer, voice, out, count);
+    }
+    voice->position += count;
+    if (voice->position >= voice->length) {
+        voice->id = 0;
+    }
+}
+
+/**
+  Mixes next frames stereo frames of all voices into out. Called from audio thread.
+ */
+void mixer_render(MIXER* mixer, float* out, int frames)
+{
+    unsigned int written = atomic_load_acquire(&mixer->commands_written);
+    unsigned int read = mixer->commands_read;
+    int sample_rate = atomic_load_acquire(&mixer->sample_rate);
+    uint64_t now = read != written || sample_rate ? mixer->clock() : 0;
+    REVERB* reverb = atomic_load_acquire(&mixer->reverb);
+    SEQUENCER* music = atomic_load_acquire(&mixer->music);
+
+    if (sample_rate) {
+        advance_stream_time(mixer, sample_rate, now, frames);
+    }
+    while (read != written) {
+        apply_command(mixer, &mixer->commands[read & MIXER_COMMANDS_MASK], sample_rate, now);
+        read++;
+    }
+    atomic_store_release(&mixer->commands_read, read);
+
+    memset(out, 0, sizeof(float) * frames * MIXER_CHANNELS);
+    mix_synth_voices(mixer, out, frames);
+    for (int v = 0; v < MIXER_VOICES; v++) {
+        // synth voices left start within this buffer
+        if (mixer->voices[v].id && (mixer->voices[v].clip || mixer->voices[v].delay)) {
+            mix_voice_frames(mixer, &mixer->voices[v], out, frames);
+        }
+    }
+    if (music) {
+        uint64_t start = mixer->clock();
+        sequencer_render(music, out, frames);
+        mixer->music_time += mixer->clock() - start;
+        mixer->music_frames += frames;
+    }
+    if (reverb) {
+        reverb_process(reverb, out, frames);
+    }
+    // overlapping voices may add up over full scale
+    for (int i = 0; i < frames * MIXER_CHANNELS; i++) {
+        if (out[i] > 1.0f) {
+            out[i] = 1.0f;
+        } else if (out[i] < -1.0f) {
+            out[i] = -1.0f;
+        }
+    }
+}
+
+static double latency_percentile(const MIXER* mixer, double percentile)
+{
+    unsigned int target = (unsigned int)(mixer->latency_count * percentile);
+    unsigned int accumulated = 0;
+    for (int i = 0; i < MIXER_LATENCY_BINS; i++) {
+        accumulated += mixer->latency_histogram[i];
+        if (accumulated > target) {
+            // upper bound of bin, or max latency if it is lower
+            uint64_t bound = (uint64_t)(i + 1) * MIXER_LATENCY_BIN_NS;
+            return (bound < mixer->latency_max ? bound : mixer->latency_max) / 1000000.0;
+        }
+    }
+    return mixer->latency_max / 1000000.0;
+}
+
+/**
+  Latencies of sounds played so far. Read them when audio thread is stopped.
+ */
+void mixer_latency_stats(const MIXER* mixer, MIXER_LATENCY_STATS* stats)
+{
+    stats->count = mixer->latency_count;
+    stats->p50 = mixer->latency_count ? latency_percentile(mixer, 0.5) : 0.0;
+    stats->p99 = mixer->latency_count ? latency_percentile(mixer, 0.99) : 0.0;
+    stats->max = mixer->latency_max / 1000000.0;
+    stats->late = mixer->late_sounds;
+    stats->late_max = mixer->late_max / 1000000.0;
+}
+
+/**
+  Time audio thread spent synthetizing voices. Read it when audio thread is stopped.
+ */
+void mixer_synth_stats(const MIXER* mixer, MIXER_SYNTH_STATS* stats)
+{
+    stats->frames = mixer->synth_frames;
+    stats->frame_ns = mixer->synth_frames ? (double)mixer->synth_time / mixer->synth_frames : 0.0;
+}
+
+/**
+  Time audio thread spent rendering music. Read it when audio thread is stopped.
+ */
+void mixer_music_stats(const MIXER* mixer, MIXER_SYNTH_STATS* stats)
+{
+    stats->frames = mixer->music_frames;
+    stats->frame_ns = mixer->music_frames ? (double)mixer->music_time / mixer->music_frames : 0.0;
+}
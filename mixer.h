@@ -0,0 +1,148 @@
+/**
+  @file mixer.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Real-time mixer of a fixed pool of voices, run from the audio device callback.
+ */
+
+#ifndef _MIXER_H_
+#define _MIXER_H_
+
+#include "clip.h"
+#include "music.h"
+#include "reverb.h"
+#include "synth.h"
+#include <stdint.h>
+
+// voices playing at once. When all are busy, the one closest to its end is replaced.
+#define MIXER_VOICES 16
+
+// mixer output is interleaved stereo
+#define MIXER_CHANNELS 2
+
+// commands waiting for the audio thread, must be a power of two
+#define MIXER_COMMANDS 64
+
+// latency histogram bins of 0.1 ms, covering 100 ms
+#define MIXER_LATENCY_BINS 1000
+#define MIXER_LATENCY_BIN_NS 100000
+
+/**
+  Monotonic time in nanoseconds, the same for game and audio threads.
+ */
+typedef uint64_t (*MIXER_CLOCK)(void);
+
+typedef enum {
+    MIXER_PLAY,
+    MIXER_STOP
+} MIXER_COMMAND_TYPE;
+
+/**
+  @brief Request from game thread to audio thread. Clips must outlive the mixer.
+ */
+typedef struct {
+    MIXER_COMMAND_TYPE type;
+    unsigned int id;
+    /** when game thread sent the command */
+    uint64_t time;
+    /** mixer clock time of the event the sound is for, or 0 to play it as soon as possible */
+    uint64_t at;
+    /** clip to play, or NULL to synthetize synth voice */
+    const SOUND_CLIP* clip;
+    SYNTH_VOICE synth;
+    int length;
+    float gains[MIXER_CHANNELS];
+} MIXER_COMMAND;
+
+/**
+  @brief A clip or a synth voice being played. Voices are only touched by the audio thread.
+ */
+typedef struct {
+    /** id given by mixer_play, 0 if voice is free */
+    unsigned int id;
+    /** clip played, NULL if voice is synthetized while it plays */
+    const SOUND_CLIP* clip;
+    SYNTH_VOICE synth;
+    int length;
+    int position;
+    /** frames of silence left before the voice starts */
+    int delay;
+    float gains[MIXER_CHANNELS];
+} MIXER_VOICE;
+
+/**
+  @brief Time from the event of a sound, or from mixer_play if it has none, until its first sample
+  is handed to device, in milliseconds. Late sounds couldn't start at their scheduled sample and
+  late_max is how far past it the latest one started.
+ */
+typedef struct {
+    unsigned int count;
+    double p50;
+    double p99;
+    double max;
+    unsigned int late;
+    double late_max;
+} MIXER_LATENCY_STATS;
+
+/**
+  @brief Audio thread time spent synthetizing voices or music.
+ */
+typedef struct {
+    /** samples synthetized, added up over all voices; stereo frames for music */
+    uint64_t frames;
+    /** nanoseconds per synthetized sample */
+    double frame_ns;
+} MIXER_SYNTH_STATS;
+
+/**
+  @brief Voice pool and single producer, single consumer command queue. Game thread only calls
+  mixer_play and mixer_stop, audio thread only calls mixer_render, so neither locks nor allocates.
+ */
+typedef struct {
+    MIXER_COMMAND commands[MIXER_COMMANDS];
+    /** commands pushed by game thread and popped by audio thread, counted since start */
+    volatile unsigned int commands_written;
+    volatile unsigned int commands_read;
+    unsigned int next_id;
+    /** commands lost because queue was full, counted by game thread */
+    unsigned int dropped_commands;
+    MIXER_VOICE voices[MIXER_VOICES];
+    /** voices replaced before their end, counted by audio thread */
+    unsigned int stolen_voices;
+    MIXER_CLOCK clock;
+    /** latencies of played sounds, written by audio thread; last bin counts the ones out of range */
+    unsigned int latency_histogram[MIXER_LATENCY_BINS + 1];
+    unsigned int latency_count;
+    uint64_t latency_max;
+    /** device rate, 0 until mixer_set_schedule, and delay from the event of a sound to its first sample */
+    volatile int sample_rate;
+    uint64_t schedule_delay;
+    /** mixer clock time estimated for first frame of current buffer and frames of last one, kept by audio thread */
+    uint64_t stream_time;
+    int stream_frames;
+    unsigned int late_sounds;
+    uint64_t late_max;
+    /** synthesis work, written by audio thread */
+    uint64_t synth_frames;
+    uint64_t synth_time;
+    /** reverb of mix bus, NULL if none */
+    REVERB* volatile reverb;
+    /** music mixed with voices, NULL if none, and its work, written by audio thread */
+    SEQUENCER* volatile music;
+    uint64_t music_frames;
+    uint64_t music_time;
+} MIXER;
+
+void mixer_init(MIXER* mixer, MIXER_CLOCK clock);
+void mixer_set_schedule(MIXER* mixer, int sample_rate, uint64_t delay);
+unsigned int mixer_play(MIXER* mixer, const SOUND_CLIP* clip, float gain, uint64_t at);
+unsigned int mixer_play_synth(MIXER* mixer, const SYNTH_VOICE* synth, float gain, float pan, uint64_t at);
+void mixer_stop(MIXER* mixer, unsigned int id);
+void mixer_set_reverb(MIXER* mixer, REVERB* reverb);
+void mixer_set_music(MIXER* mixer, SEQUENCER* music);
+void mixer_render(MIXER* mixer, float* out, int frames);
+void mixer_latency_stats(const MIXER* mixer, MIXER_LATENCY_STATS* stats);
+void mixer_synth_stats(const MIXER* mixer, MIXER_SYNTH_STATS* stats);
+void mixer_music_stats(const MIXER* mixer, MIXER_SYNTH_STATS* stats);
+
+#endif
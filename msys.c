@@ -7,6 +7,8 @@
 
 #include <SDL.h>
 #include <stdio.h>
+#include <string.h>
+#include "input.h"
 #include "msys.h"
 
 #ifdef _WINDOWS
@@ -22,9 +24,39 @@ int video_initialized = 0;
 int gl_initialized = 0;
 int sound_initialized = 0;
 
-static void format_event(SDL_Event* event, SysEvent* sysEvent);
+static SysAudioCallback audio_callback;
+static void* audio_callback_data;
 
-static char error_str[128];
+// stereo frames mixed at once for mono devices
+#define AUDIO_CHUNK_FRAMES 256
+static float audio_chunk[AUDIO_CHUNK_FRAMES * 2];
+
+static int format_event(SDL_Event* event, SysEvent* sysEvent, uint64_t now, Uint32 ticks);
+
+static char error_str[256];
+
+static Uint64 counter_start = 0;
+static Uint64 counter_frequency = 0;
+
+/**
+  Frame pacer. Sleeps until a bit before the deadline and spins the last stretch, because
+  SDL_Delay wakes up late by up to some milliseconds. Spin time adapts to measured oversleep.
+ */
+#define PACER_HISTOGRAM_BINS 500
+// each bin of jitter histogram covers 10 microseconds, so histogram covers 5 ms
+#define PACER_HISTOGRAM_BIN_NS 10000
+#define PACER_MIN_SPIN_NS 500000
+#define PACER_MAX_SPIN_NS 4000000
+
+static uint64_t pacer_period_ns;
+static uint64_t pacer_deadline_ns;
+static uint64_t pacer_spin_ns = 2000000;
+static uint64_t pacer_oversleep_ns = 0;
+static uint64_t pacer_jitter_max_ns;
+static unsigned int pacer_frames;
+static unsigned int pacer_missed;
+// last bin counts jitters out of histogram range
+static unsigned int pacer_histogram[PACER_HISTOGRAM_BINS + 1];
 
 int sys_init_video(int width, int height)
 {
@@ -58,8 +90,46 @@ int sys_init_video(int width, int height)
     return 0;
 }
 
-int sys_init_sound(int sample_freq)
+static void SDLCALL fill_audio_buffer(void* userdata, Uint8* stream, int len)
 {
+    float* out = (float*)stream;
+    int channels = have.channels;
+    int frames = len / (int)(sizeof(float) * channels);
+
+    if (channels == 1) {
+        // stereo frames don't fit in device buffer, mix them down by chunks
+        for (int done = 0; done < frames; done += AUDIO_CHUNK_FRAMES) {
+            int count = frames - done < AUDIO_CHUNK_FRAMES ? frames - done : AUDIO_CHUNK_FRAMES;
+            audio_callback(audio_callback_data, audio_chunk, count);
+            for (int i = 0; i < count; i++) {
+                out[done + i] = (audio_chunk[i * 2] + audio_chunk[i * 2 + 1]) * 0.5f;
+            }
+        }
+        return;
+    }
+    audio_callback(audio_callback_data, out, frames);
+    // spread stereo frames over channels, from the end so none is overwritten before it is copied
+    if (channels > 2) {
+        for (int i = frames - 1; i >= 0; i--) {
+            float left = out[i * 2];
+            float right = out[i * 2 + 1];
+            for (int c = channels - 1; c >= 2; c--) {
+                out[i * channels + c] = 0.0f;
+            }
+            out[i * channels + 1] = right;
+            out[i * channels] = left;
+        }
+    }
+}
+
+/**
+  Opens audio device, which pulls samples from callback as it needs them. Device may choose
+  other sample rate, channels and buffer size than the ones asked, which are set in format.
+  Samples are always float, SDL converts them if device needs another format.
+ */
+int sys_init_sound(int sample_freq, int buffer_frames, SysAudioCallback callback, void* data, SysAudioFormat* format)
+{
+    Uint16 samples = 16;
 
 #ifdef _WINDOWS
     // avoid issue in SDL > 2.0.5 on Windows
@@ -71,31 +141,32 @@ int sys_init_sound(int sample_freq)
         return -1;
     }
 
+    // buffer size must be a power of two
+    while (samples < buffer_frames && samples < 32768) {
+        samples <<= 1;
+    }
     want.freq = sample_freq;
     want.format = AUDIO_F32SYS;
-    want.channels = 1;
-    want.samples = 2048;
-    want.callback = NULL;
+    want.channels = 2;
+    want.samples = samples;
+    want.callback = fill_audio_buffer;
+    audio_callback = callback;
+    audio_callback_data = data;
 
-    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
     if (dev == 0) {
 		    log_error("Failed opening audio device: %s\n", SDL_GetError());
         return -1;
-    } else if (have.format != want.format) {
-        SDL_CloseAudioDevice(dev);
-		    log_error("Failed getting sample format (AUDIO_F32SYS)\n");
-        return -1;
     }
+    format->sample_rate = have.freq;
+    format->channels = have.channels;
+    format->buffer_frames = have.samples;
     sound_initialized = 1;
     SDL_PauseAudioDevice(dev, 0);
     return 0;
 }
 
-void sys_play_sound(void* samples, int data_size)
-{
-    SDL_QueueAudio(dev, samples, data_size);
-}
-
 void sys_dispose_video()
 {
     if (gl_initialized) {
@@ -110,7 +181,7 @@ void sys_dispose_audio()
 {
     if (sound_initialized) {
         SDL_CloseAudioDevice(dev);
-        SDL_CloseAudio();
+        sound_initialized = 0;
     }
 }
 
@@ -124,16 +195,155 @@ unsigned int sys_get_ticks()
     return SDL_GetTicks();
 }
 
-int sys_wait(SysEvent* sysEvent, unsigned int milis)
+/**
+  Monotonic time in nanoseconds from high resolution performance counter.
+ */
+uint64_t sys_get_time_ns()
+{
+    if (!counter_frequency) {
+        counter_frequency = SDL_GetPerformanceFrequency();
+        counter_start = SDL_GetPerformanceCounter();
+    }
+    Uint64 counter = SDL_GetPerformanceCounter() - counter_start;
+    // split in seconds and remainder to avoid overflow
+    return (counter / counter_frequency) * 1000000000ULL
+        + (counter % counter_frequency) * 1000000000ULL / counter_frequency;
+}
+
+void sys_pacer_init(double frequency)
+{
+    pacer_period_ns = (uint64_t)(1000000000.0 / frequency + 0.5);
+    pacer_deadline_ns = sys_get_time_ns() + pacer_period_ns;
+    sys_pacer_reset_stats();
+}
+
+static void pacer_record_jitter(uint64_t jitter)
+{
+    int bin = (int)(jitter / PACER_HISTOGRAM_BIN_NS);
+    pacer_histogram[bin < PACER_HISTOGRAM_BINS ? bin : PACER_HISTOGRAM_BINS]++;
+    if (jitter > pacer_jitter_max_ns) {
+        pacer_jitter_max_ns = jitter;
+    }
+    pacer_frames++;
+}
+
+/**
+  Waits until deadline of current frame and sets deadline of next one. Deadlines are
+  absolute, so a late frame doesn't shift the ones after it, except when a frame is late
+  for more than a period: then pacer resynchronizes instead of rushing frames to catch up.
+  Returns current time in nanoseconds.
+ */
+uint64_t sys_pacer_wait()
+{
+    uint64_t now = sys_get_time_ns();
+    uint64_t sleep_until;
+
+    if (now >= pacer_deadline_ns) {
+        pacer_missed++;
+        pacer_record_jitter(now - pacer_deadline_ns);
+        if (now - pacer_deadline_ns > pacer_period_ns) {
+            pacer_deadline_ns = now;
+        }
+        pacer_deadline_ns += pacer_period_ns;
+        return now;
+    }
+    if (pacer_deadline_ns - now > pacer_spin_ns) {
+        sleep_until = pacer_deadline_ns - pacer_spin_ns;
+        SDL_Delay((Uint32)((sleep_until - now) / 1000000));
+        now = sys_get_time_ns();
+        // adapt spin time to twice the average oversleep of SDL_Delay
+        pacer_oversleep_ns = (pacer_oversleep_ns * 7 + (now > sleep_until ? now - sleep_until : 0)) / 8;
+        pacer_spin_ns = PACER_MIN_SPIN_NS + pacer_oversleep_ns * 2;
+        if (pacer_spin_ns > PACER_MAX_SPIN_NS) {
+            pacer_spin_ns = PACER_MAX_SPIN_NS;
+        }
+    }
+    while (now < pacer_deadline_ns) {
+        now = sys_get_time_ns();
+    }
+    pacer_record_jitter(now - pacer_deadline_ns);
+    pacer_deadline_ns += pacer_period_ns;
+    return now;
+}
+
+static double pacer_percentile(double percentile)
+{
+    unsigned int target = (unsigned int)(pacer_frames * percentile);
+    unsigned int accumulated = 0;
+    for (int i = 0; i < PACER_HISTOGRAM_BINS; i++) {
+        accumulated += pacer_histogram[i];
+        if (accumulated > target) {
+            // upper bound of bin
+            return (i + 1) * PACER_HISTOGRAM_BIN_NS / 1000000.0;
+        }
+    }
+    return pacer_jitter_max_ns / 1000000.0;
+}
+
+void sys_pacer_stats(SysPacerStats* stats)
 {
-    int hasEvent = 0;
+    stats->frames = pacer_frames;
+    stats->missed = pacer_missed;
+    stats->jitter_p50 = pacer_frames ? pacer_percentile(0.5) : 0.0;
+    stats->jitter_p99 = pacer_frames ? pacer_percentile(0.99) : 0.0;
+    stats->jitter_max = pacer_jitter_max_ns / 1000000.0;
+}
+
+void sys_pacer_reset_stats()
+{
+    memset(pacer_histogram, 0, sizeof(pacer_histogram));
+    pacer_frames = 0;
+    pacer_missed = 0;
+    pacer_jitter_max_ns = 0;
+}
+
+/**
+  Drains SDL event queue into input queue of a match, so events never wait behind others for
+  next frame. Returns number of queued events.
+ */
+int sys_pump_events(INPUT_QUEUE* queue)
+{
+    int queued = 0;
     SDL_Event event;
-    SDL_Delay(milis);
-    if (SDL_PollEvent(&event)) {
-      format_event(&event, sysEvent);
-      hasEvent = 1;
+    SysEvent sysEvent;
+    uint64_t now = sys_get_time_ns();
+    Uint32 ticks = SDL_GetTicks();
+    while (SDL_PollEvent(&event)) {
+        if (format_event(&event, &sysEvent, now, ticks) && input_push_event(queue, &sysEvent) == 0) {
+            queued++;
+        }
     }
-    return hasEvent;
+    return queued;
+}
+
+/**
+  Sleeps until time, or a bit later because of scheduler granularity.
+ */
+void sys_sleep_until(uint64_t time_ns)
+{
+    uint64_t now = sys_get_time_ns();
+    if (time_ns > now) {
+        SDL_Delay((Uint32)((time_ns - now + 999999) / 1000000));
+    }
+}
+
+void* sys_create_thread(const char* name, SysThreadFunction function, void* data)
+{
+    return SDL_CreateThread(function, name, data);
+}
+
+void sys_wait_thread(void* thread)
+{
+    SDL_WaitThread((SDL_Thread*)thread, NULL);
+}
+
+/**
+  Binds GL context to calling thread, or releases it from calling thread if current is 0.
+  A context is current in one thread at a time.
+ */
+int sys_gl_make_current(int current)
+{
+    return SDL_GL_MakeCurrent(window, current ? mainContext : NULL);
 }
 
 void sys_swap_buffers()
@@ -150,7 +360,11 @@ void sys_show_cursor(int show)
     SDL_ShowCursor(show ? SDL_TRUE : SDL_FALSE);
 }
 
-static void format_event(SDL_Event* event, SysEvent* sysEvent)
+/**
+  Translates SDL event to game event. Returns 0 if event is not used by game.
+  SDL timestamps (milliseconds) are moved to performance counter clock using current time of both clocks.
+ */
+static int format_event(SDL_Event* event, SysEvent* sysEvent, uint64_t now, Uint32 ticks)
 {
     switch (event->type) {
     case SDL_QUIT:
@@ -160,18 +374,25 @@ static void format_event(SDL_Event* event, SysEvent* sysEvent)
         sysEvent->type = MOUSEMOTION;
         break;
     case SDL_MOUSEBUTTONUP:
-        if (event->button.button == SDL_BUTTON_LEFT) {
-            sysEvent->type = MOUSELBUTTONUP;
+        if (event->button.button != SDL_BUTTON_LEFT) {
+            return 0;
         }
+        sysEvent->type = MOUSELBUTTONUP;
         break;
     case SDL_KEYDOWN:
-        if (event->key.keysym.sym == SDLK_ESCAPE) {
-            sysEvent->type = CLOSE;
+        if (event->key.keysym.sym != SDLK_ESCAPE) {
+            return 0;
         }
+        sysEvent->type = CLOSE;
         break;
+    default:
+        return 0;
     }
+    uint64_t age = (Sint32)(ticks - event->common.timestamp) > 0 ? (ticks - event->common.timestamp) * 1000000ULL : 0;
+    sysEvent->timestamp = age < now ? now - age : 0;
     sysEvent->x = event->motion.x;
     sysEvent->y = event->motion.y;
+    return 1;
 }
 
 void sys_mouse_position(int* x, int* y) {
@@ -192,3 +413,17 @@ void log_error(char* format, ...)
 	fprintf(stderr, "%s\n", error_str);
 #endif
 }
+
+void log_info(char* format, ...)
+{
+	va_list argptr;
+	va_start(argptr, format);
+	vsnprintf(error_str, sizeof(error_str), format, argptr);
+	va_end(argptr);
+
+#ifdef _WINDOWS
+	OutputDebugStringA(error_str);
+#else
+	fprintf(stdout, "%s\n", error_str);
+#endif
+}
@@ -8,6 +8,11 @@
 #ifndef _MSYS_H_
 #define _MSYS_H_
 
+#include <stdint.h>
+
+// input queue events are pumped into, see input.h
+struct INPUT_QUEUE;
+
 typedef enum {
     MOUSEMOTION,
     MOUSELBUTTONUP,
@@ -16,20 +21,62 @@ typedef enum {
 
 typedef struct {
     SysEventType type;
+    /** time of event in nanoseconds, same clock as sys_get_time_ns */
+    uint64_t timestamp;
     int x;
     int y;
     int prevx;
     int prevy;
 } SysEvent;
 
+/**
+  Frame pacer statistics. Jitter is the delay between frame deadline and the moment
+  pacer returns, in milliseconds.
+ */
+typedef struct {
+    unsigned int frames;
+    unsigned int missed;
+    double jitter_p50;
+    double jitter_p99;
+    double jitter_max;
+} SysPacerStats;
+
+typedef int (*SysThreadFunction)(void* data);
+
+/**
+  Fills frames stereo frames of audio device buffer, left and right samples interleaved. Runs in
+  the audio thread.
+ */
+typedef void (*SysAudioCallback)(void* data, float* out, int frames);
+
+/**
+  Output format agreed with audio device. Samples are float. Stereo frames are mixed down on mono
+  devices; on devices with more channels, the extra ones are silent.
+ */
+typedef struct {
+    int sample_rate;
+    int channels;
+    int buffer_frames;
+} SysAudioFormat;
+
 int sys_init_video(int width, int height);
-int sys_init_sound(int sample_rate);
-void sys_play_sound(void* samples, int data_size);
+int sys_init_sound(int sample_rate, int buffer_frames, SysAudioCallback callback, void* data, SysAudioFormat* format);
 void sys_dispose_video();
 void sys_dispose_audio();
 void sys_quit();
 unsigned int sys_get_ticks();
-int sys_wait(SysEvent* event, unsigned int milis);
+uint64_t sys_get_time_ns();
+int sys_pump_events(struct INPUT_QUEUE* queue);
+
+void sys_pacer_init(double frequency);
+uint64_t sys_pacer_wait();
+void sys_pacer_stats(SysPacerStats* stats);
+void sys_pacer_reset_stats();
+
+void sys_sleep_until(uint64_t time_ns);
+void* sys_create_thread(const char* name, SysThreadFunction function, void* data);
+void sys_wait_thread(void* thread);
+int sys_gl_make_current(int current);
 
 void sys_swap_buffers();
 void sys_mouse_center(int width, int height);
@@ -37,5 +84,6 @@ void sys_show_cursor(int show);
 void sys_mouse_position(int* x, int* y);
 
 void log_error(char* format, ...);
+void log_info(char* format, ...);
 
 #endif
@@ -0,0 +1,391 @@
+/**
+  @file multiball.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Multi-ball mode. Extra balls stored as structure of arrays and moved by vectorized kernels.
+
+  Each tick every ball moves, bounces on walls and, when it reaches a stick plane, is tested
+  against the stick. Player stick returns the balls it covers; a missed ball comes back from
+  computer stick plane. Computer side always returns balls. Kernels process 1 (scalar), 4 (SSE2)
+  or 8 (AVX2) balls at a time with the same float operations, so all of them give the same
+  results. AVX2 is chosen at run time when CPU supports it.
+ */
+
+#include "multiball.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MULTIBALL_HAVE_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(MULTIBALL_HAVE_SSE) && (defined(__GNUC__) || defined(__AVX2__))
+#define MULTIBALL_HAVE_AVX2
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+#endif
+
+/**
+  Limits of ball center for a tick, computed once from match bodies.
+ */
+typedef struct {
+    float min_x, max_x;
+    float min_y, max_y;
+    float player_z, opponent_z;
+    float width;
+    float stick_left, stick_right;
+    float stick_bottom, stick_top;
+} MULTIBALL_BOUNDS;
+
+static void set_stick_bounds(MULTIBALL_BOUNDS* bounds, float ball_width, const BODY* stick)
+{
+    bounds->width = ball_width;
+    bounds->stick_left = stick->x - stick->width2;
+    bounds->stick_right = stick->x + stick->width2;
+    bounds->stick_bottom = stick->y - stick->height2;
+    bounds->stick_top = stick->y + stick->height2;
+}
+
+static int count_bits(int mask)
+{
+    int bits = 0;
+    for (; mask; mask &= mask - 1) {
+        bits++;
+    }
+    return bits;
+}
+
+static int in_stick_scalar(float x, float y, const MULTIBALL_BOUNDS* b)
+{
+    return (x - b->width) < b->stick_right && (x + b->width) > b->stick_left && (y - b->width) < b->stick_top && (y + b->width) > b->stick_bottom;
+}
+
+static void step_scalar(BALL_SET* set, int first, const MULTIBALL_BOUNDS* b, float dt)
+{
+    for (int i = first; i < set->count; i++) {
+        float vx = set->vx[i], vy = set->vy[i], vz = set->vz[i];
+        float x = set->x[i] + vx * dt;
+        float y = set->y[i] + vy * dt;
+        float z = set->z[i] + vz * dt;
+
+        if (x > b->max_x) {
+            x = b->max_x;
+            vx = -vx;
+        } else if (x < b->min_x) {
+            x = b->min_x;
+            vx = -vx;
+        }
+        if (y > b->max_y) {
+            y = b->max_y;
+            vy = -vy;
+        } else if (y < b->min_y) {
+            y = b->min_y;
+            vy = -vy;
+        }
+        if (z > b->player_z) {
+            if (in_stick_scalar(x, y, b)) {
+                z = b->player_z;
+                vz = -vz;
+                set->returned++;
+            } else {
+                x = 0.0f;
+                y = 0.0f;
+                z = b->opponent_z;
+                set->missed++;
+            }
+        } else if (z < b->opponent_z) {
+            z = b->opponent_z;
+            vz = -vz;
+        }
+        set->x[i] = x;
+        set->y[i] = y;
+        set->z[i] = z;
+        set->vx[i] = vx;
+        set->vy[i] = vy;
+        set->vz[i] = vz;
+    }
+}
+
+#ifdef MULTIBALL_HAVE_SSE
+
+static __m128 select_sse(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static __m128 in_stick_sse(__m128 x, __m128 y, const MULTIBALL_BOUNDS* b)
+{
+    __m128 width = _mm_set1_ps(b->width);
+    __m128 inside = _mm_cmplt_ps(_mm_sub_ps(x, width), _mm_set1_ps(b->stick_right));
+    inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(x, width), _mm_set1_ps(b->stick_left)));
+    inside = _mm_and_ps(inside, _mm_cmplt_ps(_mm_sub_ps(y, width), _mm_set1_ps(b->stick_top)));
+    return _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(y, width), _mm_set1_ps(b->stick_bottom)));
+}
+
+/**
+  Clamps position to [min, max] and reverses velocity of balls that were out.
+ */
+static void bounce_sse(__m128* p, __m128* v, float min, float max)
+{
+    __m128 vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max);
+    __m128 out = _mm_or_ps(_mm_cmpgt_ps(*p, vmax), _mm_cmplt_ps(*p, vmin));
+    *p = _mm_max_ps(_mm_min_ps(*p, vmax), vmin);
+    *v = _mm_xor_ps(*v, _mm_and_ps(out, _mm_set1_ps(-0.0f)));
+}
+
+static int step_sse(BALL_SET* set, const MULTIBALL_BOUNDS* b, float dt)
+{
+    __m128 vdt = _mm_set1_ps(dt);
+    __m128 player_z = _mm_set1_ps(b->player_z);
+    __m128 opponent_z = _mm_set1_ps(b->opponent_z);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    int i;
+
+    for (i = 0; i + 4 <= set->count; i += 4) {
+        __m128 vx = _mm_load_ps(set->vx + i), vy = _mm_load_ps(set->vy + i), vz = _mm_load_ps(set->vz + i);
+        __m128 x = _mm_add_ps(_mm_load_ps(set->x + i), _mm_mul_ps(vx, vdt));
+        __m128 y = _mm_add_ps(_mm_load_ps(set->y + i), _mm_mul_ps(vy, vdt));
+        __m128 z = _mm_add_ps(_mm_load_ps(set->z + i), _mm_mul_ps(vz, vdt));
+        __m128 past, hit, miss, back;
+
+        bounce_sse(&x, &vx, b->min_x, b->max_x);
+        bounce_sse(&y, &vy, b->min_y, b->max_y);
+
+        past = _mm_cmpgt_ps(z, player_z);
+        hit = _mm_and_ps(past, in_stick_sse(x, y, b));
+        miss = _mm_andnot_ps(hit, past);
+        back = _mm_cmplt_ps(z, opponent_z);
+        z = select_sse(hit, player_z, z);
+        z = select_sse(_mm_or_ps(miss, back), opponent_z, z);
+        vz = _mm_xor_ps(vz, _mm_and_ps(_mm_or_ps(hit, back), sign));
+        x = _mm_andnot_ps(miss, x);
+        y = _mm_andnot_ps(miss, y);
+        set->returned += count_bits(_mm_movemask_ps(hit));
+        set->missed += count_bits(_mm_movemask_ps(miss));
+
+        _mm_store_ps(set->x + i, x);
+        _mm_store_ps(set->y + i, y);
+        _mm_store_ps(set->z + i, z);
+        _mm_store_ps(set->vx + i, vx);
+        _mm_store_ps(set->vy + i, vy);
+        _mm_store_ps(set->vz + i, vz);
+    }
+    return i;
+}
+
+#endif
+
+#ifdef MULTIBALL_HAVE_AVX2
+
+AVX2_FUNCTION static __m256 select_avx2(__m256 mask, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+AVX2_FUNCTION static __m256 in_stick_avx2(__m256 x, __m256 y, const MULTIBALL_BOUNDS* b)
+{
+    __m256 width = _mm256_set1_ps(b->width);
+    __m256 inside = _mm256_cmp_ps(_mm256_sub_ps(x, width), _mm256_set1_ps(b->stick_right), _CMP_LT_OQ);
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(x, width), _mm256_set1_ps(b->stick_left), _CMP_GT_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_sub_ps(y, width), _mm256_set1_ps(b->stick_top), _CMP_LT_OQ));
+    return _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(y, width), _mm256_set1_ps(b->stick_bottom), _CMP_GT_OQ));
+}
+
+AVX2_FUNCTION static void bounce_avx2(__m256* p, __m256* v, float min, float max)
+{
+    __m256 vmin = _mm256_set1_ps(min), vmax = _mm256_set1_ps(max);
+    __m256 out = _mm256_or_ps(_mm256_cmp_ps(*p, vmax, _CMP_GT_OQ), _mm256_cmp_ps(*p, vmin, _CMP_LT_OQ));
+    *p = _mm256_max_ps(_mm256_min_ps(*p, vmax), vmin);
+    *v = _mm256_xor_ps(*v, _mm256_and_ps(out, _mm256_set1_ps(-0.0f)));
+}
+
+AVX2_FUNCTION static int step_avx2(BALL_SET* set, const MULTIBALL_BOUNDS* b, float dt)
+{
+    __m256 vdt = _mm256_set1_ps(dt);
+    __m256 player_z = _mm256_set1_ps(b->player_z);
+    __m256 opponent_z = _mm256_set1_ps(b->opponent_z);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    int i;
+
+    for (i = 0; i + 8 <= set->count; i += 8) {
+        __m256 vx = _mm256_load_ps(set->vx + i), vy = _mm256_load_ps(set->vy + i), vz = _mm256_load_ps(set->vz + i);
+        __m256 x = _mm256_add_ps(_mm256_load_ps(set->x + i), _mm256_mul_ps(vx, vdt));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(set->y + i), _mm256_mul_ps(vy, vdt));
+        __m256 z = _mm256_add_ps(_mm256_load_ps(set->z + i), _mm256_mul_ps(vz, vdt));
+        __m256 past, hit, miss, back;
+
+        bounce_avx2(&x, &vx, b->min_x, b->max_x);
+        bounce_avx2(&y, &vy, b->min_y, b->max_y);
+
+        past = _mm256_cmp_ps(z, player_z, _CMP_GT_OQ);
+        hit = _mm256_and_ps(past, in_stick_avx2(x, y, b));
+        miss = _mm256_andnot_ps(hit, past);
+        back = _mm256_cmp_ps(z, opponent_z, _CMP_LT_OQ);
+        z = select_avx2(hit, player_z, z);
+        z = select_avx2(_mm256_or_ps(miss, back), opponent_z, z);
+        vz = _mm256_xor_ps(vz, _mm256_and_ps(_mm256_or_ps(hit, back), sign));
+        x = _mm256_andnot_ps(miss, x);
+        y = _mm256_andnot_ps(miss, y);
+        set->returned += count_bits(_mm256_movemask_ps(hit));
+        set->missed += count_bits(_mm256_movemask_ps(miss));
+
+        _mm256_store_ps(set->x + i, x);
+        _mm256_store_ps(set->y + i, y);
+        _mm256_store_ps(set->z + i, z);
+        _mm256_store_ps(set->vx + i, vx);
+        _mm256_store_ps(set->vy + i, vy);
+        _mm256_store_ps(set->vz + i, vz);
+    }
+    return i;
+}
+
+#endif
+
+int multiball_kernel_supported(MULTIBALL_KERNEL kernel)
+{
+    switch (kernel) {
+    case MULTIBALL_SCALAR:
+        return 1;
+    case MULTIBALL_SSE:
+#ifdef MULTIBALL_HAVE_SSE
+        return 1;
+#else
+        return 0;
+#endif
+    case MULTIBALL_AVX2:
+#if defined(MULTIBALL_HAVE_AVX2) && defined(__GNUC__)
+        return __builtin_cpu_supports("avx2") ? 1 : 0;
+#elif defined(MULTIBALL_HAVE_AVX2)
+        return 1;
+#else
+        return 0;
+#endif
+    }
+    return 0;
+}
+
+const char* multiball_kernel_name(MULTIBALL_KERNEL kernel)
+{
+    switch (kernel) {
+    case MULTIBALL_SCALAR:
+        return "scalar";
+    case MULTIBALL_SSE:
+        return "sse2";
+    case MULTIBALL_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+/**
+  Allocates arrays for count balls and selects fastest kernel for this CPU.
+  Returns -1 if there isn't memory enough.
+ */
+int multiball_create(BALL_SET* set, int count)
+{
+    // each array is rounded up to 8 floats, so all of them keep 32 bytes alignment
+    size_t stride = ((size_t)count + 7) & ~(size_t)7;
+    uintptr_t base;
+
+    memset(set, 0, sizeof(BALL_SET));
+    set->block = malloc(stride * 6 * sizeof(float) + 31);
+    if (!set->block) {
+        return -1;
+    }
+    base = ((uintptr_t)set->block + 31) & ~(uintptr_t)31;
+    set->x = (float*)base;
+    set->y = set->x + stride;
+    set->z = set->y + stride;
+    set->vx = set->z + stride;
+    set->vy = set->vx + stride;
+    set->vz = set->vy + stride;
+    memset(set->x, 0, stride * 6 * sizeof(float));
+    set->count = count;
+    set->kernel = MULTIBALL_SCALAR;
+    if (multiball_kernel_supported(MULTIBALL_SSE)) {
+        set->kernel = MULTIBALL_SSE;
+    }
+    if (multiball_kernel_supported(MULTIBALL_AVX2)) {
+        set->kernel = MULTIBALL_AVX2;
+    }
+    return 0;
+}
+
+void multiball_dispose(BALL_SET* set)
+{
+    free(set->block);
+    memset(set, 0, sizeof(BALL_SET));
+}
+
+static float launch_random(uint32_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) / 16777216.0f;
+}
+
+/**
+  Places balls at random in the stage with random directions. Balls have their own random
+  numbers, so launching them doesn't change the match.
+ */
+void multiball_launch(BALL_SET* set, const GameContext* ctx, uint32_t seed)
+{
+    const BODY* stage = &ctx->stage;
+    float radius = ctx->ball.width;
+    float player_z = ctx->player_stick.z - radius;
+    float opponent_z = ctx->opponent_stick.z + radius;
+    uint32_t state = seed ? seed : 1;
+
+    for (int i = 0; i < set->count; i++) {
+        set->x[i] = (launch_random(&state) * 2.0f - 1.0f) * (stage->width2 - radius);
+        set->y[i] = (launch_random(&state) * 2.0f - 1.0f) * (stage->height2 - radius);
+        set->z[i] = opponent_z + launch_random(&state) * (player_z - opponent_z);
+        set->vx[i] = (launch_random(&state) * 2.0f - 1.0f) * stage->width / 4.0f;
+        set->vy[i] = (launch_random(&state) * 2.0f - 1.0f) * stage->height / 4.0f;
+        set->vz[i] = (launch_random(&state) < 0.5f ? -1.0f : 1.0f) * stage->large * INITIAL_VELOCITY_FACTOR * (0.5f + launch_random(&state) * 0.5f);
+    }
+    set->returned = 0;
+    set->missed = 0;
+}
+
+/**
+  Advances all balls dt seconds against walls and sticks of match.
+ */
+void multiball_step(BALL_SET* set, const GameContext* ctx, float dt)
+{
+    MULTIBALL_BOUNDS bounds;
+    float radius = ctx->ball.width;
+    int done = 0;
+
+    bounds.min_x = -ctx->stage.width2 + radius;
+    bounds.max_x = ctx->stage.width2 - radius;
+    bounds.min_y = -ctx->stage.height2 + radius;
+    bounds.max_y = ctx->stage.height2 - radius;
+    bounds.player_z = ctx->player_stick.z - radius;
+    bounds.opponent_z = ctx->opponent_stick.z + radius;
+    set_stick_bounds(&bounds, radius, &ctx->player_stick);
+
+    switch (set->kernel) {
+#ifdef MULTIBALL_HAVE_AVX2
+    case MULTIBALL_AVX2:
+        done = step_avx2(set, &bounds, dt);
+        break;
+#endif
+#ifdef MULTIBALL_HAVE_SSE
+    case MULTIBALL_SSE:
+        done = step_sse(set, &bounds, dt);
+        break;
+#endif
+    default:
+        break;
+    }
+    // balls left over by vector kernels
+    step_scalar(set, done, &bounds, dt);
+}
+
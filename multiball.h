@@ -0,0 +1,49 @@
+/**
+  @file multiball.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Multi-ball mode. Extra balls stored as structure of arrays and moved by vectorized kernels.
+ */
+
+#ifndef _MULTIBALL_H_
+#define _MULTIBALL_H_
+
+#include "pong3d.h"
+#include <stdint.h>
+
+/**
+  @brief Implementations of multi-ball physics step. All of them give the same results.
+ */
+typedef enum {
+    MULTIBALL_SCALAR,
+    MULTIBALL_SSE,
+    MULTIBALL_AVX2
+} MULTIBALL_KERNEL;
+
+/**
+  @brief Extra balls of a match. Arrays are 32 bytes aligned, velocities in stage units per second.
+ */
+typedef struct BALL_SET {
+    int count;
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+    void* block;
+    MULTIBALL_KERNEL kernel;
+    /** balls returned and missed by player since balls were launched */
+    int returned;
+    int missed;
+} BALL_SET;
+
+int multiball_create(BALL_SET* set, int count);
+void multiball_dispose(BALL_SET* set);
+void multiball_launch(BALL_SET* set, const GameContext* ctx, uint32_t seed);
+void multiball_step(BALL_SET* set, const GameContext* ctx, float dt);
+
+int multiball_kernel_supported(MULTIBALL_KERNEL kernel);
+const char* multiball_kernel_name(MULTIBALL_KERNEL kernel);
+
+#endif
@@ -0,0 +1,108 @@
+/**
+  @file music.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Step sequencer playing background music with synth patches, rendered as it plays.
+
+  Each step, tracks with a note restart their voice with the note pitch. Voices are rendered in
+  blocks that never cross a step, so notes start on their exact sample. Step length is computed
+  from the speed set by the game thread when the step starts.
+ */
+
+#include "music.h"
+#include "atomics.h"
+#include <math.h>
+#include <string.h>
+
+/**
+  Sets up sequencer to play song from its start at gain. Call it before audio thread renders it.
+ */
+void sequencer_init(SEQUENCER* sequencer, const MUSIC_SONG* song, int sample_rate, float gain)
+{
+    memset(sequencer, 0, sizeof(SEQUENCER));
+    sequencer->song = song;
+    sequencer->sample_rate = sample_rate;
+    sequencer->speed_permille = 1000;
+    // first step advances to start of song
+    sequencer->step = MUSIC_STEPS - 1;
+    sequencer->pattern = MUSIC_PATTERNS - 1;
+    for (int t = 0; t < MUSIC_TRACKS; t++) {
+        const MUSIC_TRACK* track = &song->tracks[t];
+        sequencer->gains[t][0] = gain * track->gain * (track->pan > 0.0f ? 1.0f - track->pan : 1.0f);
+        sequencer->gains[t][1] = gain * track->gain * (track->pan < 0.0f ? 1.0f + track->pan : 1.0f);
+    }
+    for (int n = 0; n <= MUSIC_NOTE_RANGE * 2; n++) {
+        sequencer->transpose[n] = powf(2.0f, (n - MUSIC_NOTE_RANGE) / 12.0f);
+    }
+}
+
+/**
+  Sets tempo relative to song one, from 1 up to MUSIC_MAX_SPEED. Takes effect on next step.
+ */
+void sequencer_set_speed(SEQUENCER* sequencer, float speed)
+{
+    speed = speed < 1.0f ? 1.0f : (speed > MUSIC_MAX_SPEED ? MUSIC_MAX_SPEED : speed);
+    atomic_store_release(&sequencer->speed_permille, (int)(speed * 1000.0f));
+}
+
+static void next_step(SEQUENCER* sequencer)
+{
+    const MUSIC_SONG* song = sequencer->song;
+    int speed_permille = atomic_load_acquire(&sequencer->speed_permille);
+
+    if (++sequencer->step == MUSIC_STEPS) {
+        sequencer->step = 0;
+        sequencer->pattern = (sequencer->pattern + 1) % MUSIC_PATTERNS;
+    }
+    // steps are sixteenth notes, a quarter of a beat
+    sequencer->step_samples = (int)(sequencer->sample_rate * 60.0f * 1000.0f / (song->tempo * speed_permille * 4.0f));
+    if (sequencer->step_samples < 1) {
+        sequencer->step_samples = 1;
+    }
+    for (int t = 0; t < MUSIC_TRACKS; t++) {
+        int note = song->tracks[t].notes[sequencer->pattern][sequencer->step];
+        if (note == MUSIC_REST || !song->tracks[t].instrument) {
+            continue;
+        }
+        note = note < -MUSIC_NOTE_RANGE ? -MUSIC_NOTE_RANGE : (note > MUSIC_NOTE_RANGE ? MUSIC_NOTE_RANGE : note);
+        synth_voice_start(&sequencer->voices[t], song->tracks[t].instrument, sequencer->sample_rate);
+        synth_voice_transpose(&sequencer->voices[t], sequencer->transpose[note + MUSIC_NOTE_RANGE]);
+        sequencer->playing[t] = 1;
+    }
+}
+
+/**
+  Adds next frames interleaved stereo frames of music to stereo. Called from audio thread.
+ */
+void sequencer_render(SEQUENCER* sequencer, float* stereo, int frames)
+{
+    sample_t block[SYNTH_BLOCK];
+    int done = 0;
+
+    while (done < frames) {
+        int count = frames - done < SYNTH_BLOCK ? frames - done : SYNTH_BLOCK;
+        if (sequencer->step_samples == 0) {
+            next_step(sequencer);
+        }
+        if (count > sequencer->step_samples) {
+            count = sequencer->step_samples;
+        }
+        for (int t = 0; t < MUSIC_TRACKS; t++) {
+            float* out = stereo + done * 2;
+            int rendered;
+            if (!sequencer->playing[t]) {
+                continue;
+            }
+            rendered = synth_voice_render(&sequencer->voices[t], block, count);
+            for (int i = 0; i < rendered; i++) {
+                out[i * 2] += block[i] * sequencer->gains[t][0];
+                out[i * 2 + 1] += block[i] * sequencer->gains[t][1];
+            }
+            if (rendered < count) {
+                sequencer->playing[t] = 0;
+            }
+        }
+        sequencer->step_samples -= count;
+        done += count;
+    }
+}
@@ -0,0 +1,73 @@
+/**
+  @file music.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Step sequencer playing background music with synth patches, rendered as it plays.
+ */
+
+#ifndef _MUSIC_H_
+#define _MUSIC_H_
+
+#include "synth.h"
+
+// instruments of a song, each one plays a note at a time
+#define MUSIC_TRACKS 3
+
+// steps of a pattern, sixteenth notes of a 4/4 bar
+#define MUSIC_STEPS 16
+
+// patterns of a song, played in loop
+#define MUSIC_PATTERNS 4
+
+// step without note
+#define MUSIC_REST -128
+
+// notes are semitones from instrument pitch, up to two octaves
+#define MUSIC_NOTE_RANGE 24
+
+// max share of one core music may take
+#define MUSIC_CPU_BUDGET 0.01
+
+// max tempo, relative to song tempo
+#define MUSIC_MAX_SPEED 2.0f
+
+typedef struct {
+    const SYNTH* instrument;
+    float gain;
+    /** from -1 (left) to 1 (right) */
+    float pan;
+    /** semitones from instrument pitch of each step, or MUSIC_REST */
+    signed char notes[MUSIC_PATTERNS][MUSIC_STEPS];
+} MUSIC_TRACK;
+
+typedef struct {
+    /** beats per minute at speed 1 */
+    float tempo;
+    MUSIC_TRACK tracks[MUSIC_TRACKS];
+} MUSIC_SONG;
+
+/**
+  @brief Plays a song in loop. Game thread only sets speed; audio thread renders it with a voice
+  per track, so memory use doesn't depend on song length.
+ */
+typedef struct {
+    const MUSIC_SONG* song;
+    int sample_rate;
+    /** tempo relative to song one in thousandths, written by game thread */
+    volatile int speed_permille;
+    /** samples left of current step */
+    int step_samples;
+    int step;
+    int pattern;
+    SYNTH_VOICE voices[MUSIC_TRACKS];
+    int playing[MUSIC_TRACKS];
+    float gains[MUSIC_TRACKS][2];
+    /** frequency ratio of each note */
+    float transpose[MUSIC_NOTE_RANGE * 2 + 1];
+} SEQUENCER;
+
+void sequencer_init(SEQUENCER* sequencer, const MUSIC_SONG* song, int sample_rate, float gain);
+void sequencer_set_speed(SEQUENCER* sequencer, float speed);
+void sequencer_render(SEQUENCER* sequencer, float* stereo, int frames);
+
+#endif
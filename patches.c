@@ -0,0 +1,59 @@
+/**
+  @file patches.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Synth patches of game sounds and background music.
+ */
+
+#include "patches.h"
+
+const SYNTH sound_patches[PATCHES_COUNT] = {
+    // total, volume, attack, decay, release, decay value, filter betas, oscillators, frequencies, delay, reverb
+    { 0.1f, 1.0f, 0.0f, 0.05f, 0.05f, 0.3f, 0.2f, 0.3f, TRIANGLE, NONE, 700.0f, 0.0f, 0.5f, 0.1f },
+    { 0.1f, 1.0f, 0.0f, 0.05f, 0.05f, 0.3f, 0.2f, 0.3f, TRIANGLE, NONE, 350.0f, 350.0f, 0.5f, 0.1f },
+    { 0.1f, 1.0f, 0.0f, 0.05f, 0.05f, 0.3f, 0.2f, 0.3f, TRIANGLE, NONE, 500.0f, 500.0f, 0.5f, 0.1f },
+    { 0.05f, 0.7f, 0.01f, 0.03f, 0.01f, 0.7f, 0.6f, 0.4f, SIN, SIN, 200.0f, 400.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 0.2f, 0.8f, 0.4f, 0.1f, 0.4f, 0.4f, SIN, COS, 1046.50f, 2.0f, 0.0f, 0.0f },
+    { 0.6f, 1.0f, 0.01f, 0.3f, 0.3f, 0.1f, 0.4f, 0.4f, SIN, COS, 323.5f, 30.0f, 0.0f, 0.0f },
+    { 0.12f, 0.9f, 0.0f, 0.04f, 0.08f, 0.5f, 0.5f, 0.5f, TRIANGLE, NONE, 110.0f, 0.0f, 0.0f, 0.0f },
+    { 0.1f, 0.6f, 0.0f, 0.03f, 0.07f, 0.4f, 0.6f, 0.4f, SIN, COS, 440.0f, 3.0f, 0.0f, 0.0f },
+    { 0.03f, 0.5f, 0.0f, 0.01f, 0.02f, 0.2f, 0.3f, 0.7f, SIN, SIN, 3520.0f, 1870.0f, 0.0f, 0.0f }
+};
+
+const char* sound_patch_names[PATCHES_COUNT] = {
+    "player pong",
+    "opponent pong",
+    "start",
+    "wall hit",
+    "player wins",
+    "opponent wins",
+    "music bass",
+    "music lead",
+    "music tick"
+};
+
+const PATCH_ID clip_patches[CLIP_PATCHES_COUNT] = { START_PATCH, PLAYER_WINS_PATCH, OPPONENT_WINS_PATCH };
+
+#define R MUSIC_REST
+
+// A minor, F, C and G chords, a bar each
+const MUSIC_SONG background_song = {
+    112.0f,
+    { { &sound_patches[MUSIC_BASS_PATCH], 0.6f, 0.0f,
+          { { 0, R, R, R, 0, R, 12, R, 0, R, R, R, 0, R, 12, R },
+              { -4, R, R, R, -4, R, 8, R, -4, R, R, R, -4, R, 8, R },
+              { 3, R, R, R, 3, R, 15, R, 3, R, R, R, 3, R, 15, R },
+              { -2, R, R, R, -2, R, 10, R, -2, R, R, R, -2, R, 10, R } } },
+        { &sound_patches[MUSIC_LEAD_PATCH], 0.3f, -0.4f,
+            { { 0, R, 3, R, 7, R, 12, R, 7, R, 3, R, 0, R, 3, R },
+                { -4, R, 0, R, 3, R, 8, R, 3, R, 0, R, -4, R, 0, R },
+                { 3, R, 7, R, 10, R, 15, R, 10, R, 7, R, 3, R, 7, R },
+                { -2, R, 2, R, 5, R, 10, R, 5, R, 2, R, -2, R, 2, R } } },
+        { &sound_patches[MUSIC_TICK_PATCH], 0.2f, 0.4f,
+            { { R, R, 0, R, R, R, 0, R, R, R, 0, R, R, R, 0, 0 },
+                { R, R, 0, R, R, R, 0, R, R, R, 0, R, R, R, 0, 0 },
+                { R, R, 0, R, R, R, 0, R, R, R, 0, R, R, R, 0, 0 },
+                { R, R, 0, R, R, R, 0, R, R, R, 0, 0, 0, R, 0, 0 } } } }
+};
+
+#undef R
@@ -0,0 +1,35 @@
+/**
+  @file patches.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Synth patches of game sounds and background music.
+ */
+
+#ifndef _PATCHES_H_
+#define _PATCHES_H_
+
+#include "music.h"
+#include "synth.h"
+
+typedef enum {
+    PLAYER_PONG_PATCH,
+    OPPONENT_PONG_PATCH,
+    START_PATCH,
+    WALL_HIT_PATCH,
+    PLAYER_WINS_PATCH,
+    OPPONENT_WINS_PATCH,
+    MUSIC_BASS_PATCH,
+    MUSIC_LEAD_PATCH,
+    MUSIC_TICK_PATCH,
+    PATCHES_COUNT
+} PATCH_ID;
+
+// patches rendered once and stored as clips; the rest are synthetized as they play
+#define CLIP_PATCHES_COUNT 3
+
+extern const SYNTH sound_patches[PATCHES_COUNT];
+extern const char* sound_patch_names[PATCHES_COUNT];
+extern const PATCH_ID clip_patches[CLIP_PATCHES_COUNT];
+extern const MUSIC_SONG background_song;
+
+#endif
@@ -6,27 +6,276 @@
  */
 
 #include "pong3d.h"
+#include "ai.h"
 #include "geometry.h"
+#include "input.h"
+#include "replay.h"
+#include "tasks.h"
+#include <math.h>
+#include <string.h>
 
-GAME_STATE gameState, prevGameState;
+/**
+  Initializes a new game against a computer of normal level. Given a seed and the input events
+  of each tick, game is deterministic.
+ */
+void init_game(GameContext* ctx, uint32_t seed)
+{
+    float aspect = (float)WINDOW_WIDTH / WINDOW_HEIGHT;
+
+    memset(ctx, 0, sizeof(GameContext));
+    timer_wheel_init(&ctx->timers);
+    setup_body(&ctx->stage, STAGE_WIDTH, STAGE_WIDTH / aspect, STAGE_LARGE);
+    setup_body(&ctx->ball, BALL_RADIUS, BALL_RADIUS, BALL_RADIUS);
+    setup_body(&ctx->player_stick, STICK_WIDTH, STICK_WIDTH / aspect, 0.0f);
+    setup_body(&ctx->opponent_stick, STICK_WIDTH, STICK_WIDTH / aspect, 0.0f);
+    ctx->balls = BALLS;
+    ctx->fps_inc = REFERENCE_FPS;
+    ai_set_level(ctx, AI_NORMAL);
+    reset_player_stick_position(ctx);
+    reset_opponent_stick_position(ctx);
+    reset_ball_position(ctx);
+    store_previous_positions(ctx);
+    ctx->randomState = seed ? seed : 1;
+    change_state(ctx, STARTING);
+}
+
+/**
+  Advances game one tick, consuming first events of its input queue. Timers due in the tick run
+  first; state tasks only run every tick while ball is in play or being served.
+ */
+void game_tick(GameContext* ctx, int events)
+{
+    GAME_STATE state;
+
+    if (ctx->recorder && replay_is_recording(ctx->recorder)) {
+        replay_record_tick(ctx->recorder, ctx, events);
+    }
+    process_events_task(ctx, events);
+    store_previous_positions(ctx);
+    state = ctx->gameState;
+    timer_wheel_run(&ctx->timers, ctx);
+    // a state entered by a timer starts in next tick
+    if (ctx->gameState == state) {
+        process_state(ctx, events);
+    }
+    input_consume_events(&ctx->input, events);
+    ctx->totalTicks++;
+}
+
+/**
+  Ticks since game was initialized.
+ */
+uint32_t game_tick_count(const GameContext* ctx)
+{
+    return ctx->totalTicks;
+}
+
+/**
+  Random numbers for game logic (xorshift32), so a game can be reproduced from its seed.
+ */
+uint32_t game_random(GameContext* ctx)
+{
+    ctx->randomState ^= ctx->randomState << 13;
+    ctx->randomState ^= ctx->randomState >> 17;
+    ctx->randomState ^= ctx->randomState << 5;
+    return ctx->randomState;
+}
+
+void process_state(GameContext* ctx, int events)
+{
+    switch (ctx->gameState) {
+    case PLAYER_SERVICE:
+        serving_task(ctx, events);
+        break;
+    case PLAYER_RETURN:
+    case OPP_RETURN:
+        playing_task(ctx);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+  Runs the task of a state when it is entered.
+ */
+static void enter_state(GameContext* ctx)
+{
+    switch (ctx->gameState) {
+
+    case STARTING:
+        start_screen_task();
+        break;
+    case LOADING_PLAYERS:
+        loading_players_task(ctx);
+        break;
+    case PLAYER_SERVICE:
+        player_service_task(ctx);
+        break;
+    case PLAYER_RETURN:
+        player_return_task(ctx);
+        break;
+    case OPP_RETURN:
+        opponent_return_task(ctx);
+        break;
+    case PLAYER_WINS:
+        player_wins_task(ctx);
+        break;
+    case OPP_WINS:
+        opponent_wins_task(ctx);
+        break;
+    case OPP_SERVICE:
+        opponent_service_task(ctx);
+        break;
+    case FINISHED:
+        finished_task(ctx);
+        break;
+    case EXIT:
+        break;
+    case STARTED:
+        break;
+    }
+}
+
+int process_events_task(GameContext* ctx, int events)
+{
+    for (int i = 0; i < events; i++) {
+        const SysEvent* event = input_peek_event(&ctx->input, i);
+        switch (event->type) {
+        case CLOSE:
+            change_state(ctx, EXIT);
+            break;
+        case MOUSELBUTTONUP:
+            // serve is handled by player_service_task
+            if (ctx->gameState == STARTING || ctx->gameState == FINISHED) {
+                change_state(ctx, LOADING_PLAYERS);
+            }
+            break;
+        case MOUSEMOTION:
+            move_player_stick_to_mouse(ctx, event->x, event->y);
+            break;
+        }
+    }
+    return 0;
+}
+
+void emit_game_event(GameContext* ctx, GAME_EVENT_TYPE type)
+{
+    emit_game_event_at(ctx, type, 0.0f);
+}
+
+static float hit_offset(const BODY* ball, const BODY* stick)
+{
+    float dx = fabsf(ball->x - stick->x) / stick->width2;
+    float dy = fabsf(ball->y - stick->y) / stick->height2;
+    float offset = dx > dy ? dx : dy;
+    return offset < 1.0f ? offset : 1.0f;
+}
+
+/**
+  Queues a game event happened time seconds after start of current tick, with ball position and
+  speed at that moment.
+ */
+void emit_game_event_at(GameContext* ctx, GAME_EVENT_TYPE type, float time)
+{
+    GAME_EVENT* event;
+
+    if (ctx->events_queued >= GAME_EVENTS_MAX) {
+        return;
+    }
+    event = &ctx->events[ctx->events_queued++];
+    event->type = type;
+    event->time = time;
+    event->position = ctx->ball.x / ctx->stage.width2;
+    event->speed = fabsf(ctx->ball_speed_vector[2]) / (ctx->stage.large * INITIAL_VELOCITY_FACTOR);
+    event->offset = 0.0f;
+    if (type == PLAYER_PONG_SOUND) {
+        event->offset = hit_offset(&ctx->ball, &ctx->player_stick);
+    } else if (type == OPPONENT_PONG_SOUND) {
+        event->offset = hit_offset(&ctx->ball, &ctx->opponent_stick);
+    }
+}
+
+int game_events_count(const GameContext* ctx)
+{
+    return ctx->events_queued;
+}
+
+const GAME_EVENT* game_event(const GameContext* ctx, int index)
+{
+    return &ctx->events[index];
+}
+
+void clear_game_events(GameContext* ctx)
+{
+    ctx->events_queued = 0;
+}
+
+/**
+  Enters a new state, cancelling timers of the previous one.
+ */
+void change_state(GameContext* ctx, GAME_STATE state)
+{
+    timer_cancel(&ctx->state_timer);
+    timer_cancel(&ctx->ai_timer);
+    ctx->prevGameState = ctx->gameState;
+    ctx->gameState = state;
+    enter_state(ctx);
+}
+
+void reset_player_stick_position(GameContext* ctx)
+{
+    move_body(&ctx->player_stick, 0.0f, 0.0f, 0.0f);
+}
+
+void reset_opponent_stick_position(GameContext* ctx)
+{
+    move_body(&ctx->opponent_stick, 0.0f, 0.0f, -ctx->stage.large);
+}
+
+void reset_ball_position(GameContext* ctx)
+{
+    move_body(&ctx->ball, 0.0f, 0.0f, ctx->player_stick.z - ctx->ball.width);
+}
+
+void move_player_stick(GameContext* ctx, float x, float y)
+{
+    ctx->player_stick.x = x;
+    ctx->player_stick.y = y;
+}
+
+void move_opponent_stick(GameContext* ctx, float x, float y)
+{
+    ctx->opponent_stick.x = x;
+    ctx->opponent_stick.y = y;
+}
+
+void move_ball(GameContext* ctx, float x, float y, float z)
+{
+    move_body(&ctx->ball, x, y, z);
+}
 
-void change_state(GAME_STATE state)
+void store_previous_positions(GameContext* ctx)
 {
-    prevGameState = gameState;
-    gameState = state;
+    ctx->ball_prev_position[0] = ctx->ball.x;
+    ctx->ball_prev_position[1] = ctx->ball.y;
+    ctx->ball_prev_position[2] = ctx->ball.z;
+    ctx->opponent_stick_prev_position[0] = ctx->opponent_stick.x;
+    ctx->opponent_stick_prev_position[1] = ctx->opponent_stick.y;
+    ctx->opponent_stick_prev_position[2] = ctx->opponent_stick.z;
 }
 
-int ball_in_player_stick()
+int ball_in_player_stick(const GameContext* ctx)
 {
-    return ball_in_stick(ball.x, ball.y, ball.width, &player_stick);
+    return ball_in_stick(ctx->ball.x, ctx->ball.y, ctx->ball.width, &ctx->player_stick);
 }
 
-int ball_in_opponent_stick()
+int ball_in_opponent_stick(const GameContext* ctx)
 {
-    return ball_in_stick(ball.x, ball.y, ball.width, &opponent_stick);
+    return ball_in_stick(ctx->ball.x, ctx->ball.y, ctx->ball.width, &ctx->opponent_stick);
 }
 
-int ball_in_stick(float ball_x, float ball_y, float ball_width, PONG_ELEMENT* stick)
+int ball_in_stick(float ball_x, float ball_y, float ball_width, const BODY* stick)
 {
     return ((ball_x - ball_width) < (stick->x + stick->width2) && (ball_x + ball_width) > (stick->x - stick->width2) && (ball_y - ball_width) < (stick->y + stick->height2) && (ball_y + ball_width) > (stick->y - stick->height2));
 }
@@ -9,7 +9,10 @@
 #define _CONFIG_H_
 
 #include "geometry.h"
+#include "input.h"
+#include "timer.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #define WINDOW_TITLE "Pong 3D"
 
@@ -30,6 +33,12 @@
 // sample frecuency rate for sound synthetizer
 #define SAMPLE_RATE 44100
 
+// samples of audio device buffer by default. Smaller buffers lower latency but may underrun.
+#define AUDIO_BUFFER_FRAMES 512
+
+// reverb of game sounds by default, as reverb time in seconds of a generated room
+#define REVERB_DEFAULT "0.6"
+
 // alpha value for overlay
 #define OVERLAY_ALPHA 0.8f
 
@@ -41,8 +50,25 @@
 
 #define STAGE_COLOR { 0.0f, 1.0f, 0.0f, 0.2f }
 
+// max frames rendered per second. Gameplay speed doesn't depend on it.
 #define FPS 60
 
+// simulation ticks per second. Game logic runs at this fixed rate whatever the render rate is.
+#define TICK_RATE 120
+
+#define TICK_TIME (1.0f / TICK_RATE)
+
+#define SECONDS_TO_TICKS(seconds) ((int)((seconds) * TICK_RATE + 0.5f))
+
+// max ticks simulated before rendering a frame, so a long stall doesn't freeze the game catching up.
+#define MAX_TICKS_PER_FRAME 8
+
+/**
+  Gameplay was tuned for 60 frames per second. Velocities are stored per second and
+  rally speed (fps_inc) is counted in frames of this reference rate.
+ */
+#define REFERENCE_FPS 60
+
 #define BALLS 12
 /**
   each time that player return a ball, ball speed is increased reducing number of frames where ball movement is updated.
@@ -67,16 +93,135 @@ typedef enum {
     EXIT
 } GAME_STATE;
 
-extern int balls;
-extern int player_score;
-extern int opponent_score;
-extern GAME_STATE gameState, prevGameState;
+/**
+  Effects of game logic on the platform (sounds, mouse cursor). Tasks queue them and the front end
+  applies them after each tick, so game logic runs without window or audio device.
+ */
+typedef enum {
+    START_SOUND,
+    PLAYER_PONG_SOUND,
+    OPPONENT_PONG_SOUND,
+    WALL_HIT_SOUND,
+    PLAYER_WINS_SOUND,
+    OPPONENT_WINS_SOUND,
+    SHOW_CURSOR,
+    HIDE_CURSOR,
+    CENTER_MOUSE
+} GAME_EVENT_TYPE;
+
+typedef struct {
+    GAME_EVENT_TYPE type;
+    /** seconds since start of tick when it happened, for contacts found within a tick */
+    float time;
+    /** ball x relative to half stage width, from -1 (left) to 1 (right) */
+    float position;
+    /** ball speed along stage relative to serve speed */
+    float speed;
+    /** distance of ball from center of the stick it hits, from 0 to 1 (edge); 0 if not a stick hit */
+    float offset;
+} GAME_EVENT;
+
+// max game events queued in a tick
+#define GAME_EVENTS_MAX 32
+
+// max contacts of ball with walls and sticks resolved in a tick
+#define MAX_CONTACTS_PER_TICK 8
+
+struct REPLAY;
+struct BALL_SET;
 
-int ball_in_player_stick();
-int ball_in_opponent_stick();
-int ball_in_stick(float ball_x, float ball_y, float ball_width, PONG_ELEMENT* stick);
-int ball_hit_wall(float* outVector, PONG_ELEMENT* stage, PONG_ELEMENT* ball);
+/**
+  @brief Skill of computer player.
+ */
+typedef struct {
+    /** seconds computer waits after player returns the ball before moving */
+    float reaction_time;
+    /** max speed of computer stick, in stage units per second */
+    float max_speed;
+    /** max distance from predicted ball position computer aims to, relative to half stick size */
+    float aim_error;
+} AI_DIFFICULTY;
 
-void change_state(GAME_STATE state);
+/**
+  @brief State of a match. Game logic only reads and writes the context it is given, so many
+  matches can run at once, each one from a single thread.
+ */
+typedef struct {
+    BODY stage;
+    BODY ball;
+    BODY player_stick;
+    BODY opponent_stick;
+    /** positions of moving bodies in the previous tick, used for interpolating between ticks. */
+    float ball_prev_position[3];
+    float opponent_stick_prev_position[3];
+    /** player stick position where it last returned the ball and ticks left until ball is deflected by stick displacement since then. */
+    float player_stick_hit_position[2];
+    int desviation_ticks;
+
+    /** ball velocity in stage units per second. */
+    float ball_speed_vector[3];
+    /** rally speed, in frames of reference rate taken by ball to cross the stage. */
+    int fps_inc;
+    /** computer stick displacement per tick and ticks to reach center of stage. */
+    float to_position[2];
+    int ticksToPosition;
+    /** computer player skill, where it goes and whether its reaction time is over. */
+    AI_DIFFICULTY ai;
+    float ai_target[2];
+    bool ai_moving;
+    bool ai_replan;
+
+    float overlay_fadeout;
+    int overlay_fadeout_steps;
+    float overlay_fadeout_alpha;
+    int balls;
+    int player_score;
+    int opponent_score;
+
+    GAME_STATE gameState;
+    GAME_STATE prevGameState;
+    uint32_t totalTicks;
+    uint32_t randomState;
+    /** timers of match, in ticks. They point into the context, so it can't be copied once initialized. */
+    TIMER_WHEEL timers;
+    /** timer of current state (fade steps, end of point), cancelled when state changes. */
+    TIMER state_timer;
+    TIMER ai_timer;
+
+    INPUT_QUEUE input;
+    GAME_EVENT events[GAME_EVENTS_MAX];
+    int events_queued;
+    /** replay recording ticks of this match, if any. */
+    struct REPLAY* recorder;
+    /** extra balls of multi-ball mode, if any. */
+    struct BALL_SET* multiball;
+} GameContext;
+
+void init_game(GameContext* ctx, uint32_t seed);
+void game_tick(GameContext* ctx, int events);
+uint32_t game_tick_count(const GameContext* ctx);
+uint32_t game_random(GameContext* ctx);
+void process_state(GameContext* ctx, int events);
+int process_events_task(GameContext* ctx, int events);
+
+void emit_game_event(GameContext* ctx, GAME_EVENT_TYPE type);
+void emit_game_event_at(GameContext* ctx, GAME_EVENT_TYPE type, float time);
+int game_events_count(const GameContext* ctx);
+const GAME_EVENT* game_event(const GameContext* ctx, int index);
+void clear_game_events(GameContext* ctx);
+
+void reset_player_stick_position(GameContext* ctx);
+void reset_opponent_stick_position(GameContext* ctx);
+void reset_ball_position(GameContext* ctx);
+void move_player_stick(GameContext* ctx, float x, float y);
+void move_opponent_stick(GameContext* ctx, float x, float y);
+void move_ball(GameContext* ctx, float x, float y, float z);
+void store_previous_positions(GameContext* ctx);
+
+int ball_in_player_stick(const GameContext* ctx);
+int ball_in_opponent_stick(const GameContext* ctx);
+int ball_in_stick(float ball_x, float ball_y, float ball_width, const BODY* stick);
+
+void change_state(GameContext* ctx, GAME_STATE state);
 
 #endif
@@ -11,9 +11,20 @@
 #include <GL/glew.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define ERRORMSG_MAX_LENGTH 128
 
+// first of the four attribute locations of per instance model matrix
+#define INSTANCE_MODEL_LOCATION 8
+
+// depth shadows are sorted behind bodies casting them, more than a step of sort keys
+#define SHADOW_DEPTH_BIAS 0.01f
+
+// model matrices the instance buffer holds. When it's full, it's orphaned and filled again.
+#define RENDERER_MAX_INSTANCES 256
+
 GLuint vertex_shader;
 GLuint fragment_shader;
 
@@ -23,14 +34,59 @@ GLuint projectionMatrixId;
 GLuint viewMatrixId;
 GLuint modelMatrixId;
 
-GLuint alphaUniform;
-GLuint renderStickUniform;
-GLuint stageWireframeUniform;
-GLuint applyOffsetUniform;
 GLuint offsetProjectionMatrixUniform;
 
+// uniforms whose last values are cached
+typedef enum {
+    UNIFORM_ALPHA,
+    UNIFORM_RENDER_STICK,
+    UNIFORM_STAGE_WIREFRAME,
+    UNIFORM_RENDER_TEXT,
+    UNIFORM_APPLY_OFFSET,
+    UNIFORM_INSTANCED,
+    UNIFORMS_COUNT
+} RENDERER_UNIFORM;
+
+static const char* uniform_names[UNIFORMS_COUNT] = { "alpha", "renderStick", "stageWireframe", "renderText", "applyOffset", "instanced" };
+
+/**
+  GL state last set through the renderer, so calls that wouldn't change it are skipped. A state
+  is unknown until it's set the first time.
+ */
+static struct {
+    GLuint program;
+    GLuint vao;
+    GLenum texture_unit;
+    GLuint texture;
+    GLint uniform_locations[UNIFORMS_COUNT];
+    float uniforms[UNIFORMS_COUNT];
+    int uniforms_known[UNIFORMS_COUNT];
+    float model_matrix[16];
+    int model_matrix_known;
+    unsigned issued;
+    unsigned skipped;
+    RENDERER_STATE_STATS stats;
+} state = { 0, 0, 0, 0 };
+
+// draws of current frame
+static DRAW_QUEUE draw_queue;
+
+// per instance model matrices of instanced draws, streamed every frame
+static GLuint instance_vbo;
+static int instances_used;
+static int instancing_supported = 0;
+
 float offset_projection_matrix[16];
 
+// shader locations of vertex attributes, indexed by VERTEX_ATTRIBUTE
+static const GLuint attribute_locations[VERTEX_ATTRIBUTES] = { 0, 1, 3 };
+
+// GL types indexed by VERTEX_ENCODING
+static const GLenum gl_encodings[] = { GL_FLOAT, GL_FLOAT, GL_HALF_FLOAT, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT };
+
+// GL primitives indexed by PRIMITIVE_TYPE
+static const GLenum gl_primitives[] = { GL_TRIANGLES, GL_TRIANGLE_FAN };
+
 GLchar errormsg[ERRORMSG_MAX_LENGTH];
 
 int program_created = 0;
@@ -42,28 +98,25 @@ const GLchar* vertex_shader_source = "#version 130\n \
 #extension GL_ARB_explicit_attrib_location : require\n \
 		layout(location = 0) in vec4 in_position;\n \
 		layout(location = 1) in vec4 in_color;\n \
-		layout(location = 2) in vec4 in_normal;\n \
 		layout(location = 3) in vec2 in_uv;\n \
-		layout(location = 4) in vec4 extra;\n \
+		layout(location = 8) in mat4 in_instance_model;\n \
 		uniform mat4 projectionMatrix;\n \
 		uniform mat4 viewMatrix;\n \
 		uniform mat4 modelMatrix;\n \
 		uniform mat4 offsetProjectionMatrix;\n \
 		uniform bool applyOffset;\n \
+		uniform bool instanced;\n \
 		layout(location = 5) out vec4 outColor;\n \
 		layout(location = 6) out vec2 outUV;\n \
-		out vec4 outNormal;\n \
-		out vec4 outExtra;\n \
 		void main(void) {\n \
+			mat4 model = instanced ? in_instance_model : modelMatrix;\n \
 			if (applyOffset) {\n \
-				gl_Position = offsetProjectionMatrix * viewMatrix * modelMatrix * in_position;\n \
+				gl_Position = offsetProjectionMatrix * viewMatrix * model * in_position;\n \
 			} else {\n \
-				gl_Position = projectionMatrix * viewMatrix * modelMatrix * in_position;\n \
+				gl_Position = projectionMatrix * viewMatrix * model * in_position;\n \
 			}\n \
 			outColor = in_color;\n \
 				outUV = in_uv;\n \
-				outNormal = in_normal;\n \
-				outExtra = extra;\n \
 		}";
 
 /**
@@ -97,7 +150,10 @@ const GLchar* fragment_shader_source = "#version 130\n \
 				}\n \
 			}\n \
 			else if (stageWireframe) {\n \
-				color = outColor + vec4(0.0, 0.0, 0.0, 0.2);\n \
+				vec2 edges = min(fract(outUV), 1.0 - fract(outUV)) / fwidth(outUV);\n \
+				float line = 1.0 - clamp(min(edges.x, edges.y), 0.0, 1.0);\n \
+				float fill = outColor.w * exp2(-floor(outUV.y));\n \
+				color = vec4(outColor.xyz, mix(fill, 1.0 - (0.8 - fill) * (1.0 - fill), line));\n \
 			}\n \
 			else if (renderText) {\n \
 				color = vec4(1.0, 1.0, 1.0, texture2D(tex, outUV).a);\n \
@@ -109,38 +165,156 @@ const GLchar* fragment_shader_source = "#version 130\n \
 float projection_matrix[16];
 float view_matrix[16];
 
+static void count_state_call(int issued)
+{
+    if (issued) {
+        state.issued++;
+    } else {
+        state.skipped++;
+    }
+}
+
+static void use_program(GLuint id)
+{
+    count_state_call(state.program != id);
+    if (state.program != id) {
+        glUseProgram(id);
+        state.program = id;
+    }
+}
+
+// bool uniforms are set as 0 or 1 values
+static void set_uniform(RENDERER_UNIFORM uniform, float value)
+{
+    int issued = !state.uniforms_known[uniform] || state.uniforms[uniform] != value;
+
+    count_state_call(issued);
+    if (issued) {
+        if (uniform == UNIFORM_ALPHA) {
+            glUniform1f(state.uniform_locations[uniform], value);
+        } else {
+            glUniform1i(state.uniform_locations[uniform], (GLint)value);
+        }
+        state.uniforms[uniform] = value;
+        state.uniforms_known[uniform] = 1;
+    }
+}
+
+void renderer_bind_vao(GLuint vao)
+{
+    count_state_call(state.vao != vao);
+    if (state.vao != vao) {
+        glBindVertexArray(vao);
+        state.vao = vao;
+    }
+}
+
+/**
+  Binds a 2D texture to unit, making it the active texture unit.
+ */
+void renderer_bind_texture(GLenum unit, GLuint texture)
+{
+    count_state_call(state.texture_unit != unit);
+    if (state.texture_unit != unit) {
+        glActiveTexture(unit);
+        state.texture_unit = unit;
+        state.texture = 0;
+    }
+    count_state_call(state.texture != texture);
+    if (state.texture != texture) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        state.texture = texture;
+    }
+}
+
+void renderer_set_model_matrix(const float* matrix)
+{
+    int issued = !state.model_matrix_known || memcmp(state.model_matrix, matrix, sizeof(state.model_matrix));
+
+    count_state_call(issued);
+    if (issued) {
+        glUniformMatrix4fv(modelMatrixId, 1, GL_FALSE, matrix);
+        memcpy(state.model_matrix, matrix, sizeof(state.model_matrix));
+        state.model_matrix_known = 1;
+    }
+}
+
+// sets every uniform of a shader variant, so a draw doesn't depend on what the previous one left set
+static void set_variant(RENDER_MATERIAL material, int instanced)
+{
+    set_uniform(UNIFORM_RENDER_STICK, material == MATERIAL_STICK);
+    set_uniform(UNIFORM_STAGE_WIREFRAME, material == MATERIAL_WIREFRAME);
+    set_uniform(UNIFORM_RENDER_TEXT, material == MATERIAL_TEXT);
+    set_uniform(UNIFORM_INSTANCED, (float)instanced);
+}
+
+/**
+  Selects how fragment shader colors next draws, placed by the model matrix.
+ */
+void renderer_set_material(RENDER_MATERIAL material)
+{
+    set_variant(material, 0);
+}
+
+/**
+  Closes counts of state calls of current frame. Must be called once per frame, before swapping buffers.
+ */
+void renderer_end_frame()
+{
+    state.stats.frames++;
+    state.stats.total_issued += state.issued;
+    state.stats.total_skipped += state.skipped;
+    state.stats.frame_issued = state.issued;
+    state.stats.frame_skipped = state.skipped;
+    state.issued = state.skipped = 0;
+}
+
+void renderer_state_stats(RENDERER_STATE_STATS* stats)
+{
+    *stats = state.stats;
+}
+
 void renderer_clear_screen()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+/**
+  Uploads vertices of element packed to its layout, with a VAO reading each attribute it stores.
+ */
 void upload_to_renderer(PONG_ELEMENT* element)
 {
+    const VERTEX_LAYOUT* layout = &element->layout;
+    unsigned char* packed = (unsigned char*)malloc((size_t)element->vertex_count * layout->stride);
 
     element->uploaded = 0;
+    if (!packed) {
+        log_error("Couldn't pack mesh vertices");
+        return;
+    }
+    pack_vertices(element, packed);
     glGenVertexArrays(1, &element->vao);
-    glBindVertexArray(element->vao);
+    renderer_bind_vao(element->vao);
 
     glGenBuffers(1, &element->vbo);
     glBindBuffer(GL_ARRAY_BUFFER, element->vbo);
-    glBufferData(GL_ARRAY_BUFFER, element->vertex_count * VERTEX_SIZE * sizeof(float), element->vertex, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_SIZE, 0);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_SIZE, (char*)NULL + sizeof(float) * 4);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_SIZE, (char*)NULL + sizeof(float) * 8);
-    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_SIZE, (char*)NULL + sizeof(float) * 12);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_SIZE, (char*)NULL + sizeof(float) * 14);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
+    glBufferData(GL_ARRAY_BUFFER, element->vertex_count * layout->stride, packed, GL_STATIC_DRAW);
+    free(packed);
+    for (int a = 0; a < VERTEX_ATTRIBUTES; a++) {
+        VERTEX_ENCODING encoding = layout->encodings[a];
+        if (encoding == ENCODING_NONE) {
+            continue;
+        }
+        glVertexAttribPointer(attribute_locations[a], vertex_components[a], gl_encodings[encoding],
+            encoding == ENCODING_UNORM8 || encoding == ENCODING_UNORM16, layout->stride, (char*)NULL + layout->offsets[a]);
+        glEnableVertexAttribArray(attribute_locations[a]);
+    }
 
     if (element->elements_count > 0) {
         glGenBuffers(1, &element->ebo);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element->ebo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, element->elements_count * sizeof(unsigned int), element->elements, GL_STATIC_DRAW);
     }
-    glBindVertexArray(0);
     element->uploaded = 1;
 }
 
@@ -150,7 +324,37 @@ void remove_to_renderer(PONG_ELEMENT* element)
     if (element->elements_count > 0) {
         glDeleteBuffers(1, &element->ebo);
     }
+    if (state.vao == element->vao) {
+        renderer_bind_vao(0);
+    }
     glDeleteVertexArrays(1, &element->vao);
+    element->uploaded = 0;
+}
+
+/**
+  Uploads meshes of all game objects. Must be called after create_elements.
+ */
+void upload_elements()
+{
+    PONG_ELEMENT* elements[] = { &stage, &overlay, &player_stick, &opponent_stick, &ball, &ball_shadow, &ball_mark, &stick_shadow };
+    int bytes = 0, float_bytes = 0;
+
+    for (int i = 0; i < (int)(sizeof(elements) / sizeof(elements[0])); i++) {
+        upload_to_renderer(elements[i]);
+        bytes += elements[i]->vertex_count * elements[i]->layout.stride;
+        float_bytes += elements[i]->vertex_count * VERTEX_SIZE * (int)sizeof(float);
+    }
+    log_info("Mesh vertices: %d bytes, %d bytes as floats", bytes, float_bytes);
+}
+
+void remove_elements()
+{
+    PONG_ELEMENT* elements[] = { &stage, &overlay, &player_stick, &opponent_stick, &ball, &ball_shadow, &ball_mark, &stick_shadow };
+    for (int i = 0; i < (int)(sizeof(elements) / sizeof(elements[0])); i++) {
+        if (elements[i]->uploaded) {
+            remove_to_renderer(elements[i]);
+        }
+    }
 }
 
 GLuint build_shader(GLenum type, const GLchar* source, GLint* result, GLchar* pErrormsg)
@@ -252,16 +456,16 @@ int init_renderer(int width, int height)
     view_matrix[14] = -0.866f / ((float)width / height);
     create_projection_matrix(60.0f, (float)width / height, 0.1f, 10.0f, projection_matrix);
 
-    glUseProgram(program);
+    use_program(program);
     projectionMatrixId = glGetUniformLocation(program, "projectionMatrix");
     viewMatrixId = glGetUniformLocation(program, "viewMatrix");
     modelMatrixId = glGetUniformLocation(program, "modelMatrix");
     glUniformMatrix4fv(projectionMatrixId, 1, GL_FALSE, projection_matrix);
     glUniformMatrix4fv(viewMatrixId, 1, GL_FALSE, view_matrix);
-    alphaUniform = glGetUniformLocation(program, "alpha");
-    renderStickUniform = glGetUniformLocation(program, "renderStick");
-    stageWireframeUniform = glGetUniformLocation(program, "stageWireframe");
-    glUniform1f(alphaUniform, 0.0f);
+    for (int i = 0; i < UNIFORMS_COUNT; i++) {
+        state.uniform_locations[i] = glGetUniformLocation(program, uniform_names[i]);
+        set_uniform(i, 0.0f);
+    }
 
     /** 
 	  create offset projection matrix for ball shadow and fix z-fighting
@@ -269,16 +473,28 @@ int init_renderer(int width, int height)
 
     create_projection_matrix(60.0f, (float)width / height, 0.1f, 12.0f, offset_projection_matrix);
 
-    applyOffsetUniform = glGetUniformLocation(program, "applyOffset");
     offsetProjectionMatrixUniform = glGetUniformLocation(program, "offsetProjectionMatrix");
     glUniformMatrix4fv(offsetProjectionMatrixUniform, 1, GL_FALSE, offset_projection_matrix);
-    glUniform1i(applyOffsetUniform, 0);
+
+    // instanced draws need instance attribute divisors, core since OpenGL 3.3
+    instancing_supported = GLEW_VERSION_3_3;
+    if (instancing_supported) {
+        glGenBuffers(1, &instance_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, RENDERER_MAX_INSTANCES * 16 * sizeof(float), NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    } else {
+        log_info("OpenGL 3.3 not available, instances are drawn one by one");
+    }
 
     return 0;
 }
 
 void dispose_renderer()
 {
+    if (instancing_supported) {
+        glDeleteBuffers(1, &instance_vbo);
+    }
     if (program_created) {
         glDeleteProgram(program_created);
     }
@@ -290,162 +506,255 @@ void dispose_renderer()
     }
 }
 
-void render_pong_element(PONG_ELEMENT* element)
+static void draw_element(PONG_ELEMENT* element)
 {
-    glBindVertexArray(element->vao);
-    glUniformMatrix4fv(modelMatrixId, 1, GL_FALSE, element->model_matrix);
+    renderer_bind_vao(element->vao);
+    renderer_set_model_matrix(element->model_matrix);
     if (element->elements_count > 0) {
-        glDrawElements(element->vertexType, element->elements_count, GL_UNSIGNED_INT, 0);
+        glDrawElements(gl_primitives[element->vertexType], element->elements_count, GL_UNSIGNED_INT, 0);
     } else {
-        glDrawArrays(element->vertexType, 0, element->vertex_count);
+        glDrawArrays(gl_primitives[element->vertexType], 0, element->vertex_count);
     }
-    glBindVertexArray(0);
 }
 
-void render_shadows()
+void render_pong_element(PONG_ELEMENT* element)
 {
-    glUniform1i(applyOffsetUniform, 1);
-
-    ball_shadow.model_matrix[0] = 0.0f;
-    ball_shadow.model_matrix[1] = 0.0f;
-    ball_shadow.model_matrix[2] = -1.0f;
-    ball_shadow.model_matrix[3] = 0.0f;
-    ball_shadow.model_matrix[4] = 0.0f;
-    ball_shadow.model_matrix[5] = 1.0f;
-    ball_shadow.model_matrix[6] = 0.0f;
-    ball_shadow.model_matrix[7] = 0.0f;
-    ball_shadow.model_matrix[8] = 1.0f;
-    ball_shadow.model_matrix[9] = 0.0f;
-    ball_shadow.model_matrix[10] = 0.0f;
-    ball_shadow.model_matrix[11] = 0.0f;
-    ball_shadow.model_matrix[12] = -stage.width2;
-    ball_shadow.model_matrix[13] = ball.model_matrix[13];
-    ball_shadow.model_matrix[14] = ball.model_matrix[14];
-    render_pong_element(&ball_shadow);
-
-    ball_shadow.model_matrix[12] = stage.width2;
-    ball_shadow.model_matrix[13] = ball.model_matrix[13];
-    ball_shadow.model_matrix[14] = ball.model_matrix[14];
-    render_pong_element(&ball_shadow);
-
-    ball_shadow.model_matrix[0] = 1.0f;
-    ball_shadow.model_matrix[1] = 0.0f;
-    ball_shadow.model_matrix[2] = 0.0f;
-    ball_shadow.model_matrix[3] = 0.0f;
+    renderer_set_material(MATERIAL_PLAIN);
+    draw_element(element);
+}
 
-    ball_shadow.model_matrix[4] = 0.0f;
-    ball_shadow.model_matrix[5] = 0.0f;
-    ball_shadow.model_matrix[6] = 1.0f;
-    ball_shadow.model_matrix[7] = 0.0f;
+/**
+  Draws count copies of element in one call, each placed by its model matrix in models (16 floats
+  each). Matrices are streamed to the instance buffer.
+ */
+void render_pong_element_instances(PONG_ELEMENT* element, const float* models, int count)
+{
+    GLenum primitive = gl_primitives[element->vertexType];
+
+    set_variant(MATERIAL_PLAIN, instancing_supported);
+    renderer_bind_vao(element->vao);
+    if (!instancing_supported) {
+        for (int i = 0; i < count; i++) {
+            renderer_set_model_matrix(models + i * 16);
+            if (element->elements_count > 0) {
+                glDrawElements(primitive, element->elements_count, GL_UNSIGNED_INT, 0);
+            } else {
+                glDrawArrays(primitive, 0, element->vertex_count);
+            }
+        }
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+    while (count > 0) {
+        int batch = count < RENDERER_MAX_INSTANCES ? count : RENDERER_MAX_INSTANCES;
+        if (instances_used + batch > RENDERER_MAX_INSTANCES) {
+            // GPU may still read old matrices; new storage avoids waiting for it
+            glBufferData(GL_ARRAY_BUFFER, RENDERER_MAX_INSTANCES * 16 * sizeof(float), NULL, GL_STREAM_DRAW);
+            instances_used = 0;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, instances_used * 16 * sizeof(float), batch * 16 * sizeof(float), models);
+        for (int c = 0; c < 4; c++) {
+            glVertexAttribPointer(INSTANCE_MODEL_LOCATION + c, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 16,
+                (char*)NULL + sizeof(float) * (instances_used * 16 + c * 4));
+            glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + c, 1);
+            glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + c);
+        }
+        if (element->elements_count > 0) {
+            glDrawElementsInstanced(primitive, element->elements_count, GL_UNSIGNED_INT, 0, batch);
+        } else {
+            glDrawArraysInstanced(primitive, 0, element->vertex_count, batch);
+        }
+        instances_used += batch;
+        models += batch * 16;
+        count -= batch;
+    }
+}
 
-    ball_shadow.model_matrix[8] = 1.0f;
-    ball_shadow.model_matrix[9] = -1.0f;
-    ball_shadow.model_matrix[10] = 0.0f;
-    ball_shadow.model_matrix[11] = 0.0f;
+static void set_shadow_axes(float* matrix, const float* axes)
+{
+    for (int c = 0; c < 3; c++) {
+        matrix[c * 4] = axes[c * 3];
+        matrix[c * 4 + 1] = axes[c * 3 + 1];
+        matrix[c * 4 + 2] = axes[c * 3 + 2];
+        matrix[c * 4 + 3] = 0.0f;
+    }
+}
 
-    ball_shadow.model_matrix[12] = ball.model_matrix[12];
-    ball_shadow.model_matrix[13] = -stage.height2;
-    ball_shadow.model_matrix[14] = ball.model_matrix[14];
-    render_pong_element(&ball_shadow);
+/**
+  Draws shadows of ball on the four stage sides as one instanced draw.
+ */
+static void draw_ball_shadows(const DRAW_ITEM* item)
+{
+    // axes of ball shadows on left and right sides, and on floor and ceiling
+    static const float ball_side_axes[] = { 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f };
+    static const float ball_floor_axes[] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, -1.0f, 0.0f };
+    float ball_shadows[4 * 16];
+
+    (void)item;
+    for (int i = 0; i < 4; i++) {
+        float* matrix = ball_shadows + i * 16;
+        float side = i % 2 ? 1.0f : -1.0f;
+        memcpy(matrix, ball_shadow.model_matrix, sizeof(float) * 16);
+        set_shadow_axes(matrix, i < 2 ? ball_side_axes : ball_floor_axes);
+        matrix[12] = i < 2 ? side * stage.width2 : ball.model_matrix[12];
+        matrix[13] = i < 2 ? ball.model_matrix[13] : side * stage.height2;
+        matrix[14] = ball.model_matrix[14];
+    }
+    set_uniform(UNIFORM_APPLY_OFFSET, 1.0f);
+    render_pong_element_instances(&ball_shadow, ball_shadows, 4);
+    set_uniform(UNIFORM_APPLY_OFFSET, 0.0f);
+}
 
-    ball_shadow.model_matrix[12] = ball.model_matrix[12];
-    ball_shadow.model_matrix[13] = stage.height2;
-    ball_shadow.model_matrix[14] = ball.model_matrix[14];
-    render_pong_element(&ball_shadow);
+/**
+  Draws shadows of player stick on the four stage sides as one instanced draw.
+ */
+static void draw_stick_shadows(const DRAW_ITEM* item)
+{
+    float stick_shadows[4 * 16];
+
+    (void)item;
+    for (int i = 0; i < 4; i++) {
+        float* matrix = stick_shadows + i * 16;
+        float side = i % 2 ? 1.0f : -1.0f;
+        memcpy(matrix, stick_shadow.model_matrix, sizeof(float) * 16);
+        // shadows on floor and ceiling, then turned a quarter on left and right sides
+        matrix[0] = i < 2 ? 1.0f : 0.0f;
+        matrix[1] = i < 2 ? 0.0f : 1.0f;
+        matrix[4] = i < 2 ? 0.0f : -1.0f;
+        matrix[5] = i < 2 ? 1.0f : 0.0f;
+        matrix[12] = i < 2 ? player_stick.model_matrix[12] : side * stage.width2;
+        matrix[13] = i < 2 ? side * stage.height2 : player_stick.model_matrix[13];
+    }
+    render_pong_element_instances(&stick_shadow, stick_shadows, 4);
+}
 
-    stick_shadow.model_matrix[0] = 1.0f;
-    stick_shadow.model_matrix[1] = 0.0;
-    stick_shadow.model_matrix[4] = 0.0;
-    stick_shadow.model_matrix[5] = 1.0f;
-    glUniform1i(applyOffsetUniform, 0);
+/**
+  Draws stage walls and their grid lines in one pass.
+ */
+static void draw_stage(const DRAW_ITEM* item)
+{
+    (void)item;
+    renderer_set_material(MATERIAL_WIREFRAME);
+    draw_element(&stage);
+}
 
-    stick_shadow.model_matrix[12] = player_stick.model_matrix[12];
-    stick_shadow.model_matrix[13] = -stage.height2;
-    render_pong_element(&stick_shadow);
+// params[0] is the number of marks
+static void draw_balls_counter(const DRAW_ITEM* item)
+{
+    float marks[BALLS * 16];
+    float gap = ball_mark.width * 3.0f;
+    int balls = (int)item->params[0];
 
-    stick_shadow.model_matrix[12] = player_stick.model_matrix[12];
-    stick_shadow.model_matrix[13] = stage.height2;
-    render_pong_element(&stick_shadow);
+    balls = balls < BALLS ? balls : BALLS;
+    for (int i = 0; i < balls; i++) {
+        memcpy(marks + i * 16, ball_mark.model_matrix, sizeof(float) * 16);
+        marks[i * 16 + 12] = -((float)(balls)*gap) / 2.0f + gap * (i + 1);
+        marks[i * 16 + 13] = -stage.height2 + 0.05f;
+    }
+    render_pong_element_instances(&ball_mark, marks, balls);
+}
 
-    stick_shadow.model_matrix[0] = 0;
-    stick_shadow.model_matrix[1] = 1.0;
-    stick_shadow.model_matrix[4] = -1.0;
-    stick_shadow.model_matrix[5] = 0;
+// data is the element
+static void draw_plain_element(const DRAW_ITEM* item)
+{
+    render_pong_element((PONG_ELEMENT*)item->data);
+}
 
-    stick_shadow.model_matrix[12] = -stage.width2;
-    stick_shadow.model_matrix[13] = player_stick.model_matrix[13];
-    render_pong_element(&stick_shadow);
+static void draw_stick(const DRAW_ITEM* item)
+{
+    renderer_set_material(MATERIAL_STICK);
+    draw_element((PONG_ELEMENT*)item->data);
+}
 
-    stick_shadow.model_matrix[12] = stage.width2;
-    stick_shadow.model_matrix[13] = player_stick.model_matrix[13];
-    render_pong_element(&stick_shadow);
+// params[0] is the alpha taken from overlay
+static void draw_overlay(const DRAW_ITEM* item)
+{
+    set_uniform(UNIFORM_ALPHA, item->params[0]);
+    render_pong_element(&overlay);
+    set_uniform(UNIFORM_ALPHA, 0.0f);
 }
 
-void render_stage()
+/**
+  Distance of a model placed by model_matrix from camera, along view direction.
+ */
+float renderer_view_depth(const float* model_matrix)
 {
-    glUniform1i(stageWireframeUniform, 1);
-    glPolygonMode(GL_FRONT, GL_LINE);
-    render_pong_element(&stage);
-    glUniform1i(stageWireframeUniform, 0);
-    glPolygonMode(GL_FRONT, GL_FILL);
-    render_pong_element(&stage);
+    return -(model_matrix[14] + view_matrix[14]);
 }
 
-void render_balls_counter(int balls)
+/**
+  Queues a draw for the frame. Material and instanced select the shader variant it's sorted by.
+  Returns the draw to set its params, or NULL if queue is full.
+ */
+DRAW_ITEM* renderer_submit(DRAW_PASS pass, int transparent, RENDER_MATERIAL material, int instanced,
+    GLuint vao, float depth, DrawFunction draw, const void* data)
 {
-    ball_mark.model_matrix[13] = -stage.height2 + 0.05f;
+    unsigned variant = (unsigned)material | (instanced ? 4u : 0u);
+    return draw_queue_submit(&draw_queue, draw_key(pass, transparent, variant, vao, depth), draw, data);
+}
 
-    float gap = ball_mark.width * 3.0f;
-    ball_mark.model_matrix[12] = -((float)(balls)*gap) / 2.0f;
+/**
+  Issues draws queued for the frame in key order.
+ */
+void renderer_draw_queue()
+{
+    draw_queue_execute(&draw_queue);
+}
 
-    for (int i = 0; i < balls; i++) {
-        ball_mark.model_matrix[12] += gap;
-        render_pong_element(&ball_mark);
-    }
+void submit_stage()
+{
+    // walls enclose every other body, so they're behind all of them
+    float depth = renderer_view_depth(stage.model_matrix) + stage.large;
+    renderer_submit(DRAW_PASS_WORLD, 1, MATERIAL_WIREFRAME, 0, stage.vao, depth, draw_stage, NULL);
 }
 
-void render_ball()
+void submit_shadows()
 {
-    render_pong_element(&ball);
+    // shadows lie on walls, behind the body casting them
+    renderer_submit(DRAW_PASS_WORLD, 1, MATERIAL_PLAIN, instancing_supported, ball_shadow.vao,
+        renderer_view_depth(ball.model_matrix) + SHADOW_DEPTH_BIAS, draw_ball_shadows, NULL);
+    renderer_submit(DRAW_PASS_WORLD, 1, MATERIAL_PLAIN, instancing_supported, stick_shadow.vao,
+        renderer_view_depth(player_stick.model_matrix) + SHADOW_DEPTH_BIAS, draw_stick_shadows, NULL);
 }
 
-GLuint renderer_get_main_program()
+void submit_balls_counter(int balls)
 {
-    return program;
+    DRAW_ITEM* item = renderer_submit(DRAW_PASS_WORLD, 0, MATERIAL_PLAIN, instancing_supported, ball_mark.vao,
+        renderer_view_depth(ball_mark.model_matrix), draw_balls_counter, NULL);
+    if (item) {
+        item->params[0] = (float)balls;
+    }
 }
 
-void render_overlay()
+void submit_ball()
 {
-    render_pong_element(&overlay);
+    renderer_submit(DRAW_PASS_WORLD, 0, MATERIAL_PLAIN, 0, ball.vao, renderer_view_depth(ball.model_matrix),
+        draw_plain_element, &ball);
 }
 
-void reset_overlay()
+GLuint renderer_get_main_program()
 {
-    glUniform1f(alphaUniform, 0.0f);
+    return program;
 }
-void render_fadeout_overlay(float pAlpha)
+
+/**
+  Queues overlay darkening the stage, made more transparent by alpha.
+ */
+void submit_overlay(float alpha)
 {
-    glUniform1f(alphaUniform, pAlpha);
-    render_overlay();
-    glUniform1f(alphaUniform, 0.0f);
+    DRAW_ITEM* item = renderer_submit(DRAW_PASS_OVERLAY, 1, MATERIAL_PLAIN, 0, overlay.vao, 0.0f, draw_overlay, NULL);
+    if (item) {
+        item->params[0] = alpha;
+    }
 }
 
-void render_opponent_stick()
+void submit_opponent_stick()
 {
-    glUniform1i(renderStickUniform, 1);
-    render_pong_element(&opponent_stick);
-    glUniform1i(renderStickUniform, 0);
+    renderer_submit(DRAW_PASS_WORLD, 1, MATERIAL_STICK, 0, opponent_stick.vao,
+        renderer_view_depth(opponent_stick.model_matrix), draw_stick, &opponent_stick);
 }
-void render_player_stick()
+void submit_player_stick()
 {
-    int mx, my;
-    sys_mouse_position(&mx, &my);
-    move_player_stick((mx - (WINDOW_WIDTH >> 1)) / (float)WINDOW_WIDTH,
-        //(aspect * h -> w/h * h -> h)
-        (my - (WINDOW_HEIGHT >> 1)) / -(float)WINDOW_WIDTH);
-
-    glUniform1i(renderStickUniform, 1);
-    render_pong_element(&player_stick);
-    glUniform1i(renderStickUniform, 0);
+    renderer_submit(DRAW_PASS_WORLD, 1, MATERIAL_STICK, 0, player_stick.vao,
+        renderer_view_depth(player_stick.model_matrix), draw_stick, &player_stick);
 }
-
@@ -1,28 +1,67 @@
 #ifndef _RENDERER_H_
 #define _RENDERER_H_
 
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+
+#include "drawqueue.h"
 #include "geometry.h"
+#include <GL/glew.h>
+
+/**
+  How fragment shader colors a draw: with mesh colors, as a stick, as stage walls with grid lines or as a glyph.
+ */
+typedef enum {
+    MATERIAL_PLAIN,
+    MATERIAL_STICK,
+    MATERIAL_WIREFRAME,
+    MATERIAL_TEXT
+} RENDER_MATERIAL;
+
+/**
+  GL state calls (program, VAO, texture and uniforms) issued and skipped because they
+  wouldn't change state, in last frame and in all frames.
+ */
+typedef struct {
+    unsigned frames;
+    unsigned frame_issued;
+    unsigned frame_skipped;
+    unsigned long long total_issued;
+    unsigned long long total_skipped;
+} RENDERER_STATE_STATS;
 
 int init_renderer(int width, int height);
 GLuint renderer_get_main_program();
 GLuint build_shaders_program(int count, int* result, GLchar* errormsg, ...);
 void render_pong_element(PONG_ELEMENT* element);
+void render_pong_element_instances(PONG_ELEMENT* element, const float* models, int count);
+void renderer_bind_vao(GLuint vao);
+void renderer_bind_texture(GLenum unit, GLuint texture);
+void renderer_set_model_matrix(const float* matrix);
+void renderer_set_material(RENDER_MATERIAL material);
+void renderer_end_frame();
+void renderer_state_stats(RENDERER_STATE_STATS* stats);
 void upload_to_renderer(PONG_ELEMENT*);
 void remove_to_renderer(PONG_ELEMENT*);
+void upload_elements();
+void remove_elements();
 void dispose_renderer();
 
-void render_stage();
-void render_ball();
-void render_balls_counter(int);
+float renderer_view_depth(const float* model_matrix);
+DRAW_ITEM* renderer_submit(DRAW_PASS pass, int transparent, RENDER_MATERIAL material, int instanced,
+    GLuint vao, float depth, DrawFunction draw, const void* data);
+void renderer_draw_queue();
+
+void submit_stage();
+void submit_ball();
+void submit_balls_counter(int);
 
-void render_fadeout_overlay(float overlay_fadeout_alpha);
 void renderer_clear_screen();
-void render_overlay();
-void reset_overlay();
+void submit_overlay(float alpha);
 
-void render_opponent_stick();
-void render_player_stick();
-void render_balls_counter(int);
-void render_shadows();
+void submit_opponent_stick();
+void submit_player_stick();
+void submit_shadows();
 
 #endif
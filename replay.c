@@ -0,0 +1,251 @@
+/**
+  @file replay.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Recording and replay of matches as streams of tick indexed input events.
+
+  Game logic is deterministic given the random seed and the input events consumed by each
+  tick, so that is all a replay stores. Stream format:
+
+  - header: "P3DR", version byte, varint seed, varint tick rate.
+  - one record per event: varint (ticks since previous record << 2 | event type). Mouse motions
+    follow with zigzag varint deltas of x and y from previous motion.
+  - end record: varint (ticks since previous record << 2 | 3), varint checksum of game state
+    at the end, which replay compares to detect that it diverged from the recording.
+ */
+
+#include "replay.h"
+#include "geometry.h"
+#include "input.h"
+#include "pong3d.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_VERSION 2
+#define REPLAY_END 3
+
+static void write_varint(REPLAY* replay, uint32_t value)
+{
+    while (value >= 0x80) {
+        putc((int)(value & 0x7F) | 0x80, replay->file);
+        value >>= 7;
+    }
+    putc((int)value, replay->file);
+}
+
+static void write_signed_varint(REPLAY* replay, int value)
+{
+    write_varint(replay, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static int read_varint(REPLAY* replay, uint32_t* value)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35 && replay->cursor < replay->size; shift += 7) {
+        unsigned char byte = replay->data[replay->cursor++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int read_signed_varint(REPLAY* replay, int* value)
+{
+    uint32_t raw;
+    if (read_varint(replay, &raw) < 0) {
+        return -1;
+    }
+    *value = (int)(raw >> 1) ^ -(int)(raw & 1);
+    return 0;
+}
+
+static void hash_bytes(uint32_t* hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        *hash = (*hash ^ bytes[i]) * 16777619u;
+    }
+}
+
+/**
+  FNV-1a hash of the game state that matters for replaying.
+ */
+static uint32_t state_checksum(const GameContext* ctx)
+{
+    uint32_t hash = 2166136261u;
+    hash_bytes(&hash, &ctx->ball.x, sizeof(float) * 3);
+    hash_bytes(&hash, &ctx->player_stick.x, sizeof(float) * 3);
+    hash_bytes(&hash, &ctx->opponent_stick.x, sizeof(float) * 3);
+    hash_bytes(&hash, &ctx->player_score, sizeof(int));
+    hash_bytes(&hash, &ctx->opponent_score, sizeof(int));
+    hash_bytes(&hash, &ctx->balls, sizeof(int));
+    hash_bytes(&hash, &ctx->gameState, sizeof(GAME_STATE));
+    return hash;
+}
+
+int replay_start_recording(REPLAY* replay, const char* path, uint32_t seed)
+{
+    memset(replay, 0, sizeof(REPLAY));
+    replay->file = fopen(path, "wb");
+    if (!replay->file) {
+        return -1;
+    }
+    fwrite("P3DR", 1, 4, replay->file);
+    putc(REPLAY_VERSION, replay->file);
+    write_varint(replay, seed);
+    write_varint(replay, TICK_RATE);
+    return 0;
+}
+
+/**
+  Records the first events of match input queue, the ones consumed by current tick.
+ */
+void replay_record_tick(REPLAY* replay, const GameContext* ctx, int events)
+{
+    uint32_t tick = game_tick_count(ctx);
+    for (int i = 0; i < events; i++) {
+        const SysEvent* event = input_peek_event(&ctx->input, i);
+        write_varint(replay, (tick - replay->last_tick) << 2 | (uint32_t)event->type);
+        replay->last_tick = tick;
+        if (event->type == MOUSEMOTION) {
+            write_signed_varint(replay, event->x - replay->last_x);
+            write_signed_varint(replay, event->y - replay->last_y);
+            replay->last_x = event->x;
+            replay->last_y = event->y;
+        }
+    }
+}
+
+int replay_stop_recording(REPLAY* replay, const GameContext* ctx)
+{
+    int result;
+    if (!replay->file) {
+        return 0;
+    }
+    write_varint(replay, (game_tick_count(ctx) - replay->last_tick) << 2 | REPLAY_END);
+    write_varint(replay, state_checksum(ctx));
+    result = ferror(replay->file) ? -1 : 0;
+    fclose(replay->file);
+    replay->file = NULL;
+    return result;
+}
+
+int replay_is_recording(const REPLAY* replay)
+{
+    return replay->file != NULL;
+}
+
+static int decode_next_record(REPLAY* replay)
+{
+    uint32_t value;
+    if (read_varint(replay, &value) < 0) {
+        return -1;
+    }
+    replay->next_tick += value >> 2;
+    replay->next_type = (int)(value & 3);
+    return 0;
+}
+
+/**
+  Loads a replay and returns its random seed, which game must be initialized with.
+ */
+int replay_load(REPLAY* replay, const char* path, uint32_t* seed)
+{
+    uint32_t tick_rate;
+    FILE* file = fopen(path, "rb");
+    memset(replay, 0, sizeof(REPLAY));
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    replay->size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+    replay->data = (unsigned char*)malloc(replay->size);
+    if (!replay->data || fread(replay->data, 1, replay->size, file) != replay->size) {
+        fclose(file);
+        replay_dispose(replay);
+        return -1;
+    }
+    fclose(file);
+    replay->cursor = 5;
+    if (replay->size < 5 || memcmp(replay->data, "P3DR", 4) || replay->data[4] != REPLAY_VERSION
+        || read_varint(replay, seed) < 0 || read_varint(replay, &tick_rate) < 0) {
+        replay_dispose(replay);
+        return -1;
+    }
+    // ticks of a replay recorded at another rate don't match
+    if (tick_rate != TICK_RATE) {
+        replay_dispose(replay);
+        return -1;
+    }
+    return decode_next_record(replay);
+}
+
+/**
+  Replaces match input queue with events recorded for current tick. Returns number of events,
+  or -1 when replay has finished.
+ */
+int replay_feed_tick(REPLAY* replay, GameContext* ctx)
+{
+    uint32_t tick = game_tick_count(ctx);
+    SysEvent event;
+    int events = 0;
+
+    if (replay->finished) {
+        return -1;
+    }
+    input_clear_events(&ctx->input);
+    memset(&event, 0, sizeof(event));
+    while (replay->next_tick == tick) {
+        if (replay->next_type == REPLAY_END) {
+            replay->finished = 1;
+            if (read_varint(replay, &replay->checksum) < 0) {
+                replay->checksum = 0;
+            }
+            return -1;
+        }
+        event.type = (SysEventType)replay->next_type;
+        if (event.type == MOUSEMOTION) {
+            int dx, dy;
+            if (read_signed_varint(replay, &dx) < 0 || read_signed_varint(replay, &dy) < 0) {
+                replay->finished = 1;
+                return -1;
+            }
+            replay->last_x += dx;
+            replay->last_y += dy;
+        }
+        event.x = replay->last_x;
+        event.y = replay->last_y;
+        input_push_event(&ctx->input, &event);
+        events++;
+        if (decode_next_record(replay) < 0) {
+            replay->finished = 1;
+            break;
+        }
+    }
+    return events;
+}
+
+/**
+  Returns 0 if game state at the end of replay is the one recorded. Game may stop before
+  reading the end of replay (a recorded CLOSE event), so it is read here if it is due.
+ */
+int replay_verify(REPLAY* replay, GameContext* ctx)
+{
+    if (!replay->finished) {
+        replay_feed_tick(replay, ctx);
+    }
+    return replay->finished && replay->checksum == state_checksum(ctx) ? 0 : -1;
+}
+
+void replay_dispose(REPLAY* replay)
+{
+    free(replay->data);
+    replay->data = NULL;
+    replay->size = 0;
+    replay->cursor = 0;
+}
@@ -0,0 +1,44 @@
+/**
+  @file replay.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Recording and replay of matches as streams of tick indexed input events.
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include "pong3d.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+  @brief A replay being recorded or played. Each match records or plays its own.
+ */
+typedef struct REPLAY {
+    FILE* file;
+    unsigned char* data;
+    size_t size;
+    size_t cursor;
+    /** tick of last record and last mouse position, origin of deltas */
+    uint32_t last_tick;
+    int last_x;
+    int last_y;
+    /** next record of replay already decoded */
+    uint32_t next_tick;
+    int next_type;
+    int finished;
+    uint32_t checksum;
+} REPLAY;
+
+int replay_start_recording(REPLAY* replay, const char* path, uint32_t seed);
+void replay_record_tick(REPLAY* replay, const GameContext* ctx, int events);
+int replay_stop_recording(REPLAY* replay, const GameContext* ctx);
+int replay_is_recording(const REPLAY* replay);
+
+int replay_load(REPLAY* replay, const char* path, uint32_t* seed);
+int replay_feed_tick(REPLAY* replay, GameContext* ctx);
+int replay_verify(REPLAY* replay, GameContext* ctx);
+void replay_dispose(REPLAY* replay);
+
+#endif
@@ -0,0 +1,261 @@
+/**
+  @file reverb.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Convolution reverb with an impulse response, split in partitions convolved by FFT.
+
+  Uniformly partitioned overlap-save: impulse response is split in partitions of REVERB_PARTITION
+  samples, whose spectra over 2 * REVERB_PARTITION points are computed once. Each input block is
+  transformed with the previous one and kept in a ring of spectra; output block is the inverse
+  transform of the sum of each partition spectrum times the input spectrum as old as it, so cost
+  per block is one FFT pair plus a complex product per bin and partition. Real signals of 2M
+  samples are transformed by a complex FFT of M points.
+ */
+
+#include "reverb.h"
+#include "math_constants.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REVERB_BLOCK REVERB_PARTITION
+
+static void setup_tables(REVERB* reverb)
+{
+    int bits = 0;
+    while ((1 << bits) < REVERB_BLOCK) {
+        bits++;
+    }
+    for (int i = 0; i < REVERB_BLOCK; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        reverb->bit_reverse[i] = reversed;
+    }
+    for (int k = 0; k < REVERB_BLOCK / 2; k++) {
+        reverb->twiddle_re[k] = (float)cos(-2.0 * M_PI * k / REVERB_BLOCK);
+        reverb->twiddle_im[k] = (float)sin(-2.0 * M_PI * k / REVERB_BLOCK);
+    }
+    for (int k = 0; k < REVERB_BINS; k++) {
+        reverb->split_re[k] = (float)cos(-M_PI * k / REVERB_BLOCK);
+        reverb->split_im[k] = (float)sin(-M_PI * k / REVERB_BLOCK);
+    }
+}
+
+// in place complex FFT of REVERB_BLOCK points, radix 2
+static void fft(const REVERB* reverb, float* re, float* im)
+{
+    for (int i = 0; i < REVERB_BLOCK; i++) {
+        int j = reverb->bit_reverse[i];
+        if (j > i) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    for (int size = 2; size <= REVERB_BLOCK; size <<= 1) {
+        int half = size / 2;
+        int step = REVERB_BLOCK / size;
+        for (int start = 0; start < REVERB_BLOCK; start += size) {
+            for (int k = 0; k < half; k++) {
+                float wr = reverb->twiddle_re[k * step];
+                float wi = reverb->twiddle_im[k * step];
+                int a = start + k;
+                int b = a + half;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+/**
+  Spectrum of 2 * REVERB_BLOCK real samples, bins 0 to REVERB_BLOCK. Even and odd samples go
+  through a complex FFT as real and imaginary parts and their spectra are split afterwards.
+ */
+static void real_fft(REVERB* reverb, const float* samples, float* out_re, float* out_im)
+{
+    float* re = reverb->fft_re;
+    float* im = reverb->fft_im;
+
+    for (int n = 0; n < REVERB_BLOCK; n++) {
+        re[n] = samples[2 * n];
+        im[n] = samples[2 * n + 1];
+    }
+    fft(reverb, re, im);
+    for (int k = 0; k < REVERB_BINS; k++) {
+        int a = k % REVERB_BLOCK;
+        int b = (REVERB_BLOCK - k) % REVERB_BLOCK;
+        // spectra of even (e) and odd (o) samples
+        float er = (re[a] + re[b]) * 0.5f;
+        float ei = (im[a] - im[b]) * 0.5f;
+        float odd_re = (im[a] + im[b]) * 0.5f;
+        float odd_im = (re[b] - re[a]) * 0.5f;
+        out_re[k] = er + reverb->split_re[k] * odd_re - reverb->split_im[k] * odd_im;
+        out_im[k] = ei + reverb->split_re[k] * odd_im + reverb->split_im[k] * odd_re;
+    }
+}
+
+/**
+  Inverse of real_fft without the 1 / REVERB_BLOCK scale. Only second half of the samples is
+  written, to out.
+ */
+static void inverse_real_fft(REVERB* reverb, const float* in_re, const float* in_im, float* out)
+{
+    float* re = reverb->fft_re;
+    float* im = reverb->fft_im;
+
+    for (int k = 0; k < REVERB_BLOCK; k++) {
+        int b = REVERB_BLOCK - k;
+        float er = (in_re[k] + in_re[b]) * 0.5f;
+        float ei = (in_im[k] - in_im[b]) * 0.5f;
+        float dr = (in_re[k] - in_re[b]) * 0.5f;
+        float di = (in_im[k] + in_im[b]) * 0.5f;
+        // odd spectrum is difference over split twiddle
+        float odd_re = dr * reverb->split_re[k] + di * reverb->split_im[k];
+        float odd_im = di * reverb->split_re[k] - dr * reverb->split_im[k];
+        // conjugated, so forward FFT gives the inverse one conjugated
+        re[k] = er - odd_im;
+        im[k] = -(ei + odd_re);
+    }
+    fft(reverb, re, im);
+    for (int n = REVERB_BLOCK / 2; n < REVERB_BLOCK; n++) {
+        out[2 * n - REVERB_BLOCK] = re[n];
+        out[2 * n + 1 - REVERB_BLOCK] = -im[n];
+    }
+}
+
+/**
+  Sets up reverb of an impulse response of length samples, scaled to unit energy. Returns -1 if
+  spectra couldn't be allocated.
+ */
+int reverb_create(REVERB* reverb, const float* impulse_response, int length, float wet)
+{
+    size_t spectra;
+    double energy = 0.0;
+    float scale;
+
+    memset(reverb, 0, sizeof(REVERB));
+    reverb->partitions = length > 0 ? (length + REVERB_BLOCK - 1) / REVERB_BLOCK : 1;
+    spectra = (size_t)reverb->partitions * REVERB_BINS;
+    reverb->ir_re = (float*)calloc(spectra * 4, sizeof(float));
+    if (!reverb->ir_re) {
+        return -1;
+    }
+    reverb->ir_im = reverb->ir_re + spectra;
+    reverb->input_re = reverb->ir_im + spectra;
+    reverb->input_im = reverb->input_re + spectra;
+    reverb->wet = wet;
+    setup_tables(reverb);
+
+    for (int i = 0; i < length; i++) {
+        energy += (double)impulse_response[i] * impulse_response[i];
+    }
+    // inverse FFT scale is folded into impulse response spectra
+    scale = (float)((energy > 0.0 ? 1.0 / sqrt(energy) : 0.0) / REVERB_BLOCK);
+    for (int p = 0; p < reverb->partitions; p++) {
+        int start = p * REVERB_BLOCK;
+        int count = length - start < REVERB_BLOCK ? length - start : REVERB_BLOCK;
+        float* re = reverb->ir_re + p * REVERB_BINS;
+        float* im = reverb->ir_im + p * REVERB_BINS;
+        memset(reverb->block, 0, sizeof(reverb->block));
+        for (int i = 0; i < count; i++) {
+            reverb->block[i] = impulse_response[start + i] * scale;
+        }
+        real_fft(reverb, reverb->block, re, im);
+    }
+    memset(reverb->block, 0, sizeof(reverb->block));
+    return 0;
+}
+
+void reverb_dispose(REVERB* reverb)
+{
+    free(reverb->ir_re);
+    reverb->ir_re = NULL;
+}
+
+static void process_block(REVERB* reverb)
+{
+    float* input_re;
+    float* input_im;
+
+    reverb->newest = (reverb->newest + 1) % reverb->partitions;
+    input_re = reverb->input_re + reverb->newest * REVERB_BINS;
+    input_im = reverb->input_im + reverb->newest * REVERB_BINS;
+    real_fft(reverb, reverb->block, input_re, input_im);
+
+    memset(reverb->sum_re, 0, sizeof(reverb->sum_re));
+    memset(reverb->sum_im, 0, sizeof(reverb->sum_im));
+    for (int p = 0; p < reverb->partitions; p++) {
+        int slot = reverb->newest - p < 0 ? reverb->newest - p + reverb->partitions : reverb->newest - p;
+        const float* hr = reverb->ir_re + p * REVERB_BINS;
+        const float* hi = reverb->ir_im + p * REVERB_BINS;
+        const float* xr = reverb->input_re + slot * REVERB_BINS;
+        const float* xi = reverb->input_im + slot * REVERB_BINS;
+        for (int k = 0; k < REVERB_BINS; k++) {
+            reverb->sum_re[k] += hr[k] * xr[k] - hi[k] * xi[k];
+            reverb->sum_im[k] += hr[k] * xi[k] + hi[k] * xr[k];
+        }
+    }
+    inverse_real_fft(reverb, reverb->sum_re, reverb->sum_im, reverb->output);
+    memmove(reverb->block, reverb->block + REVERB_BLOCK, sizeof(float) * REVERB_BLOCK);
+}
+
+/**
+  Adds reverb of frames interleaved stereo frames to them. Both channels feed one reverb, added
+  to both of them.
+ */
+void reverb_process(REVERB* reverb, float* stereo, int frames)
+{
+    for (int i = 0; i < frames; i++) {
+        float wet = reverb->output[reverb->filled] * reverb->wet;
+        reverb->block[REVERB_BLOCK + reverb->filled] = (stereo[i * 2] + stereo[i * 2 + 1]) * 0.5f;
+        stereo[i * 2] += wet;
+        stereo[i * 2 + 1] += wet;
+        if (++reverb->filled == REVERB_BLOCK) {
+            process_block(reverb);
+            reverb->filled = 0;
+        }
+    }
+}
+
+/**
+  Bytes used by reverb, spectra included.
+ */
+int reverb_memory(const REVERB* reverb)
+{
+    return (int)(sizeof(REVERB) + (size_t)reverb->partitions * REVERB_BINS * 4 * sizeof(float));
+}
+
+/**
+  Fills length samples with white noise decaying 60 dB along them, darker as it decays, like a
+  room with that reverb time.
+ */
+void reverb_generate_ir(float* impulse_response, int length, uint32_t seed)
+{
+    float decay = expf(-6.91f / (float)length);
+    float level = 1.0f;
+    float filtered = 0.0f;
+    uint32_t state = seed ? seed : 1;
+
+    for (int i = 0; i < length; i++) {
+        float noise;
+        // one-pole low pass closing from 1 to 0.1 of sample rate as tail goes on
+        float cutoff = 0.1f + 0.9f * level;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        noise = (state >> 8) / 8388608.0f - 1.0f;
+        filtered += (noise - filtered) * cutoff;
+        impulse_response[i] = filtered * level;
+        level *= decay;
+    }
+}
@@ -0,0 +1,58 @@
+/**
+  @file reverb.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Convolution reverb with an impulse response, split in partitions convolved by FFT.
+ */
+
+#ifndef _REVERB_H_
+#define _REVERB_H_
+
+#include <stdint.h>
+
+// samples of each impulse response partition, and of input block. Must be a power of two.
+#define REVERB_PARTITION 256
+
+// spectrum bins of a block of 2 * REVERB_PARTITION real samples
+#define REVERB_BINS (REVERB_PARTITION + 1)
+
+/**
+  @brief Uniformly partitioned convolution. Spectra of impulse response partitions and of last input
+  blocks are kept in buffers allocated at creation, so processing neither allocates nor locks.
+  Reverb output is delayed REVERB_PARTITION samples.
+ */
+typedef struct {
+    int partitions;
+    /** gain of reverb added to dry signal */
+    float wet;
+    /** impulse response spectra, one row of REVERB_BINS per partition, scaled for inverse FFT */
+    float* ir_re;
+    float* ir_im;
+    /** spectra of last input blocks, used as a ring of partitions rows */
+    float* input_re;
+    float* input_im;
+    int newest;
+    /** previous and current input block */
+    float block[REVERB_PARTITION * 2];
+    /** reverb of previous input block, played while current one is gathered */
+    float output[REVERB_PARTITION];
+    int filled;
+    float sum_re[REVERB_BINS];
+    float sum_im[REVERB_BINS];
+    float fft_re[REVERB_PARTITION];
+    float fft_im[REVERB_PARTITION];
+    /** twiddles of complex FFT of REVERB_PARTITION points and of its real FFT split */
+    float twiddle_re[REVERB_PARTITION / 2];
+    float twiddle_im[REVERB_PARTITION / 2];
+    float split_re[REVERB_BINS];
+    float split_im[REVERB_BINS];
+    int bit_reverse[REVERB_PARTITION];
+} REVERB;
+
+int reverb_create(REVERB* reverb, const float* impulse_response, int length, float wet);
+void reverb_dispose(REVERB* reverb);
+void reverb_process(REVERB* reverb, float* stereo, int frames);
+int reverb_memory(const REVERB* reverb);
+void reverb_generate_ir(float* impulse_response, int length, uint32_t seed);
+
+#endif
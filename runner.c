@@ -0,0 +1,115 @@
+/**
+  @file runner.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Pool of threads stepping many independent matches at once.
+
+  Matches don't share any state, so workers only synchronize to take contexts from the batch.
+  A worker takes a few contexts at a time and steps each one until it is done, keeping the
+  context in its core cache while it runs.
+ */
+
+#include "runner.h"
+#include <stdlib.h>
+
+// contexts taken by a worker each time
+#define RUNNER_CHUNK 4
+
+static void* runner_worker(void* arg)
+{
+    GAME_RUNNER* runner = (GAME_RUNNER*)arg;
+    unsigned int generation = 0;
+
+    pthread_mutex_lock(&runner->lock);
+    for (;;) {
+        while (!runner->quit && runner->generation == generation) {
+            pthread_cond_wait(&runner->work_ready, &runner->lock);
+        }
+        if (runner->quit) {
+            break;
+        }
+        generation = runner->generation;
+        while (runner->next < runner->count) {
+            int first = runner->next;
+            int last = first + RUNNER_CHUNK < runner->count ? first + RUNNER_CHUNK : runner->count;
+            runner->next = last;
+            pthread_mutex_unlock(&runner->lock);
+            for (int i = first; i < last; i++) {
+                while (!runner->step(&runner->contexts[i], i, runner->data))
+                    ;
+            }
+            pthread_mutex_lock(&runner->lock);
+        }
+        if (--runner->busy == 0) {
+            pthread_cond_signal(&runner->work_done);
+        }
+    }
+    pthread_mutex_unlock(&runner->lock);
+    return NULL;
+}
+
+/**
+  Starts a pool of threads. Returns -1 if threads couldn't be created.
+ */
+int runner_create(GAME_RUNNER* runner, int threads)
+{
+    runner->threads = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    runner->thread_count = 0;
+    runner->generation = 0;
+    runner->quit = 0;
+    runner->contexts = NULL;
+    runner->count = 0;
+    runner->next = 0;
+    runner->busy = 0;
+    if (!runner->threads) {
+        return -1;
+    }
+    pthread_mutex_init(&runner->lock, NULL);
+    pthread_cond_init(&runner->work_ready, NULL);
+    pthread_cond_init(&runner->work_done, NULL);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&runner->threads[i], NULL, runner_worker, runner)) {
+            runner_dispose(runner);
+            return -1;
+        }
+        runner->thread_count++;
+    }
+    return 0;
+}
+
+/**
+  Steps every context until step function reports it is done. Blocks until all of them are.
+ */
+void runner_run(GAME_RUNNER* runner, GameContext* contexts, int count, GAME_STEP step, void* data)
+{
+    pthread_mutex_lock(&runner->lock);
+    runner->contexts = contexts;
+    runner->count = count;
+    runner->next = 0;
+    runner->step = step;
+    runner->data = data;
+    runner->busy = runner->thread_count;
+    runner->generation++;
+    pthread_cond_broadcast(&runner->work_ready);
+    while (runner->busy > 0) {
+        pthread_cond_wait(&runner->work_done, &runner->lock);
+    }
+    pthread_mutex_unlock(&runner->lock);
+}
+
+void runner_dispose(GAME_RUNNER* runner)
+{
+    pthread_mutex_lock(&runner->lock);
+    runner->quit = 1;
+    pthread_cond_broadcast(&runner->work_ready);
+    pthread_mutex_unlock(&runner->lock);
+    for (int i = 0; i < runner->thread_count; i++) {
+        pthread_join(runner->threads[i], NULL);
+    }
+    pthread_cond_destroy(&runner->work_ready);
+    pthread_cond_destroy(&runner->work_done);
+    pthread_mutex_destroy(&runner->lock);
+    free(runner->threads);
+    runner->threads = NULL;
+    runner->thread_count = 0;
+}
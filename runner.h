@@ -0,0 +1,46 @@
+/**
+  @file runner.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Pool of threads stepping many independent matches at once.
+ */
+
+#ifndef _RUNNER_H_
+#define _RUNNER_H_
+
+#include "pong3d.h"
+#include <pthread.h>
+
+/**
+  Advances a match. index is the one of ctx in contexts array. Returns 0 while match has
+  work left and non zero when it is done.
+ */
+typedef int (*GAME_STEP)(GameContext* ctx, int index, void* data);
+
+/**
+  @brief Worker threads and the batch of contexts they are running.
+ */
+typedef struct {
+    pthread_t* threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    /** incremented for each batch, so workers know there is a new one */
+    unsigned int generation;
+    int quit;
+    GameContext* contexts;
+    int count;
+    /** first context not taken yet by a worker */
+    int next;
+    /** workers that haven't finished current batch */
+    int busy;
+    GAME_STEP step;
+    void* data;
+} GAME_RUNNER;
+
+int runner_create(GAME_RUNNER* runner, int threads);
+void runner_run(GAME_RUNNER* runner, GameContext* contexts, int count, GAME_STEP step, void* data);
+void runner_dispose(GAME_RUNNER* runner);
+
+#endif
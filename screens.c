@@ -10,17 +10,22 @@
 #include "msys.h"
 #include "pong3d.h"
 #include "renderer.h"
+#include "snapshot.h"
 #include "tasks.h"
 #include "text.h"
 #include <stdio.h>
+#include <string.h>
 
 #define TEXT_SIZE_SCALE 0.02f
 
+// extra balls drawn by each instanced draw
+#define MULTIBALL_INSTANCES 64
+
 float player_text_score_coords[2];
 float computer_text_score_coords[2];
-char score_text[16];
-
-float overlay_alpha = 1.0;
+// texts of both scores, kept until frame is drawn
+char player_score_text[16];
+char computer_score_text[16];
 
 void init_screens()
 {
@@ -32,75 +37,116 @@ void init_screens()
 
 void render_player_wins_screen()
 {
-    render_stage();
-    render_ball();
-    render_opponent_stick();
-    render_pong_element(&overlay);
-    render_text("Player wins", 0.0f, 0.0f, TEXT_SIZE_SCALE);
+    submit_stage();
+    submit_ball();
+    submit_opponent_stick();
+    submit_overlay(0.0f);
+    submit_text("Player wins", 0.0f, 0.0f, TEXT_SIZE_SCALE);
 }
 
 void render_opp_wins_screen()
 {
-    render_stage();
-    render_ball();
-    render_opponent_stick();
-    render_pong_element(&overlay);
-    render_text("Computer wins", 0.0f, 0.0f, TEXT_SIZE_SCALE);
+    submit_stage();
+    submit_ball();
+    submit_opponent_stick();
+    submit_overlay(0.0f);
+    submit_text("Computer wins", 0.0f, 0.0f, TEXT_SIZE_SCALE);
 }
 
 void render_main_screen(int pBalls, int pPlayer_score, int pComputer_score)
 {
-    render_stage();
-    render_opponent_stick();
-    render_ball();
-    render_player_stick();
-    render_scores(pPlayer_score, pComputer_score);
-    render_shadows();
-    render_balls_counter(pBalls);
+    submit_stage();
+    submit_opponent_stick();
+    submit_ball();
+    submit_player_stick();
+    submit_scores(pPlayer_score, pComputer_score);
+    submit_shadows();
+    submit_balls_counter(pBalls);
+}
+
+/**
+  Draws extra balls of multi-ball mode with ball mesh, in instanced draws of up to
+  MULTIBALL_INSTANCES balls. data holds x, y, z of each ball and params[0] their count.
+ */
+static void draw_multiball(const DRAW_ITEM* item)
+{
+    const float* positions = (const float*)item->data;
+    int count = (int)item->params[0];
+    float models[MULTIBALL_INSTANCES * 16];
+
+    for (int done = 0; done < count; done += MULTIBALL_INSTANCES) {
+        int batch = count - done < MULTIBALL_INSTANCES ? count - done : MULTIBALL_INSTANCES;
+        for (int i = 0; i < batch; i++) {
+            memcpy(models + i * 16, ball.model_matrix, sizeof(float) * 16);
+            models[i * 16 + 12] = positions[(done + i) * 3];
+            models[i * 16 + 13] = positions[(done + i) * 3 + 1];
+            models[i * 16 + 14] = positions[(done + i) * 3 + 2];
+        }
+        render_pong_element_instances(&ball, models, batch);
+    }
+}
+
+/**
+  Queues extra balls of multi-ball mode. positions holds x, y, z of each ball and must stay
+  valid until frame is drawn.
+ */
+void render_multiball(const float* positions, int count)
+{
+    DRAW_ITEM* item;
+
+    if (count <= 0) {
+        return;
+    }
+    // balls are opaque and share the ball mesh, so they're sorted with the main ball
+    item = renderer_submit(DRAW_PASS_WORLD, 0, MATERIAL_PLAIN, 1, ball.vao, renderer_view_depth(ball.model_matrix),
+        draw_multiball, positions);
+    if (item) {
+        item->params[0] = (float)count;
+    }
 }
+
 void render_start_screen()
 {
-    render_stage();
-    reset_overlay();
-    render_overlay();
-    render_text("Click on screen to begin", 0.0f, 0.0f, TEXT_SIZE_SCALE);
+    submit_stage();
+    submit_overlay(0.0f);
+    submit_text("Click on screen to begin", 0.0f, 0.0f, TEXT_SIZE_SCALE);
 }
 
 void render_finish_screen(int pPlayer_score, int computer_score)
 {
     render_start_screen();
-    render_scores(pPlayer_score, computer_score);
+    submit_scores(pPlayer_score, computer_score);
 }
 
-void render_scores(int pPlayer_score, int computer_score)
+void submit_scores(int pPlayer_score, int computer_score)
 {
-    sprintf(score_text, "YOU> %d", pPlayer_score);
-    render_text(score_text, player_text_score_coords[0], player_text_score_coords[1], TEXT_SIZE_SCALE);
-    sprintf(score_text, "Computer> %d", computer_score);
-    render_text(score_text, computer_text_score_coords[0], computer_text_score_coords[1], TEXT_SIZE_SCALE);
-}
-
-void loading_players_screen_set_overlay(float pOverlay) {
-  overlay_alpha = pOverlay; 
+    sprintf(player_score_text, "YOU> %d", pPlayer_score);
+    submit_text(player_score_text, player_text_score_coords[0], player_text_score_coords[1], TEXT_SIZE_SCALE);
+    sprintf(computer_score_text, "Computer> %d", computer_score);
+    submit_text(computer_score_text, computer_text_score_coords[0], computer_text_score_coords[1], TEXT_SIZE_SCALE);
 }
 
-void render_loading_players_screen() {
-  renderer_clear_screen();
-  render_stage();
-  render_fadeout_overlay(overlay_alpha);
+void render_loading_players_screen(float fadeout_alpha) {
+  submit_stage();
+  submit_overlay(fadeout_alpha);
 }
 
-void render()
+/**
+  Renders a snapshot of a match. Screens queue their draws, which are sorted and issued at the
+  end. Meshes must be placed first with place_snapshot_elements.
+ */
+void render(const GAME_SNAPSHOT* snapshot)
 {
     renderer_clear_screen();
-    switch (gameState) {
+    switch (snapshot->state) {
     case STARTING:
         render_start_screen();
         break;
     case PLAYER_SERVICE:
     case PLAYER_RETURN:
     case OPP_RETURN:
-        render_main_screen(balls, player_score, opponent_score);
+        render_main_screen(snapshot->balls, snapshot->player_score, snapshot->opponent_score);
+        render_multiball(snapshot->multiball_positions, snapshot->multiball_count);
         break;
     case PLAYER_WINS:
         render_player_wins_screen();
@@ -109,17 +155,19 @@ void render()
         render_opp_wins_screen();
         break;
     case FINISHED:
-        render_finish_screen(player_score, opponent_score);
+        render_finish_screen(snapshot->player_score, snapshot->opponent_score);
         break;
     case OPP_SERVICE:
     case STARTED:
         break;
     case LOADING_PLAYERS:
-      render_loading_players_screen();
+      render_loading_players_screen(snapshot->overlay_fadeout_alpha);
       break;
     case EXIT:
       break;
     }
+    renderer_draw_queue();
+    renderer_end_frame();
     sys_swap_buffers();
 }
 
@@ -8,15 +8,18 @@
 #ifndef _SCREENS_H_
 #define _SCREENS_H_
 
+#include "pong3d.h"
+#include "snapshot.h"
+
 void render_main_screen(int balls, int player_score, int computer_score);
-void render_scores(int player_score, int computer_score);
+void submit_scores(int player_score, int computer_score);
 void render_player_wins_screen();
 void render_opp_wins_screen();
 void render_start_screen();
 void render_finish_screen(int player_score, int computer_score);
 void init_screens();
-void render();
-void loading_players_screen_set_overlay(float overlay);
-void render_loading_players_screen();
+void render(const GAME_SNAPSHOT* snapshot);
+void render_multiball(const float* positions, int count);
+void render_loading_players_screen(float fadeout_alpha);
 
 #endif
@@ -0,0 +1,434 @@
+/**
+  @file sim.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Headless game driver. Plays matches against the computer with a scripted player as fast
+  as possible, to measure simulation throughput and to soak test game rules without window or audio.
+  Matches are spread over many game contexts, stepped by a pool of threads.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ai.h"
+#include "geometry.h"
+#include "input.h"
+#include "multiball.h"
+#include "pong3d.h"
+#include "replay.h"
+#include "runner.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// max speed of scripted player stick in stage units per second
+#define BOT_STICK_SPEED 1.5f
+
+// max aim error of scripted player, relative to stick width. Above 0.5 some balls are missed.
+#define BOT_MAX_AIM_ERROR 0.7f
+
+// float error allowed in ball position at contacts, in stage units
+#define CONTACT_TOLERANCE 1e-5f
+
+// a match longer than this is considered stuck
+#define MAX_MATCH_TICKS SECONDS_TO_TICKS(3600.0f)
+
+// rule violations printed for each context
+#define MAX_REPORTED_VIOLATIONS 10
+
+// ticks run by multi-ball benchmark for each kernel
+#define MULTIBALL_BENCH_TICKS 1000
+
+// printed when arguments can't be parsed
+#define SIM_USAGE \
+    "Usage: pong3d_sim [matches] [seed] [--contexts n] [--threads n] [--difficulty easy|normal|hard]\n" \
+    "                  [--multiball n] [--multiball-bench n] [--record file] [--replay file]\n"
+
+/**
+  Scripted player of a game context and its results.
+ */
+typedef struct {
+    float x, y;
+    float error_x, error_y;
+    unsigned int seed;
+    int matches;
+    int played;
+    long long ticks;
+    long long match_ticks;
+    long long player_points;
+    long long opponent_points;
+    int violations;
+    /** recorded input driving the player instead of the script, if any */
+    REPLAY* replay;
+} SIM_PLAYER;
+
+/**
+  Scripted player random numbers. Independent of game ones, so they don't change game randomness.
+ */
+static float bot_random(SIM_PLAYER* player)
+{
+    player->seed = player->seed * 1103515245u + 12345u;
+    return ((player->seed >> 8) & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+}
+
+static void push_mouse_event(GameContext* ctx, SIM_PLAYER* player, SysEventType type)
+{
+    SysEvent event;
+    event.type = type;
+    event.timestamp = 0;
+    // inverse of move_player_stick_to_mouse
+    event.x = (int)(player->x * WINDOW_WIDTH) + (WINDOW_WIDTH >> 1);
+    event.y = (int)(-player->y * WINDOW_WIDTH) + (WINDOW_HEIGHT >> 1);
+    event.prevx = 0;
+    event.prevy = 0;
+    input_push_event(&ctx->input, &event);
+}
+
+/**
+  Scripted player. Clicks to start matches and to serve, and follows the ball with limited
+  speed and an aim error chosen for each rally.
+ */
+static void bot_play(GameContext* ctx, SIM_PLAYER* player)
+{
+    float dx, dy, distance, max_step;
+
+    switch (ctx->gameState) {
+    case STARTING:
+    case FINISHED:
+    case PLAYER_SERVICE:
+        player->error_x = bot_random(player) * BOT_MAX_AIM_ERROR * ctx->player_stick.width;
+        player->error_y = bot_random(player) * BOT_MAX_AIM_ERROR * ctx->player_stick.height;
+        push_mouse_event(ctx, player, MOUSELBUTTONUP);
+        break;
+    case PLAYER_RETURN:
+    case OPP_RETURN:
+        dx = ctx->ball.x + player->error_x - player->x;
+        dy = ctx->ball.y + player->error_y - player->y;
+        distance = sqrtf(dx * dx + dy * dy);
+        max_step = BOT_STICK_SPEED * TICK_TIME;
+        if (distance > max_step) {
+            dx *= max_step / distance;
+            dy *= max_step / distance;
+        }
+        if (dx != 0.0f || dy != 0.0f) {
+            player->x += dx;
+            player->y += dy;
+            push_mouse_event(ctx, player, MOUSEMOTION);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void process_game_events(GameContext* ctx, SIM_PLAYER* player)
+{
+    for (int i = 0; i < game_events_count(ctx); i++) {
+        if (game_event(ctx, i)->type == CENTER_MOUSE) {
+            player->x = 0.0f;
+            player->y = 0.0f;
+        }
+    }
+    clear_game_events(ctx);
+}
+
+static void violation(const GameContext* ctx, SIM_PLAYER* player, int index, const char* rule)
+{
+    player->violations++;
+    if (player->violations <= MAX_REPORTED_VIOLATIONS) {
+        fprintf(stderr, "context %d, tick %lld: %s (state %d, ball %f %f %f)\n", index, player->ticks, rule,
+            ctx->gameState, ctx->ball.x, ctx->ball.y, ctx->ball.z);
+    }
+}
+
+/**
+  Checks rules that must hold after every tick. Ball contacts are solved within ticks, so ball
+  never goes past walls nor stick planes, however fast it is.
+ */
+static void check_rules(const GameContext* ctx, SIM_PLAYER* player, int index)
+{
+    const BODY* ball = &ctx->ball;
+    if (fabsf(ball->x) > ctx->stage.width2 - ball->width + CONTACT_TOLERANCE
+        || fabsf(ball->y) > ctx->stage.height2 - ball->width + CONTACT_TOLERANCE) {
+        violation(ctx, player, index, "ball out of walls");
+    }
+    if (ball->z > ctx->player_stick.z - ball->width + CONTACT_TOLERANCE
+        || ball->z < ctx->opponent_stick.z + ball->width - CONTACT_TOLERANCE) {
+        violation(ctx, player, index, "ball behind sticks");
+    }
+    if (ctx->balls < 0 || ctx->player_score + ctx->opponent_score > BALLS) {
+        violation(ctx, player, index, "score out of balls");
+    }
+}
+
+/**
+  Plays one tick of a context. Returns non zero when its matches are played.
+ */
+static int sim_step(GameContext* ctx, int index, void* data)
+{
+    SIM_PLAYER* player = (SIM_PLAYER*)data + index;
+    GAME_STATE lastState = ctx->gameState;
+    int events;
+
+    if (player->played >= player->matches || ctx->gameState == EXIT) {
+        return 1;
+    }
+    if (player->replay) {
+        events = replay_feed_tick(player->replay, ctx);
+        if (events < 0) {
+            return 1;
+        }
+    } else {
+        bot_play(ctx, player);
+        events = input_pending_events(&ctx->input);
+    }
+    game_tick(ctx, events);
+    process_game_events(ctx, player);
+    check_rules(ctx, player, index);
+    player->ticks++;
+    player->match_ticks++;
+    if (ctx->gameState == FINISHED && lastState != FINISHED) {
+        if (ctx->player_score + ctx->opponent_score != BALLS) {
+            violation(ctx, player, index, "match finished with balls left");
+        }
+        player->player_points += ctx->player_score;
+        player->opponent_points += ctx->opponent_score;
+        player->played++;
+        player->match_ticks = 0;
+    } else if (player->match_ticks > MAX_MATCH_TICKS) {
+        violation(ctx, player, index, "match stuck");
+        return 1;
+    }
+    return 0;
+}
+
+static double elapsed_seconds(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+  Times multi-ball step of every kernel supported by CPU, on one core, and checks that
+  all of them leave balls exactly as scalar kernel does. Returns number of kernels that differ.
+ */
+static int multiball_bench(int count, uint32_t seed)
+{
+    GameContext ctx;
+    BALL_SET reference;
+    BALL_SET set;
+    struct timespec start;
+    double seconds;
+    int mismatches = 0;
+
+    init_game(&ctx, seed);
+    if (multiball_create(&reference, count) < 0) {
+        fprintf(stderr, "Couldn't allocate %d balls\n", count);
+        return 1;
+    }
+    reference.kernel = MULTIBALL_SCALAR;
+    multiball_launch(&reference, &ctx, seed);
+    for (int tick = 0; tick < MULTIBALL_BENCH_TICKS; tick++) {
+        multiball_step(&reference, &ctx, TICK_TIME);
+    }
+    for (int kernel = MULTIBALL_SCALAR; kernel <= MULTIBALL_AVX2; kernel++) {
+        int same = 1;
+        if (!multiball_kernel_supported((MULTIBALL_KERNEL)kernel) || multiball_create(&set, count) < 0) {
+            continue;
+        }
+        set.kernel = (MULTIBALL_KERNEL)kernel;
+        multiball_launch(&set, &ctx, seed);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int tick = 0; tick < MULTIBALL_BENCH_TICKS; tick++) {
+            multiball_step(&set, &ctx, TICK_TIME);
+        }
+        seconds = elapsed_seconds(&start);
+        for (int i = 0; i < count; i++) {
+            if (set.x[i] != reference.x[i] || set.y[i] != reference.y[i] || set.z[i] != reference.z[i]
+                || set.vx[i] != reference.vx[i] || set.vy[i] != reference.vy[i] || set.vz[i] != reference.vz[i]) {
+                same = 0;
+                break;
+            }
+        }
+        same = same && set.returned == reference.returned && set.missed == reference.missed;
+        mismatches += !same;
+        printf("multiball %s: %d balls, %.4f ms/tick, %.2f ns/ball, returned %d, missed %d%s\n",
+            multiball_kernel_name(set.kernel), count, seconds * 1000.0 / MULTIBALL_BENCH_TICKS,
+            seconds * 1e9 / MULTIBALL_BENCH_TICKS / count, set.returned, set.missed,
+            same ? "" : " (differs from scalar)");
+        multiball_dispose(&set);
+    }
+    multiball_dispose(&reference);
+    return mismatches;
+}
+
+/**
+  Usage: pong3d_sim [matches] [seed] [--contexts n] [--threads n] [--difficulty easy|normal|hard]
+                    [--multiball n] [--multiball-bench n] [--record file] [--replay file]
+  Matches are split among contexts (1 by default), run by threads (one per core by default).
+  Context i plays with seed + i. --multiball adds n extra balls to each context, and
+  --multiball-bench only times multi-ball kernels with n balls. With --replay, recorded input
+  drives the player instead of the script, until replay ends. Recording and replay use a single context.
+  Unknown options and a match count under 1 print usage and return 2.
+ */
+int main(int argc, char** argv)
+{
+    int matches = 100;
+    int contexts = 1;
+    int multiball = 0;
+    int multiball_bench_balls = 0;
+    AI_LEVEL level = AI_NORMAL;
+    BALL_SET* ball_sets = NULL;
+    long long returned = 0, missed = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int positional = 0;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    REPLAY replay;
+    REPLAY recorder;
+    uint32_t seed = 1;
+    GameContext* games;
+    SIM_PLAYER* players;
+    GAME_RUNNER runner;
+    long long ticks = 0;
+    long long player_points = 0, opponent_points = 0;
+    int played = 0;
+    int violations = 0;
+    int replay_diverged = 0;
+    struct timespec start;
+    double seconds;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--contexts") && i + 1 < argc) {
+            contexts = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--difficulty") && i + 1 < argc) {
+            if (ai_parse_level(argv[++i], &level) < 0) {
+                fprintf(stderr, "Unknown difficulty %s\n", argv[i]);
+                return 2;
+            }
+        } else if (!strcmp(argv[i], "--multiball") && i + 1 < argc) {
+            multiball = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--multiball-bench") && i + 1 < argc) {
+            multiball_bench_balls = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--", 2)) {
+            fprintf(stderr, "Unknown option or missing value: %s\n%s", argv[i], SIM_USAGE);
+            return 2;
+        } else if (positional++ == 0) {
+            matches = atoi(argv[i]);
+        } else {
+            seed = (uint32_t)strtoul(argv[i], NULL, 10);
+        }
+    }
+    if (multiball_bench_balls > 0) {
+        return multiball_bench(multiball_bench_balls, seed) ? 1 : 0;
+    }
+    if (matches < 1) {
+        fprintf(stderr, "Invalid match count\n%s", SIM_USAGE);
+        return 2;
+    }
+    if (record_path || replay_path || contexts < 1) {
+        contexts = 1;
+    }
+    if (threads < 1 || threads > contexts) {
+        threads = threads < 1 ? 1 : contexts;
+    }
+
+    games = (GameContext*)calloc(contexts, sizeof(GameContext));
+    players = (SIM_PLAYER*)calloc(contexts, sizeof(SIM_PLAYER));
+    if (!games || !players) {
+        fprintf(stderr, "Couldn't allocate %d game contexts\n", contexts);
+        return 2;
+    }
+    for (int i = 0; i < contexts; i++) {
+        players[i].seed = seed + i;
+        players[i].matches = matches / contexts + (i < matches % contexts);
+    }
+    if (replay_path) {
+        if (replay_load(&replay, replay_path, &seed) < 0) {
+            fprintf(stderr, "Couldn't load replay file %s\n", replay_path);
+            return 2;
+        }
+        players[0].replay = &replay;
+    }
+    for (int i = 0; i < contexts; i++) {
+        init_game(&games[i], seed + i);
+        ai_set_level(&games[i], level);
+    }
+    if (multiball > 0) {
+        ball_sets = (BALL_SET*)calloc(contexts, sizeof(BALL_SET));
+        for (int i = 0; i < contexts; i++) {
+            if (!ball_sets || multiball_create(&ball_sets[i], multiball) < 0) {
+                fprintf(stderr, "Couldn't allocate %d balls for each context\n", multiball);
+                return 2;
+            }
+            multiball_launch(&ball_sets[i], &games[i], seed + i);
+            games[i].multiball = &ball_sets[i];
+        }
+    }
+    if (record_path) {
+        if (replay_start_recording(&recorder, record_path, seed) < 0) {
+            fprintf(stderr, "Couldn't create replay file %s\n", record_path);
+            return 2;
+        }
+        games[0].recorder = &recorder;
+    }
+    if (runner_create(&runner, threads) < 0) {
+        fprintf(stderr, "Couldn't start %d threads\n", threads);
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    runner_run(&runner, games, contexts, sim_step, players);
+    seconds = elapsed_seconds(&start);
+    runner_dispose(&runner);
+
+    if (record_path && replay_stop_recording(&recorder, &games[0]) < 0) {
+        fprintf(stderr, "Couldn't write replay file %s\n", record_path);
+    }
+    // a divergence counts as a violation of the replayed context
+    if (replay_path) {
+        replay_diverged = replay_verify(&replay, &games[0]) != 0;
+        if (replay_diverged) {
+            violation(&games[0], &players[0], 0, "replay diverged from recording");
+        }
+        replay_dispose(&replay);
+    }
+    for (int i = 0; i < contexts; i++) {
+        ticks += players[i].ticks;
+        played += players[i].played;
+        player_points += players[i].player_points;
+        opponent_points += players[i].opponent_points;
+        violations += players[i].violations;
+        if (ball_sets) {
+            returned += ball_sets[i].returned;
+            missed += ball_sets[i].missed;
+            multiball_dispose(&ball_sets[i]);
+        }
+    }
+    free(ball_sets);
+
+    printf("contexts: %d, threads: %d\n", contexts, threads);
+    printf("matches: %d, ticks: %lld, player points: %lld, computer points: %lld\n",
+        played, ticks, player_points, opponent_points);
+    printf("time: %.3f s, %.0f ticks/s (%.0fx real time)\n",
+        seconds, seconds > 0 ? ticks / seconds : 0.0, seconds > 0 ? ticks / seconds / TICK_RATE : 0.0);
+    if (multiball > 0) {
+        printf("multiball: %d balls per context, returned: %lld, missed: %lld\n", multiball, returned, missed);
+    }
+    if (replay_path) {
+        printf("replay: %s\n", replay_diverged ? "diverged from recording" : "matches recording");
+    }
+    printf("rule violations: %d\n", violations);
+    free(players);
+    free(games);
+    return violations ? 1 : 0;
+}
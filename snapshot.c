@@ -0,0 +1,124 @@
+/**
+  @file snapshot.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Immutable copies of match state published by simulation for the render thread.
+
+  Simulation writes a snapshot after each tick into its own slot and swaps it with the middle
+  one. Renderer swaps its slot with the middle one only when the middle one is fresh, so it
+  always draws the newest published tick and a slot is never written while it is being read.
+ */
+
+#include "snapshot.h"
+#include "atomics.h"
+#include "geometry.h"
+#include "multiball.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_SLOT_MASK 3
+#define SNAPSHOT_FRESH 4
+
+/**
+  Creates an empty buffer holding up to multiball_capacity extra balls per snapshot.
+ */
+int snapshot_buffer_create(SNAPSHOT_BUFFER* buffer, int multiball_capacity)
+{
+    memset(buffer, 0, sizeof(SNAPSHOT_BUFFER));
+    if (multiball_capacity > 0) {
+        buffer->multiball_block = (float*)malloc(sizeof(float) * 3 * 3 * multiball_capacity);
+        if (!buffer->multiball_block) {
+            return -1;
+        }
+        buffer->multiball_capacity = multiball_capacity;
+    }
+    for (int i = 0; i < 3; i++) {
+        buffer->slots[i].multiball_positions = buffer->multiball_block + i * 3 * multiball_capacity;
+    }
+    buffer->write_slot = 0;
+    buffer->middle_slot = 1;
+    buffer->read_slot = 2;
+    return 0;
+}
+
+void snapshot_buffer_dispose(SNAPSHOT_BUFFER* buffer)
+{
+    free(buffer->multiball_block);
+    buffer->multiball_block = NULL;
+}
+
+/**
+  Copies state of a match after a tick that simulated until time and makes it the newest snapshot.
+  Only one thread may publish.
+ */
+void snapshot_publish(SNAPSHOT_BUFFER* buffer, const GameContext* ctx, uint64_t time)
+{
+    GAME_SNAPSHOT* snapshot = &buffer->slots[buffer->write_slot];
+    const BALL_SET* set = ctx->multiball;
+
+    snapshot->state = ctx->gameState;
+    snapshot->time = time;
+    memcpy(snapshot->ball_prev_position, ctx->ball_prev_position, sizeof(float) * 3);
+    snapshot->ball_position[0] = ctx->ball.x;
+    snapshot->ball_position[1] = ctx->ball.y;
+    snapshot->ball_position[2] = ctx->ball.z;
+    memcpy(snapshot->opponent_stick_prev_position, ctx->opponent_stick_prev_position, sizeof(float) * 3);
+    snapshot->opponent_stick_position[0] = ctx->opponent_stick.x;
+    snapshot->opponent_stick_position[1] = ctx->opponent_stick.y;
+    snapshot->opponent_stick_position[2] = ctx->opponent_stick.z;
+    snapshot->player_stick_position[0] = ctx->player_stick.x;
+    snapshot->player_stick_position[1] = ctx->player_stick.y;
+    snapshot->player_stick_position[2] = ctx->player_stick.z;
+    snapshot->balls = ctx->balls;
+    snapshot->player_score = ctx->player_score;
+    snapshot->opponent_score = ctx->opponent_score;
+    snapshot->overlay_fadeout_alpha = ctx->overlay_fadeout_alpha;
+    snapshot->multiball_count = 0;
+    if (set) {
+        snapshot->multiball_count = set->count < buffer->multiball_capacity ? set->count : buffer->multiball_capacity;
+        for (int i = 0; i < snapshot->multiball_count; i++) {
+            snapshot->multiball_positions[i * 3] = set->x[i];
+            snapshot->multiball_positions[i * 3 + 1] = set->y[i];
+            snapshot->multiball_positions[i * 3 + 2] = set->z[i];
+        }
+    }
+    buffer->write_slot = atomic_exchange(&buffer->middle_slot, buffer->write_slot | SNAPSHOT_FRESH) & SNAPSHOT_SLOT_MASK;
+}
+
+/**
+  Newest published snapshot. It stays valid and unchanged until next call. Only one thread may acquire.
+ */
+const GAME_SNAPSHOT* snapshot_acquire(SNAPSHOT_BUFFER* buffer)
+{
+    if (atomic_load_acquire(&buffer->middle_slot) & SNAPSHOT_FRESH) {
+        buffer->read_slot = atomic_exchange(&buffer->middle_slot, buffer->read_slot) & SNAPSHOT_SLOT_MASK;
+    }
+    return &buffer->slots[buffer->read_slot];
+}
+
+/**
+  Fraction of tick to interpolate when drawing a snapshot at time now. Drawing lags simulation
+  by a tick, so previous and current positions of the snapshot cover the time drawn.
+ */
+float snapshot_alpha(const GAME_SNAPSHOT* snapshot, uint64_t now, uint64_t tick_period)
+{
+    if (now <= snapshot->time) {
+        return 0.0f;
+    }
+    if (now - snapshot->time >= tick_period) {
+        return 1.0f;
+    }
+    return (float)(now - snapshot->time) / tick_period;
+}
+
+/**
+  Places meshes where bodies of snapshot are, between its previous and current tick.
+  alpha is the elapsed fraction of current tick (0 previous tick, 1 current tick).
+  Player stick follows the mouse, so it is drawn at its latest position.
+ */
+void place_snapshot_elements(const GAME_SNAPSHOT* snapshot, float alpha)
+{
+    place_element(&ball, snapshot->ball_prev_position, snapshot->ball_position, alpha);
+    place_element(&opponent_stick, snapshot->opponent_stick_prev_position, snapshot->opponent_stick_position, alpha);
+    place_element(&player_stick, snapshot->player_stick_position, snapshot->player_stick_position, 1.0f);
+}
@@ -0,0 +1,57 @@
+/**
+  @file snapshot.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Immutable copies of match state published by simulation for the render thread.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "pong3d.h"
+#include <stdint.h>
+
+/**
+  @brief What renderer needs of a match after a tick: screen, body positions and HUD values.
+ */
+typedef struct {
+    GAME_STATE state;
+    /** time simulated by the tick, in nanoseconds of sys_get_time_ns clock */
+    uint64_t time;
+    float ball_prev_position[3];
+    float ball_position[3];
+    float opponent_stick_prev_position[3];
+    float opponent_stick_position[3];
+    float player_stick_position[3];
+    int balls;
+    int player_score;
+    int opponent_score;
+    float overlay_fadeout_alpha;
+    /** positions (x, y, z) of extra balls of multi-ball mode */
+    int multiball_count;
+    float* multiball_positions;
+} GAME_SNAPSHOT;
+
+/**
+  @brief Lock-free triple buffer of snapshots between one writer and one reader thread.
+  Writer and reader each own a slot; the third one is exchanged atomically, with a flag telling
+  whether it holds a snapshot newer than the reader's. Neither side ever waits for the other.
+ */
+typedef struct {
+    GAME_SNAPSHOT slots[3];
+    int write_slot;
+    int read_slot;
+    /** slot between writer and reader, plus SNAPSHOT_FRESH if reader hasn't taken it */
+    volatile int middle_slot;
+    int multiball_capacity;
+    float* multiball_block;
+} SNAPSHOT_BUFFER;
+
+int snapshot_buffer_create(SNAPSHOT_BUFFER* buffer, int multiball_capacity);
+void snapshot_buffer_dispose(SNAPSHOT_BUFFER* buffer);
+void snapshot_publish(SNAPSHOT_BUFFER* buffer, const GameContext* ctx, uint64_t time);
+const GAME_SNAPSHOT* snapshot_acquire(SNAPSHOT_BUFFER* buffer);
+float snapshot_alpha(const GAME_SNAPSHOT* snapshot, uint64_t now, uint64_t tick_period);
+void place_snapshot_elements(const GAME_SNAPSHOT* snapshot, float alpha);
+
+#endif
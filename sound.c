@@ -5,136 +5,269 @@
 	@brief Generation of game sounds.
 */
 
-#include <SDL.h>
 #include "sound.h"
+#include "mixer.h"
+#include "clip.h"
 #include "msys.h"
+#include "patches.h"
+#include "reverb.h"
 #include "synth.h"
+#include "wav.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
-sample_t* player_pong_sound;
-int player_pong_sound_samples;
+// how far hit sounds move to the sides, from 0 (center) to 1 (one channel only)
+#define HIT_PAN_WIDTH 0.8f
 
-sample_t* opponent_pong_sound;
-int opponent_pong_sound_samples;
+// gain of reverb, whose impulse response has unit energy
+#define REVERB_WET 0.15f
 
-sample_t* player_score_sound;
-int player_score_sound_samples;
+// seed of generated impulse responses
+#define REVERB_SEED 1977
 
-sample_t* opp_score_sound;
-int opp_score_sound_samples;
+// gain of background music
+#define MUSIC_GAIN 0.35f
 
-sample_t* wall_hit_sound;
-int wall_hit_sound_samples;
+// time added to the delay of sounds of events, for late game ticks and callbacks, in nanoseconds
+#define SCHEDULE_MARGIN_NS 2000000ULL
 
-sample_t* start_sound;
-int start_sound_samples;
+// format rendered sounds are stored in, unless it keeps less than CLIP_MIN_SNR of them
+#define CLIP_STORAGE CLIP_ADPCM
 
-int init_sound(int sample_freq)
+// in the order of clip_patches
+typedef enum {
+    START_CLIP,
+    PLAYER_WINS_CLIP,
+    OPPONENT_WINS_CLIP,
+    CLIPS_COUNT = CLIP_PATCHES_COUNT
+} CLIP_ID;
+
+// rendered sounds, all owned here
+static SOUND_CLIP clips[CLIPS_COUNT];
+static SoundAsset assets[CLIPS_COUNT];
+
+// mixer fed by game thread and run by audio device
+static MIXER mixer;
+static SysAudioFormat audio_format;
+static REVERB reverb;
+static int reverb_ready = 0;
+static SEQUENCER music;
+
+static void mix_audio(void* data, float* out, int frames)
+{
+    mixer_render((MIXER*)data, out, frames);
+}
+
+/**
+  Opens audio device with a buffer of about buffer_frames samples and renders clips at the sample
+  rate the device works at, stored as CLIP_STORAGE or, for those it would spoil, as 16 bit PCM.
+  Hit sounds are synthetized as they play instead.
+ */
+int init_sound(int sample_freq, int buffer_frames)
 {
+    sample_t* samples;
+    int length;
 
-    if (sys_init_sound(sample_freq) < 0) {
+    mixer_init(&mixer, sys_get_time_ns);
+    // mixer plays nothing until sounds are ready
+    if (sys_init_sound(sample_freq, buffer_frames, mix_audio, &mixer, &audio_format) < 0) {
         return -1;
     }
-    SYNTH synthParams;
-
-    synthParams.totalTime = 0.1f;
-    synthParams.volume = 1.0f;
-    synthParams.attackTime = 0.0f;
-    synthParams.decayTime = 0.05f;
-    synthParams.releaseTime = 0.05f;
-    synthParams.decayValue = 0.3f;
-    synthParams.filterBeta1 = 0.2f;
-    synthParams.filterBeta2 = 0.3f;
-    synthParams.oscillator1_type = TRIANGLE;
-    synthParams.oscillator2_type = NONE;
-    synthParams.oscillator1_freq = 700.0f;
-    synthParams.delayTime = 0.5f;
-    synthParams.reverbSize = 0.1f;
-    player_pong_sound_samples = synthetize(&synthParams, &player_pong_sound, sample_freq);
-
-    synthParams.oscillator1_freq = 350.0f;
-    synthParams.oscillator2_freq = 350.0f;
-    opponent_pong_sound_samples = synthetize(&synthParams, &opponent_pong_sound, sample_freq);
-
-    synthParams.oscillator1_freq = 500.0f;
-    synthParams.oscillator2_freq = 500.0f;
-    start_sound_samples = synthetize(&synthParams, &start_sound, sample_freq);
-
-    synthParams.totalTime = 0.05f;
-    synthParams.volume = 0.7f;
-    synthParams.attackTime = 0.01f;
-    synthParams.decayTime = 0.03f;
-    synthParams.releaseTime = 0.01f;
-    synthParams.decayValue = 0.7f;
-    synthParams.filterBeta1 = 0.6f;
-    synthParams.filterBeta2 = 0.4f;
-    synthParams.oscillator1_type = SIN;
-    synthParams.oscillator2_type = SIN;
-    synthParams.oscillator1_freq = 200.0f;
-    synthParams.oscillator2_freq = 400.0f;
-    synthParams.delayTime = 0.0f;
-    synthParams.reverbSize = 0.0f;
-    wall_hit_sound_samples = synthetize(&synthParams, &wall_hit_sound, sample_freq);
-
-    synthParams.totalTime = 1.0f;
-    synthParams.volume = 1.0f;
-    synthParams.attackTime = 0.2f;
-    synthParams.decayTime = 0.8f;
-    synthParams.releaseTime = 0.4f;
-    synthParams.decayValue = 0.1f;
-    synthParams.filterBeta1 = 0.4f;
-    synthParams.filterBeta2 = 0.4f;
-    synthParams.oscillator1_type = SIN;
-    synthParams.oscillator2_type = COS;
-    synthParams.oscillator1_freq = 1046.50f;
-    synthParams.oscillator2_freq = 2.0f;
-    synthParams.delayTime = 0.0f;
-    synthParams.reverbSize = 0.0f;
-    player_score_sound_samples = synthetize(&synthParams, &player_score_sound, sample_freq);
-
-    synthParams.totalTime = 0.6f;
-    synthParams.volume = 1.0f;
-    synthParams.attackTime = 0.01f;
-    synthParams.decayTime = 0.3f;
-    synthParams.releaseTime = 0.3f;
-    synthParams.oscillator1_freq = 323.5f;
-    synthParams.oscillator2_freq = 30.0f;
-    opp_score_sound_samples = synthetize(&synthParams, &opp_score_sound, sample_freq);
+    sample_freq = audio_format.sample_rate;
+    // sounds of events in a tick are played once it ends, and wait at most a buffer for the callback
+    mixer_set_schedule(&mixer, sample_freq, 1000000000ULL / TICK_RATE
+        + (uint64_t)audio_format.buffer_frames * 1000000000ULL / sample_freq + SCHEDULE_MARGIN_NS);
+
+    for (int c = 0; c < CLIPS_COUNT; c++) {
+        length = synthetize(&sound_patches[clip_patches[c]], &samples, sample_freq);
+        // a clip that couldn't be stored is left without data, and isn't played
+        clip_encode_min_snr(&clips[c], samples, length, CLIP_STORAGE, CLIP_MIN_SNR, &assets[c].snr);
+        free_samples(samples);
+        assets[c].name = sound_patch_names[clip_patches[c]];
+        assets[c].format = clip_format_name(clips[c].format);
+        assets[c].rejected = clips[c].format != CLIP_STORAGE ? clip_format_name(CLIP_STORAGE) : NULL;
+        assets[c].samples = clips[c].length;
+        assets[c].bytes = clips[c].bytes;
+        assets[c].float_bytes = length * (int)sizeof(sample_t);
+    }
 
     return 0;
 }
 
-void play_start_sound()
+/**
+  Plays a patch synthetized live, shaped by the ball at the hit: faster balls sound higher, up to
+  an octave, ball position sets pan and hits far from stick center sound softer. Patch delay is
+  left out, hit patches end before it. Sounds start a fixed delay after time, the sys_get_time_ns
+  time of their event, so they keep the spacing of the hits.
+ */
+static void play_hit_sound(PATCH_ID patch, const GAME_EVENT* event, uint64_t time)
 {
-    sys_play_sound(start_sound, start_sound_samples * sizeof(sample_t));
+    SYNTH_VOICE voice;
+    float pitch = sqrtf(event->speed);
+
+    if (!audio_format.sample_rate) {
+        return;
+    }
+    pitch = pitch < 0.5f ? 0.5f : (pitch > 2.0f ? 2.0f : pitch);
+    synth_voice_start(&voice, &sound_patches[patch], audio_format.sample_rate);
+    synth_voice_transpose(&voice, pitch);
+    mixer_play_synth(&mixer, &voice, 1.0f - 0.5f * event->offset, event->position * HIT_PAN_WIDTH, time);
 }
-void play_player_pong_sound()
+
+static void play_clip(CLIP_ID clip, uint64_t time)
 {
-    sys_play_sound(player_pong_sound, player_pong_sound_samples * sizeof(sample_t));
+    if (clips[clip].data) {
+        mixer_play(&mixer, &clips[clip], 1.0f, time);
+    }
 }
-void play_opponent_pong_sound()
+
+void play_start_sound(uint64_t time)
 {
-    sys_play_sound(opponent_pong_sound, opponent_pong_sound_samples * sizeof(sample_t));
+    play_clip(START_CLIP, time);
+}
+void play_player_pong_sound(const GAME_EVENT* event, uint64_t time)
+{
+    play_hit_sound(PLAYER_PONG_PATCH, event, time);
+}
+void play_opponent_pong_sound(const GAME_EVENT* event, uint64_t time)
+{
+    play_hit_sound(OPPONENT_PONG_PATCH, event, time);
 }
 
-void play_player_wins_sound()
+void play_player_wins_sound(uint64_t time)
 {
-    sys_play_sound(player_score_sound, player_score_sound_samples * sizeof(sample_t));
+    play_clip(PLAYER_WINS_CLIP, time);
 }
 
-void play_opponent_wins_sound()
+void play_opponent_wins_sound(uint64_t time)
 {
-    sys_play_sound(opp_score_sound, opp_score_sound_samples * sizeof(sample_t));
+    play_clip(OPPONENT_WINS_CLIP, time);
 }
-void play_wall_hit_sound()
+void play_wall_hit_sound(const GAME_EVENT* event, uint64_t time)
+{
+    play_hit_sound(WALL_HIT_PATCH, event, time);
+}
+
+/**
+  Resamples length samples from rate to sample_rate by linear interpolation. Returns new samples,
+  allocated, and their count in length, or NULL if they couldn't be allocated.
+ */
+static float* resample(const float* samples, int* length, int rate, int sample_rate)
 {
-    sys_play_sound(wall_hit_sound, wall_hit_sound_samples * sizeof(sample_t));
+    int count = (int)((double)*length * sample_rate / rate);
+    float* resampled = (float*)malloc(sizeof(float) * (count > 0 ? count : 1));
+
+    if (!resampled) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        double position = (double)i * rate / sample_rate;
+        int index = (int)position;
+        float fraction = (float)(position - index);
+        float next = index + 1 < *length ? samples[index + 1] : 0.0f;
+        resampled[i] = samples[index] + (next - samples[index]) * fraction;
+    }
+    *length = count;
+    return resampled;
+}
+
+/**
+  Adds a convolution reverb to the mixed sounds. spec is "off", the reverb time in seconds of a
+  generated room or a WAV file with an impulse response. Call it once, after init_sound succeeds.
+  Returns -1 if impulse response couldn't be loaded.
+ */
+int set_sound_reverb(const char* spec)
+{
+    float* impulse_response = NULL;
+    int length = 0;
+    int rate = audio_format.sample_rate;
+    int result;
+
+    if (!spec || !strcmp(spec, "off") || !audio_format.sample_rate) {
+        return 0;
+    }
+    if (atof(spec) > 0.0 && !strstr(spec, ".wav")) {
+        length = (int)(atof(spec) * audio_format.sample_rate);
+        impulse_response = (float*)malloc(sizeof(float) * length);
+        if (!impulse_response) {
+            return -1;
+        }
+        reverb_generate_ir(impulse_response, length, REVERB_SEED);
+    } else if (wav_load(spec, &impulse_response, &length, &rate) < 0) {
+        return -1;
+    }
+    if (rate != audio_format.sample_rate) {
+        float* resampled = resample(impulse_response, &length, rate, audio_format.sample_rate);
+        free(impulse_response);
+        if (!resampled) {
+            return -1;
+        }
+        impulse_response = resampled;
+    }
+    result = reverb_create(&reverb, impulse_response, length, REVERB_WET);
+    free(impulse_response);
+    if (result < 0) {
+        return -1;
+    }
+    reverb_ready = 1;
+    mixer_set_reverb(&mixer, &reverb);
+    return 0;
+}
+
+/**
+  Starts background music, played in loop. Call it once, after init_sound succeeds.
+ */
+void play_music()
+{
+    if (!audio_format.sample_rate) {
+        return;
+    }
+    sequencer_init(&music, &background_song, audio_format.sample_rate, MUSIC_GAIN);
+    mixer_set_music(&mixer, &music);
+}
+
+/**
+  Sets tempo of music relative to song one, from 1 up to MUSIC_MAX_SPEED.
+ */
+void set_music_speed(float speed)
+{
+    sequencer_set_speed(&music, speed);
 }
 
 void dispose_sound()
 {
-    free_samples(player_pong_sound);
-    free_samples(opponent_pong_sound);
-    free_samples(player_score_sound);
-    free_samples(opp_score_sound);
-    free_samples(wall_hit_sound);
+    // stop audio thread before its voices lose their clips
+    sys_dispose_audio();
+    for (int c = 0; c < CLIPS_COUNT; c++) {
+        clip_dispose(&clips[c]);
+    }
+    if (reverb_ready) {
+        reverb_dispose(&reverb);
+        reverb_ready = 0;
+    }
+}
+
+/**
+  Format of audio device and latency of sounds played. Call it once sound is disposed.
+ */
+void sound_stats(SoundStats* stats)
+{
+    stats->sample_rate = audio_format.sample_rate;
+    stats->channels = audio_format.channels;
+    stats->buffer_frames = audio_format.buffer_frames;
+    mixer_latency_stats(&mixer, &stats->latency);
+    mixer_synth_stats(&mixer, &stats->synth);
+    stats->voice_load = stats->synth.frame_ns * audio_format.sample_rate / 1e7;
+    mixer_music_stats(&mixer, &stats->music);
+    stats->music_load = stats->music.frame_ns * audio_format.sample_rate / 1e7;
+}
+
+/**
+  Memory each rendered sound takes, compared to float samples. Returns count of sounds reported.
+ */
+int sound_assets(const SoundAsset** report)
+{
+    *report = assets;
+    return audio_format.sample_rate ? CLIPS_COUNT : 0;
 }
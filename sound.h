@@ -8,12 +8,51 @@
 #ifndef _SOUND_H_
 #define _SOUND_H_
 
-int init_sound(int sample_freq);
-void play_start_sound();
-void play_player_pong_sound();
-void play_opponent_pong_sound();
-void play_player_wins_sound();
-void play_opponent_wins_sound();
+#include "mixer.h"
+#include "pong3d.h"
+
+/**
+  Audio device format and delay from the events of play_*_sound calls until their first sample is
+  handed to device, and sounds played later than their event allowed. Device adds up to buffer_frames
+  samples more until the sample is heard. voice_load is the share of
+  one core a voice synthetized while it plays takes, in percent, and music_load the share music takes.
+ */
+typedef struct {
+    int sample_rate;
+    int channels;
+    int buffer_frames;
+    MIXER_LATENCY_STATS latency;
+    MIXER_SYNTH_STATS synth;
+    double voice_load;
+    MIXER_SYNTH_STATS music;
+    double music_load;
+} SoundStats;
+
+/**
+  Memory a rendered sound takes stored in format, and as float samples. rejected is the preferred
+  format, if it kept less than CLIP_MIN_SNR of the sound, or NULL.
+ */
+typedef struct {
+    const char* name;
+    const char* format;
+    const char* rejected;
+    int samples;
+    int bytes;
+    int float_bytes;
+    double snr;
+} SoundAsset;
+
+int init_sound(int sample_freq, int buffer_frames);
+int set_sound_reverb(const char* spec);
+void play_music();
+void set_music_speed(float speed);
+void play_start_sound(uint64_t time);
+void play_player_pong_sound(const GAME_EVENT* event, uint64_t time);
+void play_opponent_pong_sound(const GAME_EVENT* event, uint64_t time);
+void play_player_wins_sound(uint64_t time);
+void play_opponent_wins_sound(uint64_t time);
 void dispose_sound();
-void play_wall_hit_sound();
+void play_wall_hit_sound(const GAME_EVENT* event, uint64_t time);
+void sound_stats(SoundStats* stats);
+int sound_assets(const SoundAsset** report);
 #endif
@@ -2,128 +2,1129 @@
   @file synth.c
   @author Alejandro Ambroa
   @date 1 Oct 2017
-  @brief Simple software synthetizer based on book "BasicSynth" by Daniel Mitchell. 
+  @brief Simple software synthetizer based on book "BasicSynth" by Daniel Mitchell.
+
+  Voices render blocks of up to SYNTH_BLOCK samples. Oscillator phases of a block are computed
+  from its start phase, sine is a polynomial, the one-pole filter runs 4 samples at once as a
+  small matrix product and the amplitude envelope is a list of linear segments, so inner loops
+  have no branches and use SSE when available. Voices sharing oscillator types can also render
+  together, one in each SSE lane, where the filter runs 4 steps at once with no shuffles and
+  triangle and saw oscillators use fixed point phases. Voices made only of sines and cosines skip
+  the filter: their output is a sum of sinusoids, rendered by rotating sequences of samples, with
+  AVX2 when the CPU supports it.
  */
 
+#include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include "synth.h"
 #include "math_constants.h"
 
-float oscillator(OSCILLATOR_TYPE type, float* ang, float incr)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SYNTH_HAVE_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(SYNTH_HAVE_SSE) && (defined(__GNUC__) || defined(__AVX2__))
+#define SYNTH_HAVE_AVX2
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_FUNCTION __attribute__((target("avx2,fma")))
+#else
+#define AVX2_FUNCTION
+#endif
+#endif
+
+#define SYNTH_PI 3.14159265f
+#define SYNTH_HALF_PI 1.57079633f
+#define SYNTH_INV_2PI 0.159154943f
+
+// Taylor series of sine up to x^11, error below 1e-7 in [-pi/2, pi/2]
+#define SIN_C3 -1.66666667e-1f
+#define SIN_C5 8.33333333e-3f
+#define SIN_C7 -1.98412698e-4f
+#define SIN_C9 2.75573192e-6f
+#define SIN_C11 -2.50521084e-8f
+
+// transient of a voice made of sinusoids is dropped once under this
+#define SYNTH_TRANSIENT_MIN 1e-7f
+
+/**
+  Builds amplitude envelope. Segments reproduce the original per sample state machine, where
+  attack fell through into decay: steps of attack cancel out, so volume holds for half the
+  attack time, and an odd attack length skips decay, releasing from one attack step above volume.
+ */
+static void setup_envelope(SYNTH_VOICE* voice, const SYNTH* synthParams, int sample_freq)
+{
+    ENVELOPE_SEGMENT* segment = voice->segments;
+    float volume = synthParams->volume;
+    float slope;
+    int attackTimeSamples = (int)(synthParams->attackTime * (float)sample_freq);
+    int decayTimeSamples = (int)(synthParams->decayTime * (float)sample_freq);
+    int releaseTimeSamples = (int)(synthParams->releaseTime * (float)sample_freq);
+
+    segment->length = attackTimeSamples / 2;
+    segment->start = volume;
+    segment->step = 0.0f;
+    segment++;
+    if (attackTimeSamples % 2) {
+        volume += volume / (float)attackTimeSamples;
+    } else if (decayTimeSamples > 0) {
+        slope = (volume - synthParams->decayValue) / (float)decayTimeSamples;
+        segment->length = decayTimeSamples;
+        segment->start = volume - slope;
+        segment->step = -slope;
+        segment++;
+        volume -= slope * decayTimeSamples;
+    }
+    // sample where release starts keeps volume
+    segment->length = 1;
+    segment->start = volume;
+    segment->step = 0.0f;
+    segment++;
+    if (releaseTimeSamples > 0) {
+        slope = volume / (float)releaseTimeSamples;
+        segment->length = releaseTimeSamples;
+        segment->start = volume - slope;
+        segment->step = -slope;
+        segment++;
+    }
+    segment->length = INT_MAX;
+    segment->start = 0.0f;
+    segment->step = 0.0f;
+    voice->segment = 0;
+    voice->segment_position = 0;
+}
+
+/**
+  Precomputes one-pole filter y[n] = beta1 * x[n] + beta2 * y[n - 1] unrolled for 4 samples.
+ */
+static void setup_filter(SYNTH_VOICE* voice, float beta1, float beta2)
+{
+    float power = 1.0f;
+    float powers[4];
+    for (int k = 0; k < 4; k++) {
+        powers[k] = power;
+        power *= beta2;
+        voice->filter_feedback[k] = power;
+    }
+    for (int j = 0; j < 4; j++) {
+        for (int k = 0; k < 4; k++) {
+            voice->filter_columns[j][k] = k >= j ? beta1 * powers[k - j] : 0.0f;
+        }
+    }
+    voice->filter_state = 0.0f;
+}
+
+/**
+  Splits output of a voice made of sine and cosine oscillators into sinusoids: a product of two
+  is the sum of two sinusoids, and the one-pole filter scales and shifts each one by its response
+  at their frequency, so filter output doesn't depend on previous samples. The filter starting
+  from silence adds a transient. Other voices are left with no sinusoids.
+ */
+static void setup_sinusoids(SYNTH_VOICE* voice)
+{
+    static const double quarter_sines[4] = { 0.0, 1.0, 0.0, -1.0 };
+    double beta1 = voice->filter_columns[0][0];
+    double beta2 = voice->filter_feedback[0];
+    int quarters1 = voice->oscillator1_type == COS;
+    int quarters2 = voice->oscillator2_type == COS;
+    int quarters[SYNTH_SINUSOIDS];
+    float incrs[SYNTH_SINUSOIDS];
+    double amplitude = 1.0;
+
+    voice->sinusoids = 0;
+    voice->sinusoid_phasors_valid = 0;
+    voice->transient = 0.0f;
+    // sinusoids a voice doesn't have render as silence
+    memset(voice->sinusoid_gains, 0, sizeof(voice->sinusoid_gains));
+    memset(voice->sinusoid_signs, 0, sizeof(voice->sinusoid_signs));
+    memset(voice->sinusoid_offsets, 0, sizeof(voice->sinusoid_offsets));
+    memset(voice->sinusoid_sines, 0, sizeof(voice->sinusoid_sines));
+    memset(voice->sinusoid_cosines, 0, sizeof(voice->sinusoid_cosines));
+    memset(voice->sinusoid_rotations, 0, sizeof(voice->sinusoid_rotations));
+    if ((voice->oscillator1_type != SIN && voice->oscillator1_type != COS)
+        || (voice->oscillator2_type != NONE && voice->oscillator2_type != SIN && voice->oscillator2_type != COS)) {
+        return;
+    }
+    if (voice->oscillator2_type == NONE) {
+        voice->sinusoids = 1;
+        voice->sinusoid_signs[0] = 0.0f;
+        quarters[0] = quarters1;
+        incrs[0] = voice->phase_incr1;
+    } else {
+        // sin(a) * sin(b) = (sin(a - b + pi / 2) + sin(a + b - pi / 2)) / 2
+        voice->sinusoids = 2;
+        amplitude = 0.5;
+        voice->sinusoid_signs[0] = -1.0f;
+        quarters[0] = quarters1 - quarters2 + 1;
+        incrs[0] = voice->phase_incr1 - voice->phase_incr2;
+        voice->sinusoid_signs[1] = 1.0f;
+        quarters[1] = quarters1 + quarters2 - 1;
+        incrs[1] = voice->phase_incr1 + voice->phase_incr2;
+    }
+    for (int c = 0; c < voice->sinusoids; c++) {
+        double incr = incrs[c];
+        double step_sin = sin(incr), step_cos = cos(incr), sine, cosine;
+        // response of y[n] = beta1 * x[n] + beta2 * y[n - 1] is beta1 / (1 - beta2 * e^(-i * incr)),
+        // as a complex gain, whose parts scale sin and cos of phase
+        double real = 1.0 - beta2 * step_cos;
+        double imaginary = beta2 * step_sin;
+        double scale = amplitude * beta1 / (real * real + imaginary * imaginary);
+        double gain_cos = scale * real, gain_sin = -scale * imaginary;
+        // sin and cos of offset, a whole number of quarter turns, one sample before first
+        double offset_sin = quarter_sines[(quarters[c] + 4) % 4], offset_cos = quarter_sines[(quarters[c] + 5) % 4];
+        double before_sin = offset_sin * step_cos - offset_cos * step_sin;
+        double before_cos = offset_cos * step_cos + offset_sin * step_sin;
+
+        voice->sinusoid_offsets[c] = quarters[c] * SYNTH_HALF_PI;
+        voice->sinusoid_gains[c][0] = (float)gain_sin;
+        voice->sinusoid_gains[c][1] = (float)gain_cos;
+        // output before first sample is silence, the sinusoids minus the transient
+        voice->transient -= (float)(gain_cos * before_sin + gain_sin * before_cos);
+        // tables by rotating in double, whose error stays far below float
+        sine = 0.0;
+        cosine = 1.0;
+        for (int k = 0; k < SYNTH_SINUSOID_STEPS; k++) {
+            double next = sine * step_cos + cosine * step_sin;
+            voice->sinusoid_sines[c][k] = (float)sine;
+            voice->sinusoid_cosines[c][k] = (float)cosine;
+            cosine = cosine * step_cos - sine * step_sin;
+            sine = next;
+        }
+        voice->sinusoid_rotations[c][0] = (float)sine;
+        voice->sinusoid_rotations[c][1] = (float)cosine;
+    }
+}
+
+/**
+  Phase of sinusoid c of a voice at its next sample.
+ */
+static float sinusoid_phase(const SYNTH_VOICE* voice, int c)
+{
+    return voice->phase1 + voice->sinusoid_signs[c] * voice->phase2 + voice->sinusoid_offsets[c];
+}
+
+/**
+  Phase, which only goes up, moved back into a turn. fmodf would take most of the time of a block
+  of a voice made of sinusoids.
+ */
+static float wrap_phase(float phase)
+{
+    return phase - (float)(int)(phase * SYNTH_INV_2PI) * P_2PI;
+}
+
+void synth_voice_start(SYNTH_VOICE* voice, const SYNTH* synthParams, int sample_freq)
+{
+    voice->oscillator1_type = synthParams->oscillator1_type;
+    voice->oscillator2_type = synthParams->oscillator2_type;
+    voice->phase1 = 0.0f;
+    voice->phase2 = 0.0f;
+    voice->phase_incr1 = (P_2PI / (float)sample_freq) * synthParams->oscillator1_freq;
+    voice->phase_incr2 = (P_2PI / (float)sample_freq) * synthParams->oscillator2_freq;
+    setup_filter(voice, synthParams->filterBeta1, synthParams->filterBeta2);
+    setup_sinusoids(voice);
+    setup_envelope(voice, synthParams, sample_freq);
+    voice->position = 0;
+    voice->length = synth_length(synthParams, sample_freq);
+}
+
+/**
+  Multiplies frequencies of both oscillators by ratio. Call it before rendering.
+ */
+void synth_voice_transpose(SYNTH_VOICE* voice, float ratio)
+{
+    voice->phase_incr1 *= ratio;
+    voice->phase_incr2 *= ratio;
+    setup_sinusoids(voice);
+}
+
+#ifdef SYNTH_HAVE_SSE
+
+static __m128 floor_sse(__m128 x)
+{
+    __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+// angle moved into [-pi, pi)
+static __m128 wrap_sse(__m128 angle)
+{
+    __m128 turns = floor_sse(_mm_mul_ps(_mm_add_ps(angle, _mm_set1_ps(SYNTH_PI)), _mm_set1_ps(SYNTH_INV_2PI)));
+    return _mm_sub_ps(angle, _mm_mul_ps(turns, _mm_set1_ps(P_2PI)));
+}
+
+// sine of an angle in [-pi, pi]
+static __m128 sin_sse(__m128 x)
 {
-    double value = 0.0;
+    __m128 x2;
+    __m128 result;
+    // fold into [-pi/2, pi/2]: sin(x) = sin(pi - x) = sin(-pi - x)
+    x = _mm_min_ps(x, _mm_sub_ps(_mm_set1_ps(SYNTH_PI), x));
+    x = _mm_max_ps(x, _mm_sub_ps(_mm_set1_ps(-SYNTH_PI), x));
+    x2 = _mm_mul_ps(x, x);
+    result = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_C11), x2), _mm_set1_ps(SIN_C9));
+    result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(SIN_C7));
+    result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(SIN_C5));
+    result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(SIN_C3));
+    result = _mm_add_ps(_mm_mul_ps(result, x2), _mm_set1_ps(1.0f));
+    return _mm_mul_ps(result, x);
+}
+
+static __m128 triangle_sse(__m128 angle)
+{
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    return _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_and_ps(wrap_sse(angle), abs_mask), _mm_set1_ps((float)M_PI_2)));
+}
+
+// angle moved into [0, 2pi)
+static __m128 turn_sse(__m128 angle)
+{
+    return _mm_sub_ps(angle, _mm_mul_ps(floor_sse(_mm_mul_ps(angle, _mm_set1_ps(SYNTH_INV_2PI))), _mm_set1_ps(P_2PI)));
+}
+
+static __m128 saw_sse(__m128 angle)
+{
+    return _mm_sub_ps(_mm_mul_ps(turn_sse(angle), _mm_set1_ps(1.0f / SYNTH_PI)), _mm_set1_ps(1.0f));
+}
+
+// rotates a sine and its cosine by the angle of rotation_sin and rotation_cos
+#define ROTATE_STEP(sine, cosine)                                                                    \
+    do {                                                                                             \
+        __m128 next = _mm_add_ps(_mm_mul_ps(sine, rotation_cos), _mm_mul_ps(cosine, rotation_sin)); \
+        cosine = _mm_sub_ps(_mm_mul_ps(cosine, rotation_cos), _mm_mul_ps(sine, rotation_sin));      \
+        sine = next;                                                                                 \
+    } while (0)
+
+/**
+  Renders count samples of sin(phase + i * incr), count is a multiple of 4. Sine polynomial only
+  gives the first 8 samples, next ones rotate them by 8 increments, which is 6 products per 4
+  samples. Error builds up over the block but is small as every block starts again from its phase.
+ */
+static void sine_block(float phase, float incr, float* out, int count)
+{
+    __m128 first = _mm_add_ps(_mm_set1_ps(phase), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(incr)));
+    __m128 second = _mm_add_ps(first, _mm_set1_ps(4.0f * incr));
+    __m128 half_pi = _mm_set1_ps(SYNTH_HALF_PI);
+    __m128 sin1 = sin_sse(wrap_sse(first));
+    __m128 cos1 = sin_sse(wrap_sse(_mm_add_ps(first, half_pi)));
+    __m128 sin2 = sin_sse(wrap_sse(second));
+    __m128 cos2 = sin_sse(wrap_sse(_mm_add_ps(second, half_pi)));
+    __m128 rotation = sin_sse(wrap_sse(_mm_set_ps(0.0f, 0.0f, 8.0f * incr + SYNTH_HALF_PI, 8.0f * incr)));
+    __m128 rotation_sin = _mm_shuffle_ps(rotation, rotation, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 rotation_cos = _mm_shuffle_ps(rotation, rotation, _MM_SHUFFLE(1, 1, 1, 1));
+
+    for (int i = 0; i < count; i += 8) {
+        __m128 next;
+        _mm_storeu_ps(out + i, sin1);
+        if (i + 4 < count) {
+            _mm_storeu_ps(out + i + 4, sin2);
+        }
+        next = _mm_add_ps(_mm_mul_ps(sin1, rotation_cos), _mm_mul_ps(cos1, rotation_sin));
+        cos1 = _mm_sub_ps(_mm_mul_ps(cos1, rotation_cos), _mm_mul_ps(sin1, rotation_sin));
+        sin1 = next;
+        next = _mm_add_ps(_mm_mul_ps(sin2, rotation_cos), _mm_mul_ps(cos2, rotation_sin));
+        cos2 = _mm_sub_ps(_mm_mul_ps(cos2, rotation_cos), _mm_mul_ps(sin2, rotation_sin));
+        sin2 = next;
+    }
+}
+
+/**
+  Gain times sin and cos of each sinusoid of a voice at next sample, from its phase.
+ */
+static void start_phasors(SYNTH_VOICE* voice)
+{
+    __m128 angles = _mm_set_ps(sinusoid_phase(voice, 1) + SYNTH_HALF_PI, sinusoid_phase(voice, 1),
+        sinusoid_phase(voice, 0) + SYNTH_HALF_PI, sinusoid_phase(voice, 0));
+    float phases[4];
+    _mm_storeu_ps(phases, sin_sse(wrap_sse(angles)));
+    for (int c = 0; c < SYNTH_SINUSOIDS; c++) {
+        float gain_sin = voice->sinusoid_gains[c][0], gain_cos = voice->sinusoid_gains[c][1];
+        voice->sinusoid_phasors[c][0] = gain_cos * phases[2 * c] + gain_sin * phases[2 * c + 1];
+        voice->sinusoid_phasors[c][1] = gain_cos * phases[2 * c + 1] - gain_sin * phases[2 * c];
+    }
+}
+
+static void store_sinusoid(float* out, __m128 sine, int accumulate)
+{
+    _mm_storeu_ps(out, accumulate ? _mm_add_ps(_mm_loadu_ps(out), sine) : sine);
+}
+
+/**
+  Renders sinusoid c of a voice into count samples of out, rounded up to SYNTH_SINUSOID_STEPS, or
+  adds it to them if accumulate is set. Its phasor rotates the tables of the voice into 4
+  sequences of 4 samples, which go SYNTH_SINUSOID_STEPS increments at a time so rotations in a row
+  don't wait for each other.
+ */
+static void sinusoid_block(SYNTH_VOICE* voice, int c, float* out, int count, int accumulate)
+{
+    const float* sines = voice->sinusoid_sines[c];
+    const float* cosines = voice->sinusoid_cosines[c];
+    __m128 rotation_sin = _mm_set1_ps(voice->sinusoid_phasors[c][0]);
+    __m128 rotation_cos = _mm_set1_ps(voice->sinusoid_phasors[c][1]);
+    __m128 sin0 = _mm_loadu_ps(sines), cos0 = _mm_loadu_ps(cosines);
+    __m128 sin1 = _mm_loadu_ps(sines + 4), cos1 = _mm_loadu_ps(cosines + 4);
+    __m128 sin2 = _mm_loadu_ps(sines + 8), cos2 = _mm_loadu_ps(cosines + 8);
+    __m128 sin3 = _mm_loadu_ps(sines + 12), cos3 = _mm_loadu_ps(cosines + 12);
+
+    ROTATE_STEP(sin0, cos0);
+    ROTATE_STEP(sin1, cos1);
+    ROTATE_STEP(sin2, cos2);
+    ROTATE_STEP(sin3, cos3);
+    rotation_sin = _mm_set1_ps(voice->sinusoid_rotations[c][0]);
+    rotation_cos = _mm_set1_ps(voice->sinusoid_rotations[c][1]);
+
+    for (int i = 0; i < count; i += SYNTH_SINUSOID_STEPS) {
+        store_sinusoid(out + i, sin0, accumulate);
+        store_sinusoid(out + i + 4, sin1, accumulate);
+        store_sinusoid(out + i + 8, sin2, accumulate);
+        store_sinusoid(out + i + 12, sin3, accumulate);
+        ROTATE_STEP(sin0, cos0);
+        ROTATE_STEP(sin1, cos1);
+        ROTATE_STEP(sin2, cos2);
+        ROTATE_STEP(sin3, cos3);
+    }
+    voice->sinusoid_phasors[c][0] = _mm_cvtss_f32(sin0);
+    voice->sinusoid_phasors[c][1] = _mm_cvtss_f32(cos0);
+}
+
+#ifdef SYNTH_HAVE_AVX2
+
+// rotates a sine and its cosine in 8 lanes by the angle of rotation_sin and rotation_cos
+#define ROTATE_STEP_AVX2(sine, cosine, rotation_sin, rotation_cos)                              \
+    do {                                                                                        \
+        __m256 next = _mm256_fmadd_ps(sine, rotation_cos, _mm256_mul_ps(cosine, rotation_sin)); \
+        cosine = _mm256_fmsub_ps(cosine, rotation_cos, _mm256_mul_ps(sine, rotation_sin));     \
+        sine = next;                                                                            \
+    } while (0)
+
+/**
+  Sequences of 8 samples of sinusoid c of a voice, from its phasor: sines and cosines of the first
+  8 increments and of the next 8.
+ */
+AVX2_FUNCTION static void sinusoid_sequences_avx2(const SYNTH_VOICE* voice, int c, __m256* sines, __m256* cosines)
+{
+    __m256 phasor_sin = _mm256_set1_ps(voice->sinusoid_phasors[c][0]);
+    __m256 phasor_cos = _mm256_set1_ps(voice->sinusoid_phasors[c][1]);
+    for (int s = 0; s < 2; s++) {
+        sines[s] = _mm256_loadu_ps(voice->sinusoid_sines[c] + 8 * s);
+        cosines[s] = _mm256_loadu_ps(voice->sinusoid_cosines[c] + 8 * s);
+        ROTATE_STEP_AVX2(sines[s], cosines[s], phasor_sin, phasor_cos);
+    }
+}
+
+/**
+  Renders all sinusoids of a voice into count samples of out, rounded up to SYNTH_SINUSOID_STEPS,
+  in a single pass of 8 samples in each vector: 2 sequences of each sinusoid go
+  SYNTH_SINUSOID_STEPS increments at a time, and their 4 rotations don't wait for each other.
+ */
+AVX2_FUNCTION static void sinusoids_avx2(SYNTH_VOICE* voice, float* out, int count)
+{
+    __m256 sin0[2], cos0[2], sin1[2], cos1[2];
+    __m256 rotation_sin0 = _mm256_set1_ps(voice->sinusoid_rotations[0][0]);
+    __m256 rotation_cos0 = _mm256_set1_ps(voice->sinusoid_rotations[0][1]);
+    __m256 rotation_sin1 = _mm256_set1_ps(voice->sinusoid_rotations[1][0]);
+    __m256 rotation_cos1 = _mm256_set1_ps(voice->sinusoid_rotations[1][1]);
+
+    sinusoid_sequences_avx2(voice, 0, sin0, cos0);
+    sinusoid_sequences_avx2(voice, 1, sin1, cos1);
+    for (int i = 0; i < count; i += SYNTH_SINUSOID_STEPS) {
+        _mm256_storeu_ps(out + i, _mm256_add_ps(sin0[0], sin1[0]));
+        _mm256_storeu_ps(out + i + 8, _mm256_add_ps(sin0[1], sin1[1]));
+        ROTATE_STEP_AVX2(sin0[0], cos0[0], rotation_sin0, rotation_cos0);
+        ROTATE_STEP_AVX2(sin0[1], cos0[1], rotation_sin0, rotation_cos0);
+        ROTATE_STEP_AVX2(sin1[0], cos1[0], rotation_sin1, rotation_cos1);
+        ROTATE_STEP_AVX2(sin1[1], cos1[1], rotation_sin1, rotation_cos1);
+    }
+    voice->sinusoid_phasors[0][0] = _mm256_cvtss_f32(sin0[0]);
+    voice->sinusoid_phasors[0][1] = _mm256_cvtss_f32(cos0[0]);
+    voice->sinusoid_phasors[1][0] = _mm256_cvtss_f32(sin1[0]);
+    voice->sinusoid_phasors[1][1] = _mm256_cvtss_f32(cos1[0]);
+}
+
+#endif
+
+// loops over groups of 4 samples, with angle of each one
+#define OSCILLATOR_LOOP(expression)                                  \
+    for (int i = 0; i < count; i += 4) {                             \
+        __m128 angle = _mm_add_ps(vphase, _mm_mul_ps(index, vincr)); \
+        _mm_storeu_ps(out + i, (expression));                        \
+        index = _mm_add_ps(index, _mm_set1_ps(4.0f));                \
+    }
+
+/**
+  Renders count samples of an oscillator starting at phase. count is a multiple of 4.
+ */
+static void oscillator_block(OSCILLATOR_TYPE type, float phase, float incr, float* out, int count)
+{
+    __m128 index = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 vincr = _mm_set1_ps(incr);
+    __m128 vphase = _mm_set1_ps(phase);
+
     switch (type) {
     case SIN:
-        value = sin(*ang);
-        *ang += incr;
-        if (*ang >= P_2PI)
-            *ang -= P_2PI;
+        sine_block(phase, incr, out, count);
+        break;
+    case COS:
+        sine_block(phase + SYNTH_HALF_PI, incr, out, count);
+        break;
+    case TRIANGLE:
+        OSCILLATOR_LOOP(triangle_sse(angle));
         break;
-    case TRIANGLE: {
-        double triValue = *ang * M_PI_2;
-        *ang += incr;
-        if (triValue < 0.0)
-            value = 1.0 + triValue;
-        else
-            value = 1.0 - triValue;
-        if (*ang >= M_PI)
-            *ang -= P_2PI;
-    } break;
     case SAW:
-        value = (*ang / M_PI) - 1.0;
-        *ang += incr;
-        if (*ang >= P_2PI)
-            *ang -= P_2PI;
+        OSCILLATOR_LOOP(saw_sse(angle));
+        break;
+    case NONE:
+        memset(out, 0, sizeof(float) * count);
+        break;
+    }
+}
+
+static void multiply_block(float* out, const float* in, int count)
+{
+    for (int i = 0; i < count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(in + i)));
+    }
+}
+
+static void filter_block(SYNTH_VOICE* voice, float* samples, int count)
+{
+    __m128 c0 = _mm_loadu_ps(voice->filter_columns[0]);
+    __m128 c1 = _mm_loadu_ps(voice->filter_columns[1]);
+    __m128 c2 = _mm_loadu_ps(voice->filter_columns[2]);
+    __m128 c3 = _mm_loadu_ps(voice->filter_columns[3]);
+    __m128 feedback = _mm_loadu_ps(voice->filter_feedback);
+    __m128 previous = _mm_set1_ps(voice->filter_state);
+
+    for (int i = 0; i < count; i += 4) {
+        __m128 x = _mm_loadu_ps(samples + i);
+        __m128 y = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0)), c0),
+            _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)), c1));
+        y = _mm_add_ps(y, _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2)), c2),
+                              _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3)), c3)));
+        // only this product and sum depend on the previous group
+        y = _mm_add_ps(y, _mm_mul_ps(previous, feedback));
+        _mm_storeu_ps(samples + i, y);
+        previous = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+/**
+  Scales count samples of in by a ramp from start into out. Two levels 4 samples apart go on 8
+  samples at a time, so their additions don't wait for each other.
+ */
+static void envelope_segment(const float* in, float* out, int count, float start, float step)
+{
+    __m128 level = _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step)));
+    __m128 next = _mm_add_ps(level, _mm_set1_ps(step * 4.0f));
+    __m128 increment = _mm_set1_ps(step * 8.0f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), level));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_loadu_ps(in + i + 4), next));
+        level = _mm_add_ps(level, increment);
+        next = _mm_add_ps(next, increment);
+    }
+    if (i + 4 <= count) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), level));
+        i += 4;
+    }
+    for (; i < count; i++) {
+        out[i] = in[i] * (start + step * i);
+    }
+}
+
+/*
+  Lane kernels render several voices at once, one in each lane: samples of a step are 4 floats,
+  sample of lane l at step n is samples[n * SYNTH_LANES + l]. Steps are a multiple of 4.
+ */
+
+// fixed point phase units in a turn
+#define SYNTH_FIXED_TURN 4294967296.0f
+
+#define LANE(samples, n) ((samples) + (n) * SYNTH_LANES)
+
+// field of the voice of each lane
+#define LANES(voices, field) _mm_set_ps((voices)[3]->field, (voices)[2]->field, (voices)[1]->field, (voices)[0]->field)
+
+// angle wrapped into [-pi, pi) as fixed point turns, so adding increments wraps it on overflow
+static __m128i fixed_angle_sse(__m128 angle)
+{
+    // pi rounds to INT_MIN, which is the same angle
+    return _mm_cvtps_epi32(_mm_mul_ps(wrap_sse(angle), _mm_set1_ps(SYNTH_FIXED_TURN / P_2PI)));
+}
+
+/**
+  Sines of each lane from 4 sequences a step apart, each one rotated by 4 increments, so
+  rotations of consecutive steps don't wait for each other.
+ */
+static void lanes_sine_block(__m128 phase, __m128 incr, float* out, int steps)
+{
+    __m128 half_pi = _mm_set1_ps(SYNTH_HALF_PI);
+    __m128 incr4 = _mm_mul_ps(incr, _mm_set1_ps(4.0f));
+    __m128 rotation_sin = sin_sse(wrap_sse(incr4));
+    __m128 rotation_cos = sin_sse(wrap_sse(_mm_add_ps(incr4, half_pi)));
+    __m128 angle1 = _mm_add_ps(phase, incr);
+    __m128 angle2 = _mm_add_ps(angle1, incr);
+    __m128 angle3 = _mm_add_ps(angle2, incr);
+    __m128 sin0 = sin_sse(wrap_sse(phase));
+    __m128 sin1 = sin_sse(wrap_sse(angle1));
+    __m128 sin2 = sin_sse(wrap_sse(angle2));
+    __m128 sin3 = sin_sse(wrap_sse(angle3));
+    __m128 cos0 = sin_sse(wrap_sse(_mm_add_ps(phase, half_pi)));
+    __m128 cos1 = sin_sse(wrap_sse(_mm_add_ps(angle1, half_pi)));
+    __m128 cos2 = sin_sse(wrap_sse(_mm_add_ps(angle2, half_pi)));
+    __m128 cos3 = sin_sse(wrap_sse(_mm_add_ps(angle3, half_pi)));
+
+    for (int n = 0; n < steps; n += 4) {
+        _mm_storeu_ps(LANE(out, n), sin0);
+        ROTATE_STEP(sin0, cos0);
+        _mm_storeu_ps(LANE(out, n + 1), sin1);
+        ROTATE_STEP(sin1, cos1);
+        _mm_storeu_ps(LANE(out, n + 2), sin2);
+        ROTATE_STEP(sin2, cos2);
+        _mm_storeu_ps(LANE(out, n + 3), sin3);
+        ROTATE_STEP(sin3, cos3);
+    }
+}
+
+static void lanes_oscillator_block(OSCILLATOR_TYPE type, __m128 phase, __m128 incr, float* out, int steps)
+{
+    __m128i fixed_incr = fixed_angle_sse(incr);
+    __m128i fixed;
+    __m128 scale;
+
+    switch (type) {
+    case SIN:
+        lanes_sine_block(phase, incr, out, steps);
         break;
     case COS:
-        value = cos(*ang);
-        *ang += incr;
-        if (*ang >= P_2PI)
-            *ang -= P_2PI;
+        lanes_sine_block(_mm_add_ps(phase, _mm_set1_ps(SYNTH_HALF_PI)), incr, out, steps);
+        break;
+    case TRIANGLE:
+        fixed = fixed_angle_sse(phase);
+        scale = _mm_set1_ps(P_2PI / SYNTH_FIXED_TURN * (float)M_PI_2);
+        for (int n = 0; n < steps; n++) {
+            __m128 angle = _mm_and_ps(_mm_cvtepi32_ps(fixed), _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+            _mm_storeu_ps(LANE(out, n), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(angle, scale)));
+            fixed = _mm_add_epi32(fixed, fixed_incr);
+        }
+        break;
+    case SAW:
+        // half a turn ahead, angles in [0, 2pi) go from -pi to pi
+        fixed = _mm_xor_si128(fixed_angle_sse(phase), _mm_set1_epi32(INT_MIN));
+        scale = _mm_set1_ps(2.0f / SYNTH_FIXED_TURN);
+        for (int n = 0; n < steps; n++) {
+            _mm_storeu_ps(LANE(out, n), _mm_mul_ps(_mm_cvtepi32_ps(fixed), scale));
+            fixed = _mm_add_epi32(fixed, fixed_incr);
+        }
         break;
     case NONE:
-        value = 0;
+        memset(out, 0, sizeof(float) * SYNTH_LANES * steps);
+        break;
     }
-    return (float)value;
 }
 
-int synthetize(SYNTH* synthParams, sample_t** out_samples, int sample_freq)
+/**
+  One-pole filter of each lane, 4 steps at once: partial sums of a group don't depend on the
+  previous one, which only adds to them scaled by powers of beta2.
+ */
+static void lanes_filter_block(__m128 beta1, __m128 beta2, __m128* state, float* samples, int steps)
 {
-    int state = 0;
-    float value;
-    float oldValue = 0.0f;
-    float volume = synthParams->volume;
+    __m128 beta2_2 = _mm_mul_ps(beta2, beta2);
+    __m128 beta2_3 = _mm_mul_ps(beta2_2, beta2);
+    __m128 beta2_4 = _mm_mul_ps(beta2_3, beta2);
+    __m128 previous = *state;
 
-    int samples_count = (int)((float)sample_freq * synthParams->totalTime);
-    sample_t* samples = (sample_t*)malloc(samples_count * sizeof(sample_t));
+    for (int n = 0; n < steps; n += 4) {
+        __m128 p0 = _mm_mul_ps(_mm_loadu_ps(LANE(samples, n)), beta1);
+        __m128 p1 = _mm_add_ps(_mm_mul_ps(p0, beta2), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 1)), beta1));
+        __m128 p2 = _mm_add_ps(_mm_mul_ps(p1, beta2), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 2)), beta1));
+        __m128 p3 = _mm_add_ps(_mm_mul_ps(p2, beta2), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 3)), beta1));
+        _mm_storeu_ps(LANE(samples, n), _mm_add_ps(p0, _mm_mul_ps(previous, beta2)));
+        _mm_storeu_ps(LANE(samples, n + 1), _mm_add_ps(p1, _mm_mul_ps(previous, beta2_2)));
+        _mm_storeu_ps(LANE(samples, n + 2), _mm_add_ps(p2, _mm_mul_ps(previous, beta2_3)));
+        previous = _mm_add_ps(p3, _mm_mul_ps(previous, beta2_4));
+        _mm_storeu_ps(LANE(samples, n + 3), previous);
+    }
+    *state = previous;
+}
 
-    int attackTimeSamples = (int)(synthParams->attackTime * (float)sample_freq);
-    int decayTimeSamples = (int)(synthParams->decayTime * (float)sample_freq);
-    int releaseTimeSamples = (int)(synthParams->releaseTime * (float)sample_freq);
+/**
+  Amplitude envelope of each lane, with levels of 4 consecutive steps going up apart so they
+  don't wait for each other.
+ */
+static void lanes_envelope_segment(float* samples, int steps, __m128 start, __m128 step)
+{
+    __m128 step4 = _mm_mul_ps(step, _mm_set1_ps(4.0f));
+    __m128 level0 = start;
+    __m128 level1 = _mm_add_ps(start, step);
+    __m128 level2 = _mm_add_ps(level1, step);
+    __m128 level3 = _mm_add_ps(level2, step);
+    int n = 0;
 
-    int envCount = attackTimeSamples;
-    float slope = volume / (float)attackTimeSamples;
-
-    float phaseIncrOsc1 = (P_2PI / (float)sample_freq) * synthParams->oscillator1_freq;
-    float phaseIncrOsc2 = (P_2PI / (float)sample_freq) * synthParams->oscillator2_freq;
-    float phase1 = 0.0f;
-    float phase2 = 0.0f;
-
-    for (int i = 0; i < samples_count; i++) {
-        value = oscillator(synthParams->oscillator1_type, &phase1, phaseIncrOsc1);
-        if (synthParams->oscillator2_type != NONE) {
-            value = value * oscillator(synthParams->oscillator2_type, &phase2, phaseIncrOsc2);
-        }
-        // filter
-        value = (synthParams->filterBeta1 * value) + (synthParams->filterBeta2 * oldValue);
-        oldValue = value;
-
-        // amplitude envelope
-        switch (state) {
-        case 0:
-            if (envCount > 0) {
-                volume += slope;
-                envCount--;
-            } else {
-                state = 1;
-                envCount = decayTimeSamples;
-                slope = (volume - synthParams->decayValue) / (float)decayTimeSamples;
+    for (; n + 4 <= steps; n += 4) {
+        _mm_storeu_ps(LANE(samples, n), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n)), level0));
+        _mm_storeu_ps(LANE(samples, n + 1), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 1)), level1));
+        _mm_storeu_ps(LANE(samples, n + 2), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 2)), level2));
+        _mm_storeu_ps(LANE(samples, n + 3), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n + 3)), level3));
+        level0 = _mm_add_ps(level0, step4);
+        level1 = _mm_add_ps(level1, step4);
+        level2 = _mm_add_ps(level2, step4);
+        level3 = _mm_add_ps(level3, step4);
+    }
+    for (; n < steps; n++) {
+        _mm_storeu_ps(LANE(samples, n), _mm_mul_ps(_mm_loadu_ps(LANE(samples, n)), level0));
+        level0 = _mm_add_ps(level0, step);
+    }
+}
+
+/**
+  Renders next frames, at most SYNTH_BLOCK, of count voices sharing oscillator types, one in each
+  lane; spare lanes repeat the first voice and are dropped. Voices that end render less and
+  don't keep a state to go on from.
+ */
+static void render_lanes(SYNTH_VOICE* const* voices, sample_t* const* outs, int count, int frames)
+{
+    float block[SYNTH_BLOCK * SYNTH_LANES];
+    float modulator[SYNTH_BLOCK * SYNTH_LANES];
+    const SYNTH_VOICE* lanes[SYNTH_LANES];
+    int counts[SYNTH_LANES];
+    int segments[SYNTH_LANES];
+    int positions[SYNTH_LANES];
+    sample_t scratch[SYNTH_BLOCK];
+    sample_t* targets[SYNTH_LANES];
+    float phases1[SYNTH_LANES];
+    float phases2[SYNTH_LANES];
+    int steps = 0;
+    int shortest = SYNTH_BLOCK;
+    int stored = 0;
+    int padded;
+    __m128 state, counted;
+
+    for (int l = 0; l < SYNTH_LANES; l++) {
+        lanes[l] = voices[l < count ? l : 0];
+        counts[l] = 0;
+        if (l < count) {
+            counts[l] = lanes[l]->length - lanes[l]->position < frames ? lanes[l]->length - lanes[l]->position : frames;
+        }
+        steps = counts[l] > steps ? counts[l] : steps;
+        if (l < count && counts[l] < shortest) {
+            shortest = counts[l];
+        }
+        segments[l] = lanes[l]->segment;
+        positions[l] = lanes[l]->segment_position;
+    }
+    padded = (steps + 3) & ~3;
+
+    lanes_oscillator_block(lanes[0]->oscillator1_type, LANES(lanes, phase1), LANES(lanes, phase_incr1), block, padded);
+    if (lanes[0]->oscillator2_type != NONE) {
+        lanes_oscillator_block(lanes[0]->oscillator2_type, LANES(lanes, phase2), LANES(lanes, phase_incr2), modulator, padded);
+        multiply_block(block, modulator, padded * SYNTH_LANES);
+    }
+    state = LANES(lanes, filter_state);
+    lanes_filter_block(LANES(lanes, filter_columns[0][0]), LANES(lanes, filter_feedback[0]), &state, block, padded);
+    for (int l = 0; l < count; l++) {
+        if (counts[l]) {
+            voices[l]->filter_state = LANE(block, counts[l] - 1)[l];
+        }
+    }
+
+    for (int done = 0; done < steps;) {
+        float starts[SYNTH_LANES];
+        float slopes[SYNTH_LANES];
+        int length = steps - done;
+
+        for (int l = 0; l < SYNTH_LANES; l++) {
+            const ENVELOPE_SEGMENT* segment = &lanes[l]->segments[segments[l]];
+            if (segment->length - positions[l] < length) {
+                length = segment->length - positions[l];
             }
-        case 1:
-            if (envCount > 0) {
-                envCount--;
-                volume -= slope;
-            } else {
-                state = 2;
-                envCount = releaseTimeSamples;
-                slope = volume / (float)releaseTimeSamples;
+            starts[l] = segment->start + segment->step * positions[l];
+            slopes[l] = segment->step;
+        }
+        lanes_envelope_segment(LANE(block, done), length, _mm_loadu_ps(starts), _mm_loadu_ps(slopes));
+        for (int l = 0; l < SYNTH_LANES; l++) {
+            positions[l] += length;
+            if (positions[l] >= lanes[l]->segments[segments[l]].length) {
+                segments[l]++;
+                positions[l] = 0;
             }
+        }
+        done += length;
+    }
+
+    // spare lanes go to scratch, so steps all lanes render are stored as they are transposed
+    for (int l = 0; l < SYNTH_LANES; l++) {
+        targets[l] = l < count ? outs[l] : scratch;
+    }
+    for (; stored + 4 <= shortest; stored += 4) {
+        __m128 row0 = _mm_loadu_ps(LANE(block, stored));
+        __m128 row1 = _mm_loadu_ps(LANE(block, stored + 1));
+        __m128 row2 = _mm_loadu_ps(LANE(block, stored + 2));
+        __m128 row3 = _mm_loadu_ps(LANE(block, stored + 3));
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+        _mm_storeu_ps(targets[0] + stored, row0);
+        _mm_storeu_ps(targets[1] + stored, row1);
+        _mm_storeu_ps(targets[2] + stored, row2);
+        _mm_storeu_ps(targets[3] + stored, row3);
+    }
+    for (int l = 0; l < count; l++) {
+        for (int n = stored; n < counts[l]; n++) {
+            outs[l][n] = LANE(block, n)[l];
+        }
+    }
+
+    counted = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)counts));
+    _mm_storeu_ps(phases1, turn_sse(_mm_add_ps(LANES(lanes, phase1), _mm_mul_ps(counted, LANES(lanes, phase_incr1)))));
+    _mm_storeu_ps(phases2, turn_sse(_mm_add_ps(LANES(lanes, phase2), _mm_mul_ps(counted, LANES(lanes, phase_incr2)))));
+    for (int l = 0; l < count; l++) {
+        SYNTH_VOICE* voice = voices[l];
+        voice->phase1 = phases1[l];
+        voice->phase2 = phases2[l];
+        voice->segment = segments[l];
+        voice->segment_position = positions[l];
+        voice->position += counts[l];
+    }
+}
+
+#else
+
+// angle moved into [-pi, pi)
+static float wrap_angle(float angle)
+{
+    return angle - floorf((angle + SYNTH_PI) * SYNTH_INV_2PI) * P_2PI;
+}
+
+static float sin_poly(float x)
+{
+    float x2;
+    x = x < SYNTH_PI - x ? x : SYNTH_PI - x;
+    x = x > -SYNTH_PI - x ? x : -SYNTH_PI - x;
+    x2 = x * x;
+    return x * (1.0f + x2 * (SIN_C3 + x2 * (SIN_C5 + x2 * (SIN_C7 + x2 * (SIN_C9 + x2 * SIN_C11)))));
+}
+
+static void oscillator_block(OSCILLATOR_TYPE type, float phase, float incr, float* out, int count)
+{
+    for (int i = 0; i < count; i++) {
+        float angle = phase + i * incr;
+        switch (type) {
+        case SIN:
+            out[i] = sin_poly(wrap_angle(angle));
             break;
-        case 2:
-            if (envCount > 0) {
-                envCount--;
-                volume -= slope;
-            } else {
-                state = -1;
-                volume = 0.0f;
-            }
+        case COS:
+            out[i] = sin_poly(wrap_angle(angle + SYNTH_HALF_PI));
+            break;
+        case TRIANGLE:
+            out[i] = 1.0f - fabsf(wrap_angle(angle)) * (float)M_PI_2;
+            break;
+        case SAW:
+            angle -= floorf(angle * SYNTH_INV_2PI) * P_2PI;
+            out[i] = angle * (1.0f / SYNTH_PI) - 1.0f;
+            break;
+        default:
+            out[i] = 0.0f;
             break;
         }
-        samples[i] = (sample_t)(volume * value);
     }
+}
 
-    // simple reverb
-    float delayTime = synthParams->delayTime;
-    float reverbSize = synthParams->reverbSize;
-    int delaySamples = (int)(delayTime * (float)sample_freq);
-    if (delaySamples > 0) {
-        for (int i = 0; i < samples_count - delaySamples; i++) {
-            samples[i + delaySamples] += samples[i] * (sample_t)reverbSize;
+static void start_phasors(SYNTH_VOICE* voice)
+{
+    for (int c = 0; c < SYNTH_SINUSOIDS; c++) {
+        float phase = sinusoid_phase(voice, c);
+        float sine = sin_poly(wrap_angle(phase)), cosine = sin_poly(wrap_angle(phase + SYNTH_HALF_PI));
+        float gain_sin = voice->sinusoid_gains[c][0], gain_cos = voice->sinusoid_gains[c][1];
+        voice->sinusoid_phasors[c][0] = gain_cos * sine + gain_sin * cosine;
+        voice->sinusoid_phasors[c][1] = gain_cos * cosine - gain_sin * sine;
+    }
+}
+
+static void sinusoid_block(SYNTH_VOICE* voice, int c, float* out, int count, int accumulate)
+{
+    const float* sines = voice->sinusoid_sines[c];
+    const float* cosines = voice->sinusoid_cosines[c];
+    float rotation_sin = voice->sinusoid_rotations[c][0];
+    float rotation_cos = voice->sinusoid_rotations[c][1];
+    float sine = voice->sinusoid_phasors[c][0];
+    float cosine = voice->sinusoid_phasors[c][1];
+
+    for (int i = 0; i < count; i += SYNTH_SINUSOID_STEPS) {
+        float next = sine * rotation_cos + cosine * rotation_sin;
+        for (int k = 0; k < SYNTH_SINUSOID_STEPS; k++) {
+            float value = sine * cosines[k] + cosine * sines[k];
+            out[i + k] = accumulate ? out[i + k] + value : value;
         }
+        cosine = cosine * rotation_cos - sine * rotation_sin;
+        sine = next;
+    }
+    voice->sinusoid_phasors[c][0] = sine;
+    voice->sinusoid_phasors[c][1] = cosine;
+}
+
+static void multiply_block(float* out, const float* in, int count)
+{
+    for (int i = 0; i < count; i++) {
+        out[i] *= in[i];
+    }
+}
+
+static void filter_block(SYNTH_VOICE* voice, float* samples, int count)
+{
+    float previous = voice->filter_state;
+    float beta1 = voice->filter_columns[0][0];
+    float beta2 = voice->filter_feedback[0];
+    for (int i = 0; i < count; i++) {
+        previous = beta1 * samples[i] + beta2 * previous;
+        samples[i] = previous;
     }
+}
+
+static void envelope_segment(const float* in, float* out, int count, float start, float step)
+{
+    for (int i = 0; i < count; i++) {
+        out[i] = in[i] * (start + step * i);
+    }
+}
+
+#endif
+
+/**
+  Renders sinusoids of a voice one after another into count samples of out.
+ */
+static void sinusoids_each(SYNTH_VOICE* voice, float* out, int count)
+{
+    for (int c = 0; c < voice->sinusoids; c++) {
+        sinusoid_block(voice, c, out, count, c > 0);
+    }
+}
+
+typedef void (*SINUSOIDS_KERNEL)(SYNTH_VOICE* voice, float* out, int count);
+
+/**
+  Kernel rendering sinusoids of voices, AVX2 and FMA when CPU supports them.
+ */
+static SINUSOIDS_KERNEL sinusoids_kernel(void)
+{
+#if defined(SYNTH_HAVE_AVX2) && defined(__GNUC__)
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? sinusoids_avx2 : sinusoids_each;
+#elif defined(SYNTH_HAVE_AVX2)
+    return sinusoids_avx2;
+#else
+    return sinusoids_each;
+#endif
+}
+
+/**
+  Renders count filtered samples of a voice made of sinusoids into a block of SYNTH_BLOCK samples,
+  and adds the transient to the first ones.
+ */
+static void sinusoids_block(SYNTH_VOICE* voice, float* block, int count)
+{
+    float beta2 = voice->filter_feedback[0];
+    float beta4 = beta2 * beta2 * beta2 * beta2;
+    float transient = voice->transient;
+    int i;
+
+    if (!voice->sinusoid_phasors_valid) {
+        start_phasors(voice);
+    }
+    sinusoids_kernel()(voice, block, count);
+    // sequences end at the next sample only when they render count samples exactly
+    voice->sinusoid_phasors_valid = count % SYNTH_SINUSOID_STEPS == 0;
+    // 4 samples at a time, so products of transient don't wait for each other
+    for (i = 0; i + 4 <= count && fabsf(transient) > SYNTH_TRANSIENT_MIN; i += 4) {
+        block[i] += transient * beta2;
+        block[i + 1] += transient * beta2 * beta2;
+        block[i + 2] += transient * beta2 * beta2 * beta2;
+        transient *= beta4;
+        block[i + 3] += transient;
+    }
+    for (; i < count && fabsf(transient) > SYNTH_TRANSIENT_MIN; i++) {
+        transient *= beta2;
+        block[i] += transient;
+    }
+    voice->transient = i < count ? 0.0f : transient;
+}
+
+/**
+  Renders next samples of a voice into out, at most frames. Returns samples rendered, less than
+  frames when voice ends.
+ */
+int synth_voice_render(SYNTH_VOICE* voice, sample_t* out, int frames)
+{
+    float block[SYNTH_BLOCK];
+    float modulator[SYNTH_BLOCK];
+    int rendered = 0;
+
+    if (frames > voice->length - voice->position) {
+        frames = voice->length - voice->position;
+    }
+    while (rendered < frames) {
+        int count = frames - rendered < SYNTH_BLOCK ? frames - rendered : SYNTH_BLOCK;
+        // kernels work on groups of 4 samples, extra ones are dropped
+        int padded = (count + 3) & ~3;
+        int done = 0;
+
+        if (voice->sinusoids) {
+            sinusoids_block(voice, block, count);
+        } else {
+            oscillator_block(voice->oscillator1_type, voice->phase1, voice->phase_incr1, block, padded);
+            if (voice->oscillator2_type != NONE) {
+                oscillator_block(voice->oscillator2_type, voice->phase2, voice->phase_incr2, modulator, padded);
+                multiply_block(block, modulator, padded);
+            }
+            filter_block(voice, block, padded);
+            voice->filter_state = block[count - 1];
+        }
+        voice->phase1 = wrap_phase(voice->phase1 + count * voice->phase_incr1);
+        voice->phase2 = wrap_phase(voice->phase2 + count * voice->phase_incr2);
+
+        while (done < count) {
+            const ENVELOPE_SEGMENT* segment = &voice->segments[voice->segment];
+            int length = segment->length - voice->segment_position;
+            if (length > count - done) {
+                length = count - done;
+            }
+            envelope_segment(block + done, out + rendered + done, length, segment->start + segment->step * voice->segment_position, segment->step);
+            done += length;
+            voice->segment_position += length;
+            if (voice->segment_position >= segment->length) {
+                voice->segment++;
+                voice->segment_position = 0;
+            }
+        }
+        rendered += count;
+    }
+    voice->position += rendered;
+    return rendered;
+}
+
+/**
+  Renders next frames of count voices, at most SYNTH_LANES, into their outs. Voices must share
+  oscillator types; with SSE they render together, one in each lane, so their filters don't wait
+  for each other. Voices made of sinusoids have no filter to wait for and render one by one. A
+  voice renders less than frames when it ends.
+ */
+void synth_voices_render(SYNTH_VOICE* const* voices, sample_t* const* outs, int count, int frames)
+{
+#ifdef SYNTH_HAVE_SSE
+    if (count > 0 && voices[0]->sinusoids) {
+        for (int v = 0; v < count; v++) {
+            synth_voice_render(voices[v], outs[v], frames);
+        }
+        return;
+    }
+    for (int done = 0; done < frames; done += SYNTH_BLOCK) {
+        sample_t* block_outs[SYNTH_LANES];
+        for (int v = 0; v < count; v++) {
+            block_outs[v] = outs[v] + done;
+        }
+        render_lanes(voices, block_outs, count, frames - done < SYNTH_BLOCK ? frames - done : SYNTH_BLOCK);
+    }
+#else
+    for (int v = 0; v < count; v++) {
+        synth_voice_render(voices[v], outs[v], frames);
+    }
+#endif
+}
+
+/**
+  Moves a started voice to position, as if it had rendered the samples before it. Its filter
+  starts from silence, so it takes SYNTH_SETTLE samples to render as the voice would, unless the
+  voice is made of sinusoids, whose transient is moved exactly.
+ */
+void synth_voice_seek(SYNTH_VOICE* voice, int position)
+{
+    voice->phase1 = (float)fmod((double)position * voice->phase_incr1, P_2PI);
+    voice->phase2 = (float)fmod((double)position * voice->phase_incr2, P_2PI);
+    voice->filter_state = 0.0f;
+    voice->sinusoid_phasors_valid = 0;
+    voice->transient *= (float)pow(voice->filter_feedback[0], position);
+    voice->segment = 0;
+    voice->segment_position = position;
+    while (voice->segment_position >= voice->segments[voice->segment].length) {
+        voice->segment_position -= voice->segments[voice->segment].length;
+        voice->segment++;
+    }
+    voice->position = position;
+}
+
+/**
+  Adds to each sample the one delay_samples before, scaled by gain, as a feedback delay line.
+ */
+void synth_delay(sample_t* samples, int count, int delay_samples, float gain)
+{
+    if (delay_samples <= 0) {
+        return;
+    }
+    // samples of a stretch shorter than delay don't depend on each other
+    for (int start = 0; start + delay_samples < count; start += delay_samples) {
+        sample_t* source = samples + start;
+        sample_t* target = source + delay_samples;
+        int length = count - start - delay_samples < delay_samples ? count - start - delay_samples : delay_samples;
+        for (int i = 0; i < length; i++) {
+            target[i] += source[i] * gain;
+        }
+    }
+}
+
+/**
+  Samples of a whole patch at sample_freq.
+ */
+int synth_length(const SYNTH* synthParams, int sample_freq)
+{
+    return (int)((float)sample_freq * synthParams->totalTime);
+}
+
+/**
+  Renders a whole patch with its reverb into samples, which hold synth_length samples. A patch
+  made of sinusoids renders as one voice. Other patches are cut in SYNTH_LANES parts rendered
+  together, each one but the first settling its filter on the SYNTH_SETTLE samples before it.
+ */
+void synth_render(const SYNTH* synthParams, sample_t* samples, int sample_freq)
+{
+    SYNTH_VOICE parts[SYNTH_LANES];
+    SYNTH_VOICE* lanes[SYNTH_LANES];
+    sample_t* outs[SYNTH_LANES];
+    sample_t settle[SYNTH_LANES][SYNTH_SETTLE];
+    int length, part;
+
+    synth_voice_start(&parts[0], synthParams, sample_freq);
+    length = parts[0].length;
+    part = (length + SYNTH_LANES - 1) / SYNTH_LANES;
+    if (part <= SYNTH_SETTLE || parts[0].sinusoids) {
+        synth_voice_render(&parts[0], samples, length);
+    } else {
+        for (int l = 0; l < SYNTH_LANES; l++) {
+            parts[l] = parts[0];
+            lanes[l] = &parts[l];
+            outs[l] = settle[l];
+            if (l > 0) {
+                synth_voice_seek(&parts[l], l * part - SYNTH_SETTLE);
+            }
+        }
+        synth_voices_render(lanes + 1, outs + 1, SYNTH_LANES - 1, SYNTH_SETTLE);
+        for (int l = 0; l < SYNTH_LANES; l++) {
+            outs[l] = samples + l * part;
+        }
+        synth_voices_render(lanes, outs, SYNTH_LANES, part);
+    }
+
+    // simple reverb
+    synth_delay(samples, length, (int)(synthParams->delayTime * (float)sample_freq), synthParams->reverbSize);
+}
+
+int synthetize(const SYNTH* synthParams, sample_t** out_samples, int sample_freq)
+{
+    int length = synth_length(synthParams, sample_freq);
+    sample_t* samples = (sample_t*)malloc(length * sizeof(sample_t));
+
+    synth_render(synthParams, samples, sample_freq);
     *out_samples = samples;
-    return samples_count;
+    return length;
 }
 
 void free_samples(sample_t* samples)
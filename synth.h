@@ -2,7 +2,7 @@
 	@file synth.c
 	@author Alejandro Ambroa
 	@date 1 Oct 2017
-	@brief Simple software synthetizer based on book "BasicSynth" by Daniel Mitchell. 
+	@brief Simple software synthetizer based on book "BasicSynth" by Daniel Mitchell.
 */
 
 #ifndef _SYNTH_H_
@@ -10,6 +10,24 @@
 
 typedef float sample_t;
 
+// samples rendered at once by synth voices
+#define SYNTH_BLOCK 128
+
+// voices synth_voices_render renders at once
+#define SYNTH_LANES 4
+
+// samples a voice's filter takes to settle after synth_voice_seek, for filter beta2 up to 0.75
+#define SYNTH_SETTLE 64
+
+// max sinusoids a voice made of sine and cosine oscillators renders
+#define SYNTH_SINUSOIDS 2
+
+// samples a sinusoid renders at a time, SYNTH_BLOCK is a multiple of this
+#define SYNTH_SINUSOID_STEPS 16
+
+// max segments of an amplitude envelope
+#define SYNTH_SEGMENTS 6
+
 typedef enum {
     NONE,
     SIN,
@@ -35,7 +53,62 @@ typedef struct {
     float reverbSize;
 } SYNTH;
 
-int synthetize(SYNTH* synth_params, sample_t** samples_buffer, int sample_freq);
+/**
+  @brief Stretch of amplitude envelope where volume changes linearly.
+ */
+typedef struct {
+    int length;
+    float start;
+    float step;
+} ENVELOPE_SEGMENT;
+
+/**
+  @brief A SYNTH patch being rendered block by block. Holds no pointers, so it can be copied.
+ */
+typedef struct {
+    OSCILLATOR_TYPE oscillator1_type;
+    OSCILLATOR_TYPE oscillator2_type;
+    /** phases at start of next block, in radians */
+    float phase1;
+    float phase2;
+    float phase_incr1;
+    float phase_incr2;
+    /** one-pole filter as 4 samples at once: output = sum of input * columns + previous output * feedback */
+    float filter_columns[4][4];
+    float filter_feedback[4];
+    float filter_state;
+    /** filtered output of a voice made of sines and cosines: sinusoids it's the sum of, as gains of
+        sin and cos of phase1 + sign * phase2 + offset, plus a transient going down by beta2 each sample */
+    int sinusoids;
+    float sinusoid_gains[SYNTH_SINUSOIDS][2];
+    float sinusoid_signs[SYNTH_SINUSOIDS];
+    float sinusoid_offsets[SYNTH_SINUSOIDS];
+    /** sin and cos of each of the first SYNTH_SINUSOID_STEPS increments, which sequences of samples
+        start from, and of SYNTH_SINUSOID_STEPS increments, which they go on by */
+    float sinusoid_sines[SYNTH_SINUSOIDS][SYNTH_SINUSOID_STEPS];
+    float sinusoid_cosines[SYNTH_SINUSOIDS][SYNTH_SINUSOID_STEPS];
+    float sinusoid_rotations[SYNTH_SINUSOIDS][2];
+    /** gain times sin and cos of each sinusoid at next sample, if valid */
+    float sinusoid_phasors[SYNTH_SINUSOIDS][2];
+    int sinusoid_phasors_valid;
+    float transient;
+    ENVELOPE_SEGMENT segments[SYNTH_SEGMENTS];
+    int segment;
+    int segment_position;
+    int position;
+    int length;
+} SYNTH_VOICE;
+
+int synthetize(const SYNTH* synth_params, sample_t** samples_buffer, int sample_freq);
+int synth_length(const SYNTH* synth_params, int sample_freq);
+void synth_render(const SYNTH* synth_params, sample_t* samples, int sample_freq);
 void free_samples(sample_t* samples);
 
+void synth_voice_start(SYNTH_VOICE* voice, const SYNTH* synth_params, int sample_freq);
+void synth_voice_transpose(SYNTH_VOICE* voice, float ratio);
+int synth_voice_render(SYNTH_VOICE* voice, sample_t* out, int frames);
+void synth_voices_render(SYNTH_VOICE* const* voices, sample_t* const* outs, int count, int frames);
+void synth_voice_seek(SYNTH_VOICE* voice, int position);
+void synth_delay(sample_t* samples, int count, int delay_samples, float gain);
+
 #endif
@@ -7,292 +7,314 @@
 
 #include "tasks.h"
 
+#include "ai.h"
+#include "input.h"
+#include "multiball.h"
 #include "pong3d.h"
-#include "renderer.h"
-#include "screens.h"
-#include "sound.h"
 #include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <time.h>
 
-float to_position[2] = { 0, 0 };
-int framesToPosition = 0;
-bool lookDesviation = false;
+// overlay fades in this time and number of steps when players are loaded
+#define OVERLAY_FADE_TIME 0.3f
+#define OVERLAY_FADE_STEPS 18
 
-float overlay_fadeout;
-int overlay_fadeout_frames;
-float overlay_fadeout_alpha;
-int player_score = 0;
-int opponent_score = 0;
-int balls = BALLS;
+// seconds between end of a point and next service
+#define POINT_OVER_TIME 1.5f
 
-float ball_speed_vector[3];
+// player stick deflects a returned ball by its displacement over this many frames of reference
+// rate after the hit, so the deflection doesn't depend on tick rate or on when mouse events land
+#define DESVIATION_FRAMES 2
+#define DESVIATION_TICKS (DESVIATION_FRAMES * TICK_RATE / REFERENCE_FPS)
 
-bool resetFramesCounter = true;
-
-int fps_inc = FPS;
+static bool equals(const GameContext* ctx, float a, float b)
+{
+    return (bool)(fabs(a - b) <= ctx->ball.width);
+}
 
-bool equals(float a, float b)
+/**
+  Moves player stick to mouse position in window coords.
+ */
+void move_player_stick_to_mouse(GameContext* ctx, int mx, int my)
 {
-    return (bool)(fabs(a - b) <= ball.width);
+    move_player_stick(ctx, (mx - (WINDOW_WIDTH >> 1)) / (float)WINDOW_WIDTH,
+        //(aspect * h -> w/h * h -> h)
+        (my - (WINDOW_HEIGHT >> 1)) / -(float)WINDOW_WIDTH);
 }
 
-int start_screen_task()
+void start_screen_task(void)
 {
-    return 0;
 }
 
-int loading_players_task(int elapsedFrames)
+static void fade_overlay_step(void* owner, TIMER* timer)
 {
-    if (elapsedFrames == 0) {
-        // overlay fading out velocity
-        overlay_fadeout_frames = (int)(FPS * 0.3f);
-        overlay_fadeout = OVERLAY_ALPHA / overlay_fadeout_frames;
-        overlay_fadeout_alpha = overlay_fadeout;
-        loading_players_screen_set_overlay(overlay_fadeout_alpha);
-    }
-    if (elapsedFrames <= overlay_fadeout_frames) {
-        overlay_fadeout_alpha += overlay_fadeout;
-        loading_players_screen_set_overlay(overlay_fadeout_alpha);
-    } else {
-        play_start_sound();
-        sys_show_cursor(0);
-        player_score = 0;
-        opponent_score = 0;
-        balls = BALLS;
-        change_state(PLAYER_SERVICE);
+    GameContext* ctx = (GameContext*)owner;
+
+    if (--ctx->overlay_fadeout_steps > 0) {
+        ctx->overlay_fadeout_alpha += ctx->overlay_fadeout;
+        timer_schedule(&ctx->timers, timer, SECONDS_TO_TICKS(OVERLAY_FADE_TIME / OVERLAY_FADE_STEPS), fade_overlay_step);
+        return;
     }
-    return 0;
+    emit_game_event(ctx, START_SOUND);
+    emit_game_event(ctx, HIDE_CURSOR);
+    ctx->player_score = 0;
+    ctx->opponent_score = 0;
+    ctx->balls = BALLS;
+    change_state(ctx, PLAYER_SERVICE);
+}
+
+void loading_players_task(GameContext* ctx)
+{
+    ctx->overlay_fadeout = OVERLAY_ALPHA / OVERLAY_FADE_STEPS;
+    ctx->overlay_fadeout_alpha = ctx->overlay_fadeout;
+    ctx->overlay_fadeout_steps = OVERLAY_FADE_STEPS;
+    timer_schedule(&ctx->timers, &ctx->state_timer, SECONDS_TO_TICKS(OVERLAY_FADE_TIME / OVERLAY_FADE_STEPS), fade_overlay_step);
 }
 
-static void set_initial_ball_velocity()
+static void set_initial_ball_velocity(GameContext* ctx)
 {
-    srand((unsigned int)time(NULL));
     // 4 is a magic number
-    ball_speed_vector[0] = ((rand() % 1) ? 1.0f : -1.0f) * stage.width / (FPS * (4 + rand() % 1));
-    ball_speed_vector[1] = ((rand() % 1) ? 1.0f : -1.0f) * stage.height / (FPS * (4 + rand() % 1));
-    ball_speed_vector[2] = -stage.large / FPS * INITIAL_VELOCITY_FACTOR;
-    fps_inc = FPS;
+    ctx->ball_speed_vector[0] = ((game_random(ctx) % 1) ? 1.0f : -1.0f) * ctx->stage.width / (4 + game_random(ctx) % 1);
+    ctx->ball_speed_vector[1] = ((game_random(ctx) % 1) ? 1.0f : -1.0f) * ctx->stage.height / (4 + game_random(ctx) % 1);
+    ctx->ball_speed_vector[2] = -ctx->stage.large * INITIAL_VELOCITY_FACTOR;
+    ctx->fps_inc = REFERENCE_FPS;
 }
 
-int player_service_task(int elapsedFrames, int pendingEvent, SysEvent* event)
+void player_service_task(GameContext* ctx)
 {
-    if (elapsedFrames == 0) {
-        set_initial_ball_velocity();
-        reset_ball_position();
-        reset_player_stick_position();
-        reset_opponent_stick_position();
-        sys_mouse_center(WINDOW_WIDTH, WINDOW_HEIGHT);
-        balls--;
-    }
-    if (pendingEvent) {
-	    if (event->type == MOUSELBUTTONUP && ball_in_player_stick()) {
-        	change_state(PLAYER_RETURN);
-        	play_player_pong_sound();
-	    }
-    }
-    return 0;
+    set_initial_ball_velocity(ctx);
+    reset_ball_position(ctx);
+    reset_player_stick_position(ctx);
+    reset_opponent_stick_position(ctx);
+    store_previous_positions(ctx);
+    emit_game_event(ctx, CENTER_MOUSE);
+    ctx->balls--;
 }
 
 /**
-  Main game logic.
+  Serves ball when player clicks with the ball in the stick.
  */
-
-int playing_task(int elapsedFrames)
+void serving_task(GameContext* ctx, int events)
 {
+    // walk events of this tick in order, so a click is tested where stick was when it happened
+    for (int i = 0; i < events; i++) {
+        const SysEvent* event = input_peek_event(&ctx->input, i);
+        if (event->type == MOUSEMOTION) {
+            move_player_stick_to_mouse(ctx, event->x, event->y);
+        } else if (event->type == MOUSELBUTTONUP && ctx->gameState == PLAYER_SERVICE && ball_in_player_stick(ctx)) {
+            change_state(ctx, PLAYER_RETURN);
+            emit_game_event(ctx, PLAYER_PONG_SOUND);
+        }
+    }
+}
 
-    float hit_wall_vector[3];
-    int resetFrames = 0;
+void player_return_task(GameContext* ctx)
+{
+    // computer predicts where ball goes once its velocity is known, after deflection by player stick
+    ctx->ai_replan = true;
+    ctx->ai_moving = false;
+}
 
-    if (ball_hit_wall(hit_wall_vector, &stage, &ball)) {
-        ball_speed_vector[0] *= hit_wall_vector[0];
-        ball_speed_vector[1] *= hit_wall_vector[1];
-        play_wall_hit_sound();
+void opponent_return_task(GameContext* ctx)
+{
+    // calculate vector from ball to center of screen for moving there
+    ctx->to_position[0] = -ctx->opponent_stick.x;
+    ctx->to_position[1] = -ctx->opponent_stick.y;
+    // velocity of movement (magic number, 10 reference frames)
+    ctx->ticksToPosition = SECONDS_TO_TICKS(10.0f / REFERENCE_FPS);
+    if (ctx->ticksToPosition > 0) {
+        ctx->to_position[0] /= ctx->ticksToPosition;
+        ctx->to_position[1] /= ctx->ticksToPosition;
+    } else {
+        ctx->to_position[0] = 0;
+        ctx->to_position[1] = 0;
     }
-    // computer return ball
-    if (gameState == OPP_RETURN) {
-        if (elapsedFrames == 0) {
-            // calculate vector from ball to center of screen for moving there
-            to_position[0] = -opponent_stick.x;
-            to_position[1] = -opponent_stick.y;
-            // velocity of movement (magic number)
-            framesToPosition = 10;
-            if (framesToPosition > 0) {
-                to_position[0] /= framesToPosition;
-                to_position[1] /= framesToPosition;
-            } else {
-                to_position[0] = 0;
-                to_position[1] = 0;
-            }
-        }
-        // if ball is in player Z coord...
-        if (equals(ball.z - ball.width, player_stick.z) || ball.z > 0.0f) {
-            if (ball_in_player_stick()) { // test if hits in player stick
-                play_player_pong_sound();
-                // invserse Z component of velocity
-                ball_speed_vector[2] *= -1.0f;
-                change_state(PLAYER_RETURN);
-                // for float precision problems, we must move the ball to positin where stick surface touch ball.
-                ball.z = player_stick.z - ball.width;
-                ball.model_matrix[14] = ball.z;
+}
 
-                to_position[0] = to_position[1] = 0;
+/**
+  Time until a coordinate moving at velocity reaches min or max, or -1 if it doesn't within limit seconds.
+ */
+static float time_to_bound(float position, float velocity, float min, float max, float limit)
+{
+    float time;
+    if (velocity > 0.0f) {
+        time = (max - position) / velocity;
+    } else if (velocity < 0.0f) {
+        time = (min - position) / velocity;
+    } else {
+        return -1.0f;
+    }
+    if (time < 0.0f) {
+        time = 0.0f;
+    }
+    return time <= limit ? time : -1.0f;
+}
 
-                // register point where player hits the ball for, in next frames, calculate desviation vector to apply to ball
-                player_stick.xprev = player_stick.x;
-                player_stick.yprev = player_stick.y;
-                player_stick.zprev = player_stick.z;
-                // enable apply desviation vector
-                lookDesviation = true;
+/**
+  Resolves a contact of ball with a wall (axis 0 or 1) or a stick plane (axis 2) happened
+  elapsed seconds after start of tick. Returns 0 if ball was missed and the point is over.
+ */
+static int resolve_contact(GameContext* ctx, int axis, float elapsed)
+{
+    BODY* ball = &ctx->ball;
+    float* velocity = ctx->ball_speed_vector;
+
+    if (axis == 0) {
+        ball->x = velocity[0] > 0.0f ? ctx->stage.width2 - ball->width : -ctx->stage.width2 + ball->width;
+        velocity[0] = -velocity[0];
+        emit_game_event_at(ctx, WALL_HIT_SOUND, elapsed);
+    } else if (axis == 1) {
+        ball->y = velocity[1] > 0.0f ? ctx->stage.height2 - ball->width : -ctx->stage.height2 + ball->width;
+        velocity[1] = -velocity[1];
+        emit_game_event_at(ctx, WALL_HIT_SOUND, elapsed);
+    } else if (velocity[2] > 0.0f) {
+        // ball reaches player stick
+        ball->z = ctx->player_stick.z - ball->width;
+        if (!ball_in_player_stick(ctx)) {
+            change_state(ctx, OPP_WINS);
+            return 0;
+        }
+        emit_game_event_at(ctx, PLAYER_PONG_SOUND, elapsed);
+        velocity[2] = -velocity[2];
+        change_state(ctx, PLAYER_RETURN);
+        ctx->to_position[0] = ctx->to_position[1] = 0;
+        // register point where player hits the ball to deflect it by stick displacement since then
+        ctx->player_stick_hit_position[0] = ctx->player_stick.x;
+        ctx->player_stick_hit_position[1] = ctx->player_stick.y;
+        ctx->desviation_ticks = DESVIATION_TICKS;
+    } else {
+        // ball reaches computer stick
+        ball->z = ctx->opponent_stick.z + ball->width;
+        if (!ball_in_opponent_stick(ctx)) {
+            change_state(ctx, PLAYER_WINS);
+            return 0;
+        }
+        emit_game_event_at(ctx, OPPONENT_PONG_SOUND, elapsed);
+        ctx->fps_inc -= FRAMES_DEC_FACTOR;
+        if (ctx->fps_inc > 0) {
+            velocity[2] = ctx->stage.large * REFERENCE_FPS / ctx->fps_inc * INITIAL_VELOCITY_FACTOR;
+        } else {
+            velocity[2] = -velocity[2];
+        }
+        change_state(ctx, OPP_RETURN);
+    }
+    return 1;
+}
 
-            } else {
-                change_state(OPP_WINS);
+/**
+  Moves ball one tick as a swept sphere. Contacts with the four walls and the stick planes are
+  found at their exact time within the tick and resolved in order, so a fast ball can't go
+  through a stick and can bounce several times in a tick.
+ */
+static void sweep_ball(GameContext* ctx)
+{
+    BODY* ball = &ctx->ball;
+    float* velocity = ctx->ball_speed_vector;
+    float elapsed = 0.0f;
+
+    for (int contacts = 0; contacts <= MAX_CONTACTS_PER_TICK; contacts++) {
+        float remaining = TICK_TIME - elapsed;
+        float step = remaining;
+        int axis = -1;
+        float times[3];
+
+        times[0] = time_to_bound(ball->x, velocity[0], -ctx->stage.width2 + ball->width, ctx->stage.width2 - ball->width, remaining);
+        times[1] = time_to_bound(ball->y, velocity[1], -ctx->stage.height2 + ball->width, ctx->stage.height2 - ball->width, remaining);
+        times[2] = time_to_bound(ball->z, velocity[2], ctx->opponent_stick.z + ball->width, ctx->player_stick.z - ball->width, remaining);
+        // after too many contacts, rest of tick is lost
+        for (int i = 0; i < 3 && contacts < MAX_CONTACTS_PER_TICK; i++) {
+            if (times[i] >= 0.0f && times[i] <= step) {
+                step = times[i];
+                axis = i;
             }
         }
-        // move stick to center
-        if (!equals(opponent_stick.x, 0.0) || !equals(opponent_stick.y, 0.0))
-            move_opponent_stick(opponent_stick.x + to_position[0], opponent_stick.y + to_position[1]);
-        // no reset frame counter
-        resetFrames = 0;
-    } else if (gameState == PLAYER_RETURN) { // player returns ball
-
-        if (equals(ball.z + ball.width, opponent_stick.z) || ball.z < opponent_stick.z) { // if ball is in Z coord of computer stick...
-
-            if (ball_in_opponent_stick()) {
-                play_opponent_pong_sound();
-
-                fps_inc -= FRAMES_DEC_FACTOR;
-                if (fps_inc > 0)
-                   ball_speed_vector[2] = stage.large / fps_inc * INITIAL_VELOCITY_FACTOR ;
+        move_ball(ctx, ball->x + velocity[0] * step, ball->y + velocity[1] * step, ball->z + velocity[2] * step);
+        elapsed += step;
+        if (axis < 0 || !resolve_contact(ctx, axis, elapsed)) {
+            return;
+        }
+    }
+}
 
-                ball.z = opponent_stick.z + ball.width;
-                ball.model_matrix[14] = ball.z;
-                
-                change_state(OPP_RETURN);
-                resetFrames = 1;
+/**
+  Main game logic.
+ */
 
-            } else {
-                change_state(PLAYER_WINS);
-            }
-        } else {
-            /* 
-             * Computer IA. 
-             * Look ball position each 8 frames and go to such position with a speed inversely proportional to distance to ball.
-            */
-            if (elapsedFrames == 8) {
-                to_position[0] = ball.x - opponent_stick.x;
-                to_position[1] = ball.y - opponent_stick.y;
-                framesToPosition = (int)fabs((opponent_stick.z - ball.z) / ball_speed_vector[2]);
-                if (framesToPosition > 0) {
-                    to_position[0] /= framesToPosition;
-                    to_position[1] /= framesToPosition;
-                } else {
-                    to_position[0] = 0;
-                    to_position[1] = 0;
-                }
-                // reset frames counter to check ball position again
-                resetFrames = 1;
-            }
-            // move computer stick to calculated ball position
-            if (!equals(opponent_stick.x, ball.x) || !equals(opponent_stick.y, 0.0))
-                move_opponent_stick(opponent_stick.x + to_position[0], opponent_stick.y + to_position[1]);
+void playing_task(GameContext* ctx)
+{
+    // computer return ball
+    if (ctx->gameState == OPP_RETURN) {
+        // move stick to center
+        if (!equals(ctx, ctx->opponent_stick.x, 0.0) || !equals(ctx, ctx->opponent_stick.y, 0.0))
+            move_opponent_stick(ctx, ctx->opponent_stick.x + ctx->to_position[0], ctx->opponent_stick.y + ctx->to_position[1]);
+    } else if (ctx->gameState == PLAYER_RETURN) { // player returns ball
+        if (ctx->desviation_ticks && --ctx->desviation_ticks == 0) {
+            // desviation of ball depending on player's stick displacement per reference frame. 6.0 is a magic number to smooth ball desviation
+            ctx->ball_speed_vector[0] += (ctx->player_stick.x - ctx->player_stick_hit_position[0]) * (6.0f / DESVIATION_FRAMES);
+            ctx->ball_speed_vector[1] += (ctx->player_stick.y - ctx->player_stick_hit_position[1]) * (6.0f / DESVIATION_FRAMES);
         }
-        if (lookDesviation) {
-            // desviation of ball depending on player's stick movement. 6.0 is a magic number to smooth ball desviation
-            ball_speed_vector[0] += (player_stick.x - player_stick.xprev) * (6.0f / FPS);
-            ball_speed_vector[1] += (player_stick.y - player_stick.yprev) * (6.0f / FPS);
-            lookDesviation = false;
+        // wall bounces don't change the prediction, so computer plans once per return, after deflection
+        if (ctx->ai_replan && !ctx->desviation_ticks) {
+            ai_plan(ctx);
+            ctx->ai_replan = false;
         }
+        ai_move(ctx);
     }
     // ball movement
-    move_ball(ball.x + ball_speed_vector[0], ball.y + ball_speed_vector[1], ball.z + ball_speed_vector[2]);
-    return resetFrames;
+    sweep_ball(ctx);
+    if (ctx->multiball) {
+        multiball_step(ctx->multiball, ctx, TICK_TIME);
+    }
 }
 
-int opponent_wins_task(int elapsedFrames)
+/**
+  Serves next ball once the point is over, or finishes the game.
+ */
+static void point_over(void* owner, TIMER* timer)
 {
+    GameContext* ctx = (GameContext*)owner;
 
-    if (elapsedFrames == 0) {
-        opponent_score++;
-        play_opponent_wins_sound();
-    } else if (elapsedFrames > 90) {
-        if (balls)
-            change_state(OPP_SERVICE);
-        else
-            change_state(FINISHED);
-        return 1;
+    (void)timer;
+    if (!ctx->balls) {
+        change_state(ctx, FINISHED);
+    } else if (ctx->gameState == PLAYER_WINS) {
+        change_state(ctx, PLAYER_SERVICE);
+    } else {
+        change_state(ctx, OPP_SERVICE);
     }
-    return 0;
 }
 
-int player_wins_task(int elapsedFrames)
+void opponent_wins_task(GameContext* ctx)
 {
-
-    if (elapsedFrames == 0) {
-        player_score++;
-        play_player_wins_sound();
-    } else if (elapsedFrames > 90) {
-        if (balls)
-            change_state(PLAYER_SERVICE);
-        else
-            change_state(FINISHED);
-        return 1;
-    }
-    return 0;
+    ctx->opponent_score++;
+    emit_game_event(ctx, OPPONENT_WINS_SOUND);
+    timer_schedule(&ctx->timers, &ctx->state_timer, SECONDS_TO_TICKS(POINT_OVER_TIME), point_over);
 }
 
-int ball_hit_wall(float* outVector, PONG_ELEMENT* pStage, PONG_ELEMENT* pBall)
+void player_wins_task(GameContext* ctx)
 {
-    outVector[0] = 1.0;
-    outVector[1] = 1.0;
-    if (pBall->x >= (pStage->width2 - pBall->width)) {
-        outVector[0] = -1.0f;
-        move_ball(pStage->width2 - pBall->width, pBall->y, pBall->z);
-        return 1;
-    }
-    if (pBall->x < (-pStage->width2 + pBall->width)) {
-        outVector[0] = -1.0f;
-        move_ball(-pStage->width2 + pBall->width, pBall->y, pBall->z);
-        return 1;
-    }
-    if (pBall->y > (pStage->height2 - pBall->width)) {
-        outVector[1] = -1.0f;
-        move_ball(pBall->x, pStage->height2 - pBall->width, pBall->z);
-
-        return 1;
-    }
-
-    if (pBall->y < (-pStage->height2 + pBall->width)) {
-        outVector[1] = -1.0f;
-        move_ball(pBall->x, -pStage->height2 + pBall->width, pBall->z);
-
-        return 1;
-    }
-
-    return 0;
+    ctx->player_score++;
+    emit_game_event(ctx, PLAYER_WINS_SOUND);
+    timer_schedule(&ctx->timers, &ctx->state_timer, SECONDS_TO_TICKS(POINT_OVER_TIME), point_over);
 }
 
-int opponent_service_task()
+void opponent_service_task(GameContext* ctx)
 {
-    set_initial_ball_velocity();
-    ball_speed_vector[2] *= -1.0f;
-    reset_ball_position();
-    reset_player_stick_position();
-    reset_opponent_stick_position();
-    sys_mouse_center(WINDOW_WIDTH, WINDOW_HEIGHT);
-    move_opponent_stick(0.0f, 0.0f);
-    move_ball(0, 0, opponent_stick.z + ball.width);
-    change_state(OPP_RETURN);
-    balls--;
-    sys_show_cursor(0);
-    return 0;
+    set_initial_ball_velocity(ctx);
+    ctx->ball_speed_vector[2] *= -1.0f;
+    reset_ball_position(ctx);
+    reset_player_stick_position(ctx);
+    reset_opponent_stick_position(ctx);
+    emit_game_event(ctx, CENTER_MOUSE);
+    move_opponent_stick(ctx, 0.0f, 0.0f);
+    move_ball(ctx, 0, 0, ctx->opponent_stick.z + ctx->ball.width);
+    store_previous_positions(ctx);
+    ctx->balls--;
+    emit_game_event(ctx, HIDE_CURSOR);
+    change_state(ctx, OPP_RETURN);
 }
 
-int finished_task(int elapsedFrames)
+void finished_task(GameContext* ctx)
 {
-    if (elapsedFrames == 0) {
-        sys_show_cursor(1);
-    }
-    return 0;
+    emit_game_event(ctx, SHOW_CURSOR);
 }
@@ -8,15 +8,21 @@
 #ifndef _TASKS_H_
 #define _TASKS_H_
 
-#include "msys.h"
+#include "pong3d.h"
 
-int start_screen_task();
-int loading_players_task(int);
-int player_service_task(int, int, SysEvent*);
-int opponent_service_task();
-int playing_task(int);
-int opponent_wins_task(int);
-int player_wins_task(int);
-int finished_task(int);
+void move_player_stick_to_mouse(GameContext* ctx, int mx, int my);
+// tasks run once when their state is entered
+void start_screen_task(void);
+void loading_players_task(GameContext* ctx);
+void player_service_task(GameContext* ctx);
+void player_return_task(GameContext* ctx);
+void opponent_return_task(GameContext* ctx);
+void opponent_service_task(GameContext* ctx);
+void opponent_wins_task(GameContext* ctx);
+void player_wins_task(GameContext* ctx);
+void finished_task(GameContext* ctx);
+// tasks run each tick of their states
+void serving_task(GameContext* ctx, int events);
+void playing_task(GameContext* ctx);
 
 #endif
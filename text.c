@@ -14,12 +14,22 @@
 #include "msys.h"
 #include <ft2build.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include FT_FREETYPE_H
 
 #define NUM_LETTERS 96
-GLuint renderTextUniform;
-GLuint modelMatrixUniform;
+
+// glyphs in each row of the atlas texture
+#define ATLAS_COLUMNS 16
+
+// glyph quads the vertex buffer holds. When it's full, it's orphaned and filled again.
+#define TEXT_MAX_QUADS 256
+
+// a glyph is two triangles of vertices with position (4 floats) and uv (2 floats)
+#define QUAD_VERTICES 6
+#define VERTEX_FLOATS 6
+#define QUAD_FLOATS (QUAD_VERTICES * VERTEX_FLOATS)
 
 FT_Library ft;
 FT_Face face;
@@ -29,20 +39,57 @@ int arrays_initialized = 0;
 
 static float text_model_matrix[16];
 static GLuint vao, vbo;
+static int quads_used;
+
+// all glyphs in one texture, so a string takes a single draw
+static GLuint atlas;
+
+// atlas region of each glyph as u0, v0, u1, v1, and whether it was rendered
+static float glyph_uvs[NUM_LETTERS][4];
+static int glyph_loaded[NUM_LETTERS] = { 0 };
 
-static GLfloat box[] = {
-    1.0f, 1.0f, 0.2f, 1.0f, 1.0f, 1.0f,
-    1.0f, 0.0f, 0.2f, 1.0f, 1.0f, 0,
-    0, 1.0f, 0.2f, 1.0f, 0, 1.0f,
-    0, 0, 0.2f, 1.0f, 0, 0
+// corners of a glyph quad, as the triangle strip it was drawn with before
+static const float quad_corners[QUAD_VERTICES][2] = {
+    { 1.0f, 1.0f }, { 1.0f, 0.0f }, { 0.0f, 1.0f },
+    { 0.0f, 1.0f }, { 1.0f, 0.0f }, { 0.0f, 0.0f }
 };
 
-static GLuint textures[NUM_LETTERS] = { 0 };
+// quads of the string being drawn
+static float quads[TEXT_MAX_QUADS * QUAD_FLOATS];
 
-void render_text(const char* text, float x, float y, float scale)
+static void put_glyph_quad(float* vertices, int column, const float* uvs)
 {
+    for (int v = 0; v < QUAD_VERTICES; v++) {
+        float cx = quad_corners[v][0], cy = quad_corners[v][1];
+        vertices[0] = column + cx;
+        vertices[1] = cy;
+        vertices[2] = 0.2f;
+        vertices[3] = 1.0f;
+        vertices[4] = uvs[0] + (uvs[2] - uvs[0]) * cx;
+        vertices[5] = uvs[1] + (uvs[3] - uvs[1]) * cy;
+        vertices += VERTEX_FLOATS;
+    }
+}
 
-    const char* p;
+// data is the text, params are x, y and scale
+static void draw_text(const DRAW_ITEM* item)
+{
+    const char* text = (const char*)item->data;
+    float x = item->params[0];
+    float y = item->params[1];
+    float scale = item->params[2];
+    int count = 0;
+
+    for (int column = 0; text[column] && count < TEXT_MAX_QUADS; column++) {
+        int index = (unsigned char)text[column] - 32;
+        if (index > 0 && index < NUM_LETTERS && glyph_loaded[index]) {
+            put_glyph_quad(quads + count * QUAD_FLOATS, column, glyph_uvs[index]);
+            count++;
+        }
+    }
+    if (!count) {
+        return;
+    }
 
     text_model_matrix[0] = scale;
     text_model_matrix[5] = -scale;
@@ -50,53 +97,94 @@ void render_text(const char* text, float x, float y, float scale)
     text_model_matrix[12] = x - scale * (strlen(text) >> 1);
     text_model_matrix[13] = y;
 
-    glUniform1i(renderTextUniform, 1);
-
-    glActiveTexture(GL_TEXTURE1);
+    renderer_set_material(MATERIAL_TEXT);
+    renderer_bind_vao(vao);
+    renderer_bind_texture(GL_TEXTURE1, atlas);
+    renderer_set_model_matrix(text_model_matrix);
 
-    glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (quads_used + count > TEXT_MAX_QUADS) {
+        // GPU may still read old quads; new storage avoids waiting for it
+        glBufferData(GL_ARRAY_BUFFER, TEXT_MAX_QUADS * QUAD_FLOATS * sizeof(float), NULL, GL_STREAM_DRAW);
+        quads_used = 0;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, quads_used * QUAD_FLOATS * sizeof(float), count * QUAD_FLOATS * sizeof(float), quads);
+    glDrawArrays(GL_TRIANGLES, quads_used * QUAD_VERTICES, count * QUAD_VERTICES);
+    quads_used += count;
+}
+
+/**
+  Renders printable glyphs into one alpha texture, in cells as large as the largest glyph. Cells
+  have a transparent border, so filtering at glyph edges blends with nothing else.
+ */
+static int create_atlas()
+{
+    int cell_width = 0, cell_height = 0, width, height;
+    unsigned char* pixels;
 
-    for (p = text; *p; p++) {
-        int index = *p - 32;
-        if (*p != ' ') {
-            if (!textures[index]) {
-                if (FT_Load_Char(face, *p, FT_LOAD_RENDER))
-                    continue;
-
-                FT_GlyphSlot g = face->glyph;
-
-                glGenTextures(1, &textures[index]);
-                glBindTexture(GL_TEXTURE_2D, textures[index]);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-                glTexImage2D(
-                    GL_TEXTURE_2D,
-                    0,
-                    GL_ALPHA,
-                    g->bitmap.width,
-                    g->bitmap.rows,
-                    0,
-                    GL_ALPHA,
-                    GL_UNSIGNED_BYTE,
-                    g->bitmap.buffer);
-
-            } else {
-                glBindTexture(GL_TEXTURE_2D, textures[index]);
-            }
-            glUniformMatrix4fv(modelMatrixUniform, 1, GL_FALSE, text_model_matrix);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindTexture(GL_TEXTURE_2D, 0);
+    for (int index = 1; index < NUM_LETTERS; index++) {
+        int glyph_width, glyph_height;
+
+        if (FT_Load_Char(face, index + 32, FT_LOAD_RENDER)) {
+            continue;
         }
-        text_model_matrix[12] += scale;
+        glyph_width = (int)face->glyph->bitmap.width;
+        glyph_height = (int)face->glyph->bitmap.rows;
+        cell_width = glyph_width > cell_width ? glyph_width : cell_width;
+        cell_height = glyph_height > cell_height ? glyph_height : cell_height;
+    }
+    cell_width += 2;
+    cell_height += 2;
+    width = ATLAS_COLUMNS * cell_width;
+    height = (NUM_LETTERS + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS * cell_height;
+    pixels = (unsigned char*)calloc((size_t)width * height, 1);
+    if (!pixels) {
+        log_error("Couldn't create glyph atlas\n");
+        return -1;
+    }
+
+    for (int index = 1; index < NUM_LETTERS; index++) {
+        int x = index % ATLAS_COLUMNS * cell_width + 1;
+        int y = index / ATLAS_COLUMNS * cell_height + 1;
+        FT_GlyphSlot g;
+
+        if (FT_Load_Char(face, index + 32, FT_LOAD_RENDER)) {
+            continue;
+        }
+        g = face->glyph;
+        for (int row = 0; row < (int)g->bitmap.rows; row++) {
+            memcpy(pixels + (size_t)(y + row) * width + x, g->bitmap.buffer + row * g->bitmap.pitch, g->bitmap.width);
+        }
+        glyph_uvs[index][0] = (float)x / width;
+        glyph_uvs[index][1] = (float)y / height;
+        glyph_uvs[index][2] = (float)(x + (int)g->bitmap.width) / width;
+        glyph_uvs[index][3] = (float)(y + (int)g->bitmap.rows) / height;
+        glyph_loaded[index] = 1;
+    }
+
+    glGenTextures(1, &atlas);
+    renderer_bind_texture(GL_TEXTURE1, atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, width, height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, pixels);
+    free(pixels);
+    return 0;
+}
+
+/**
+  Queues text centered at x, drawn over the frame. Text must stay valid until frame is drawn.
+ */
+void submit_text(const char* text, float x, float y, float scale)
+{
+    DRAW_ITEM* item = renderer_submit(DRAW_PASS_OVERLAY, 1, MATERIAL_TEXT, 0, vao, 0.0f, draw_text, text);
+    if (item) {
+        item->params[0] = x;
+        item->params[1] = y;
+        item->params[2] = scale;
     }
-    glBindVertexArray(0);
-    glUniform1i(renderTextUniform, 0);
 }
 
 int init_text_renderer()
@@ -110,29 +198,27 @@ int init_text_renderer()
 		log_error("Could not open font\n");
         return -1;
     }
-    memset(textures, 0, NUM_LETTERS * sizeof(GLuint));
     FT_Set_Pixel_Sizes(face, 0, FONT_SIZE);
+    if (create_atlas() < 0) {
+        return -1;
+    }
 
     GLuint program = renderer_get_main_program();
     glUniform1i(glGetUniformLocation(program, "tex"), 1);
 
-    renderTextUniform = glGetUniformLocation(program, "renderText");
-    modelMatrixUniform = glGetUniformLocation(program, "modelMatrix");
     load_identity_matrix(text_model_matrix);
     
     glGenVertexArrays(1, &vao);
 
     glGenBuffers(1, &vbo);
     
-    glBindVertexArray(vao);
+    renderer_bind_vao(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(float) * 6, 0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_FLOATS, 0);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (char*)NULL + (sizeof(float) * 4));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(float) * VERTEX_FLOATS, (char*)NULL + (sizeof(float) * 4));
     glEnableVertexAttribArray(3);
-    glActiveTexture(GL_TEXTURE1);
-    glBufferData(GL_ARRAY_BUFFER, sizeof box, box, GL_STATIC_DRAW);
-    glBindVertexArray(0);
+    glBufferData(GL_ARRAY_BUFFER, TEXT_MAX_QUADS * QUAD_FLOATS * sizeof(float), NULL, GL_STREAM_DRAW);
     arrays_initialized = 1;
     return 0;
 }
@@ -142,12 +228,13 @@ void dispose_text_renderer()
     if (freetype_initialized) {
         FT_Done_FreeType(ft);
     }
+    renderer_bind_vao(0);
+    renderer_bind_texture(GL_TEXTURE1, 0);
     if (arrays_initialized) {
         glDeleteVertexArrays(1, &vao);
         glDeleteBuffers(1, &vbo);
     }
-    for (int i = 0; i < NUM_LETTERS; i++) {
-      if (textures[i])
-         glDeleteTextures(1, &textures[i]);
+    if (atlas) {
+        glDeleteTextures(1, &atlas);
     }
 }
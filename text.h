@@ -9,7 +9,7 @@
 #define _TEXT_H_
 
 int init_text_renderer();
-void render_text(const char* text, float x, float y, float scale);
+void submit_text(const char* text, float x, float y, float scale);
 void dispose_text_renderer();
 
 #endif
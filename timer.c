@@ -0,0 +1,106 @@
+/**
+  @file timer.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Hierarchical timer wheel counting simulation ticks.
+
+  A timer goes to the lowest level whose span covers its delay, in the slot of its expiration
+  tick at that level. Each time the slot index of a level wraps, next slot of the level above is
+  moved down, so timers reach level 0 before they expire. Scheduling and cancelling are O(1),
+  and each tick only the due slot is visited.
+ */
+
+#include "timer.h"
+#include <string.h>
+
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+// longest delay wheel can hold, in ticks
+#define TIMER_MAX_TICKS ((1u << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+void timer_wheel_init(TIMER_WHEEL* wheel)
+{
+    memset(wheel, 0, sizeof(TIMER_WHEEL));
+}
+
+static void place_timer(TIMER_WHEEL* wheel, TIMER* timer)
+{
+    uint32_t delta = timer->expires - wheel->now;
+    int level = 0;
+    TIMER** slot;
+
+    while (level < TIMER_LEVELS - 1 && delta >= (1u << (TIMER_SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    slot = &wheel->slots[level][(timer->expires >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK];
+    timer->next = *slot;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+  Schedules callback to run ticks ticks from now (at least 1). A pending timer is rescheduled.
+ */
+void timer_schedule(TIMER_WHEEL* wheel, TIMER* timer, uint32_t ticks, TIMER_CALLBACK callback)
+{
+    timer_cancel(timer);
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+    timer->expires = wheel->now + ticks;
+    timer->callback = callback;
+    place_timer(wheel, timer);
+}
+
+void timer_cancel(TIMER* timer)
+{
+    if (!timer->pprev) {
+        return;
+    }
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+int timer_pending(const TIMER* timer)
+{
+    return timer->pprev != NULL;
+}
+
+/**
+  Advances wheel one tick, running callbacks of timers that expire in it.
+ */
+void timer_wheel_run(TIMER_WHEEL* wheel, void* owner)
+{
+    TIMER* list;
+
+    wheel->now++;
+    // move down timers of upper levels whose slot has come
+    for (int level = 1; level < TIMER_LEVELS; level++) {
+        TIMER** slot;
+        if (wheel->now & ((1u << (TIMER_SLOT_BITS * level)) - 1)) {
+            break;
+        }
+        slot = &wheel->slots[level][(wheel->now >> (TIMER_SLOT_BITS * level)) & TIMER_SLOT_MASK];
+        list = *slot;
+        *slot = NULL;
+        while (list) {
+            TIMER* timer = list;
+            list = timer->next;
+            place_timer(wheel, timer);
+        }
+    }
+    // callbacks may schedule or cancel any timer, so due ones are taken one by one
+    while ((list = wheel->slots[0][wheel->now & TIMER_SLOT_MASK]) != NULL) {
+        timer_cancel(list);
+        list->callback(owner, list);
+    }
+}
@@ -0,0 +1,50 @@
+/**
+  @file timer.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Hierarchical timer wheel counting simulation ticks.
+ */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdint.h>
+
+// slots of each wheel level are 2^TIMER_SLOT_BITS
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS 4
+
+struct TIMER;
+
+/**
+  Called when a timer expires, with owner given to timer_wheel_run. It may schedule timers again.
+ */
+typedef void (*TIMER_CALLBACK)(void* owner, struct TIMER* timer);
+
+/**
+  @brief A scheduled callback. Timers are owned by the caller, so scheduling doesn't allocate.
+ */
+typedef struct TIMER {
+    struct TIMER* next;
+    /** pointer that points to this timer in its slot list, NULL when timer isn't scheduled */
+    struct TIMER** pprev;
+    uint32_t expires;
+    TIMER_CALLBACK callback;
+} TIMER;
+
+/**
+  @brief Timer lists by expiration tick. Level n slots span TIMER_SLOTS^n ticks each.
+ */
+typedef struct {
+    TIMER* slots[TIMER_LEVELS][TIMER_SLOTS];
+    uint32_t now;
+} TIMER_WHEEL;
+
+void timer_wheel_init(TIMER_WHEEL* wheel);
+void timer_schedule(TIMER_WHEEL* wheel, TIMER* timer, uint32_t ticks, TIMER_CALLBACK callback);
+void timer_cancel(TIMER* timer);
+int timer_pending(const TIMER* timer);
+void timer_wheel_run(TIMER_WHEEL* wheel, void* owner);
+
+#endif
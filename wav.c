@@ -0,0 +1,124 @@
+/**
+  @file wav.c
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Loading of WAV files.
+ */
+
+#include "wav.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+
+static unsigned int read_u16(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8);
+}
+
+static unsigned int read_u32(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+static float read_sample(const unsigned char* bytes, int format, int bits)
+{
+    if (format == WAV_FORMAT_FLOAT) {
+        float value;
+        unsigned int raw = read_u32(bytes);
+        memcpy(&value, &raw, sizeof(float));
+        return value;
+    }
+    if (bits == 8) {
+        return (bytes[0] - 128) / 128.0f;
+    }
+    if (bits == 16) {
+        return (short)read_u16(bytes) / 32768.0f;
+    }
+    // 24 bits, sign extended from top byte
+    return (float)((int)(read_u32(bytes) << 8) >> 8) / 8388608.0f;
+}
+
+static unsigned char* read_file(const char* path, long* size)
+{
+    FILE* file = fopen(path, "rb");
+    unsigned char* data = NULL;
+
+    if (!file) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (*size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        data = (unsigned char*)malloc(*size);
+        if (data && fread(data, 1, *size, file) != (size_t)*size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+  Loads a PCM (8, 16 or 24 bits) or float WAV file, mixing its channels down to mono. samples are
+  allocated and must be released with free. Returns -1 if file can't be read or format isn't supported.
+ */
+int wav_load(const char* path, float** samples, int* frames, int* sample_rate)
+{
+    long size = 0;
+    unsigned char* data = read_file(path, &size);
+    const unsigned char* chunk;
+    const unsigned char* format_chunk = NULL;
+    int format = 0, channels = 0, bits = 0, frame_bytes;
+    int result = -1;
+
+    if (!data) {
+        return -1;
+    }
+    if (size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) {
+        free(data);
+        return -1;
+    }
+    for (chunk = data + 12; chunk + 8 <= data + size;) {
+        unsigned int chunk_size = read_u32(chunk + 4);
+        if (chunk_size > (unsigned int)(data + size - chunk - 8)) {
+            break;
+        }
+        if (!memcmp(chunk, "fmt ", 4) && chunk_size >= 16) {
+            format_chunk = chunk + 8;
+            format = read_u16(format_chunk);
+            channels = read_u16(format_chunk + 2);
+            *sample_rate = read_u32(format_chunk + 4);
+            bits = read_u16(format_chunk + 14);
+            // extensible format keeps the actual one in its subformat
+            if (format == 0xFFFE && chunk_size >= 26) {
+                format = read_u16(format_chunk + 24);
+            }
+        } else if (!memcmp(chunk, "data", 4) && format_chunk) {
+            int supported = (format == WAV_FORMAT_PCM && (bits == 8 || bits == 16 || bits == 24)) || (format == WAV_FORMAT_FLOAT && bits == 32);
+            if (!supported || channels < 1) {
+                break;
+            }
+            frame_bytes = channels * bits / 8;
+            *frames = chunk_size / frame_bytes;
+            *samples = (float*)malloc(sizeof(float) * (*frames > 0 ? *frames : 1));
+            if (!*samples) {
+                break;
+            }
+            for (int i = 0; i < *frames; i++) {
+                float sum = 0.0f;
+                for (int c = 0; c < channels; c++) {
+                    sum += read_sample(chunk + 8 + i * frame_bytes + c * bits / 8, format, bits);
+                }
+                (*samples)[i] = sum / channels;
+            }
+            result = 0;
+            break;
+        }
+        // chunks are padded to even size
+        chunk += 8 + chunk_size + (chunk_size & 1);
+    }
+    free(data);
+    return result;
+}
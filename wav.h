@@ -0,0 +1,13 @@
+/**
+  @file wav.h
+  @author Alejandro Ambroa
+  @date 1 Oct 2017
+  @brief Loading of WAV files.
+ */
+
+#ifndef _WAV_H_
+#define _WAV_H_
+
+int wav_load(const char* path, float** samples, int* frames, int* sample_rate);
+
+#endif